@@ -54,6 +54,15 @@ pub fn build(b: *std.Build) void {
     if (b.option([]const u8, "TEST_FILTER", "Test filter")) |filter| {
         exe.root_module.addCMacro("TEST_FILTER", filter);
     }
+    if (b.option([]const u8, "BENCH_FILTER", "Benchmark filter")) |filter| {
+        exe.root_module.addCMacro("BENCH_FILTER", filter);
+    }
+    if (b.option([]const u8, "BENCH_BUDGET", "Seconds of samples per benchmark")) |budget| {
+        exe.root_module.addCMacro("BENCH_BUDGET", budget);
+    }
+    if (b.option(bool, "OPPROFILE", "Dump eval op pair counts at exit") orelse false) {
+        exe.root_module.addCMacro("OPPROFILE_MODE", "");
+    }
 
     addCSourceFromDir(exe, b.path(srcdir), cflags.items);
 
@@ -1,9 +1,38 @@
 /**
  * @file include/benchmarking.h
  * @brief Define macros for benchmarking
+ * @note Only benchmarks whose name contains BENCH_FILTER run, if defined
+ *
+ * Each benchmark is warmed up, then run in batches sized so that a sample
+ * is well above the resolution of the clock, for as many samples as fit
+ * in BENCH_BUDGET seconds (at most REPEAT). The cost of timing an empty
+ * batch is subtracted from every sample before the statistics are taken.
+ *
+ * With BENCH_PERF set in the environment, the sampling also runs under a
+ * group of perf_event_open counters, whose totals are reported per call
+ * less those of the empty batch. Without access to them, only time is
+ * reported.
+ *
+ * A bench_rate body returns the units of work it did, such as operators
+ * or lines, and is reported as a rate too. Workloads read their inputs
+ * from corpus files under $BENCH_CORPUS (bench by default).
  */
 
 #pragma once
+#include <stddef.h>
+
+//! @brief Lines of a corpus file, blank ones and ';' comments left out
+typedef struct {
+  char name[32];
+  char path[256];
+  char *text; // the lines point into it
+  char **lines;
+  size_t n;
+} benchcorpus_t;
+
+[[gnu::nonnull, gnu::returns_nonnull]] benchcorpus_t const *
+benchCorpus(char const *);
+
 #ifdef BENCHMARK_MODE
  #include "ansiesc.h"
  #include <stdio.h>
@@ -12,42 +41,72 @@
  #ifndef REPEAT
   #define REPEAT 10'000
  #endif
+ #ifndef BENCH_BUDGET
+  #define BENCH_BUDGET 0.2
+ #endif
 
  #define BENCH_HEADER " ■ " ESCBLU "Benchmarking " ESCLR
 
- #define bench(name) \
-   static void BENCH_bench##name(); \
-   [[gnu::constructor]] static void BENCH_run##name() { \
-     printf(BENCH_HEADER ESBLD #name ESCLR "..."); \
-     double duration = 0; \
-     for (int i = 0; i < REPEAT; i++) { \
-       clock_t begin = clock(); \
-       [[clang::always_inline]] BENCH_bench##name(); \
-       clock_t end = clock(); \
-       duration += difftime(end, begin) / CLOCKS_PER_SEC * 1e6; \
-     } \
-     printf(" => %.6f microsecs\n", duration / REPEAT); \
+//! @brief Clock of the samples
+typedef enum {
+  BENCH_TIME,  // CLOCK_MONOTONIC_RAW, in microseconds
+  BENCH_CYCLE, // cycle counter (rdtsc on x86-64), in cycles
+} benchclock_t;
+
+//! @brief Hardware events counted as one group, the leader first
+typedef enum {
+  BENCH_EV_CYCLES,
+  BENCH_EV_INSTRUCTIONS,
+  BENCH_EV_BRANCH_MISSES,
+  BENCH_EV_L1D_MISSES,
+  BENCH_EV_LLC_MISSES,
+  BENCH_EV_N,
+} benchev_t;
+
+//! @brief Distribution of the cost of one call, in the unit of the clock
+typedef struct {
+  size_t samples, batch; // calls per sample
+  double min, median, p90, p99, mean, stddev;
+  double events[BENCH_EV_N]; // per call, NaN unless counted
+} benchstat_t;
+
+[[gnu::nonnull]] bool benchSelected(char const *);
+[[gnu::nonnull]] benchstat_t
+benchRun(char const *, void (*)(size_t), benchclock_t);
+[[gnu::nonnull]] void
+benchRate(char const *, void (*)(size_t), double const *, char const *);
+
+ #define BENCH_DEFINE(id, name, clk) \
+   static void BENCH_bench##id(); \
+   static void BENCH_batch##id(size_t n) { \
+     for (size_t i = 0; i < n; i++) \
+       [[clang::always_inline]] BENCH_bench##id(); \
+   } \
+   [[gnu::constructor]] static void BENCH_run##id() { \
+     benchRun(name, BENCH_batch##id, clk); \
    } \
-   static void BENCH_bench##name()
+   static void BENCH_bench##id()
 
+ #define bench(name) BENCH_DEFINE(name, #name, BENCH_TIME)
  #define bench_cycle(name) \
-   static void BENCH_benchcycle##name(); \
-   [[gnu::constructor]] static void BENCH_runcycle##name() { \
-     printf(BENCH_HEADER ESBLD #name ESCLR "..."); \
-     double cycle = 0; \
-     for (int i = 0; i < REPEAT; i++) { \
-       unsigned long long begin = __builtin_readcyclecounter(); \
-       [[clang::always_inline]] BENCH_benchcycle##name(); \
-       unsigned long long end = __builtin_readcyclecounter(); \
-       cycle += (double)(end - begin); \
-     } \
-     printf(" => %.6f cycle\n", cycle / REPEAT); \
+   BENCH_DEFINE(cycle##name, #name "_cycle", BENCH_CYCLE)
+
+ #define bench_rate(name, unit) \
+   static double BENCH_rate##name(); \
+   static double BENCH_units##name; /* of the last call */ \
+   static void BENCH_batchr##name(size_t n) { \
+     for (size_t i = 0; i < n; i++) \
+       BENCH_units##name = BENCH_rate##name(); \
+   } \
+   [[gnu::constructor]] static void BENCH_runr##name() { \
+     benchRate(#name, BENCH_batchr##name, &BENCH_units##name, unit); \
    } \
-   static void BENCH_benchcycle##name()
+   static double BENCH_rate##name()
 
  #define main BENCH_dummymain
 #else
 // --gc-sections
- #define bench(a)       [[gnu::unused]] static void BENCH_dum##a()
- #define bench_cycle(a) [[gnu::unused]] static void BENCH_dumc##a()
+ #define bench(a)         [[gnu::unused]] static void BENCH_dum##a()
+ #define bench_cycle(a)   [[gnu::unused]] static void BENCH_dumc##a()
+ #define bench_rate(a, u) [[gnu::unused]] static double BENCH_dumr##a()
 #endif
@@ -0,0 +1,23 @@
+/**
+ * @file include/binio.h
+ * @brief Define binary record formats for pipelines
+ *
+ * Output record (native endianness):
+ *   uint32_t rtype, then
+ *   RTYPE_REAL: double
+ *   RTYPE_COMP: double re, double im
+ *   RTYPE_MATR: uint64_t rows, uint64_t cols, rows * cols * (re, im)
+ *   RTYPE_LAMB: uint64_t len, len bytes of body
+ *   RTYPE_VECT: uint64_t len, len doubles
+ *
+ * Input frame:
+ *   uint32_t argc (<= arg_n), then argc doubles bound to $1..$argc
+ */
+
+#pragma once
+#include "main.h"
+#include <stdio.h>
+
+void printElemBinary(elem_t);
+[[gnu::nonnull]] void printDoublesBinary(double const *, size_t);
+[[gnu::nonnull]] void binReaderLoop(FILE *, char const *);
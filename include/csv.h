@@ -0,0 +1,8 @@
+/**
+ * @file include/csv.h
+ */
+
+#pragma once
+#include <stdio.h>
+
+[[gnu::nonnull]] void csvLoop(FILE *, char const *);
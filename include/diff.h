@@ -0,0 +1,33 @@
+/**
+ * @file include/diff.h
+ * @brief Derivatives of lambdas
+ *
+ * The dual engine runs a body on dual numbers, a value and its derivative
+ * by $1, through a dispatch table that mirrors the one of real mode. It is
+ * exact and costs about two plain evaluations, but gives up on tokens it
+ * has no rule for, such as nested lambdas, vectors and register writes.
+ *
+ * The numeric engine extrapolates central differences with shrinking
+ * steps (Ridders), and works for anything that can be evaluated.
+ */
+
+#pragma once
+#include "rtconf.h"
+
+constexpr size_t diff_rows = 10; // steps, each sampled on both sides
+
+//! @brief Value and derivative
+typedef struct {
+  double v, d;
+} dual_t;
+
+/**
+ * @brief Function sampled at n points at once
+ * @param[out] ys n values of each of the dim components, component-major
+ */
+typedef void (*difffn_t)(void *ctx, double const *xs, size_t n, double *ys);
+
+[[gnu::nonnull(1, 2, 4)]] bool
+diffDual(lambda_t const *, double const *, rrtinfo_t const *, dual_t *);
+[[gnu::nonnull(1, 5)]] void
+diffRichardson(difffn_t, void *, size_t, double, double *);
@@ -22,6 +22,9 @@ typedef enum {
   ERR_UNKNOWN_COMMAND,
   ERR_REACHED_UNREACHABLE,
   ERR_UNKNOWN_OPTION,
+  ERR_CONNECTION_FAILURE,
+  ERR_MISSING_OPERAND,
+  ERR_UNSET_REGISTER,
 } errcode_t;
 
 #define panic(e, ...) \
@@ -8,9 +8,10 @@
 #include "rtconf.h"
 
 constexpr size_t arg_n = 8;
+constexpr size_t stack_size = 1 << 10; // operand slots, shared by all calls
 
 typedef struct {
-  real_t payload[buf_size];
+  real_t payload[stack_size];
   real_t *rbp, *rsp;
 } stack_t;
 
@@ -25,15 +26,19 @@ typedef struct {
   char const *rip;
 } ctrl_t;
 
+//! @brief Interpreted lambda call in progress
 typedef struct {
-  // to restore argv
-  // register the list of args
-  real_t *callstack[arg_n];
-  unsigned callstacki;
-  // to restore rsp
-  // register the number of args used
-  char argc[arg_n];
-  unsigned argci;
+  lambda_t const *lmd;
+  real_t *args;           // caller's $1..$8
+  char const *expr, *rip; // caller's position, at its '!'
+  bool memo;              // store the result under argv on return
+  double argv[arg_n];
+} callframe_t;
+
+typedef struct {
+  callframe_t *frames; // inl until deeper calls move it to the heap
+  size_t framei, framecap;
+  callframe_t inl[arg_n];
 } dump_t;
 
 /**
@@ -49,3 +54,10 @@ typedef struct {
 [[gnu::nonnull]] elem_t evalExprReal(char const *);
 [[gnu::nonnull]] void rpxEval(machine_t *);
 [[gnu::nonnull]] void initEvalinfo(machine_t *);
+[[gnu::nonnull]] real_t evalWithArgs(machine_t *, char const *, real_t *);
+[[gnu::nonnull(2, 3)]] double
+callLmd(machine_t *, lambda_t const *, double const *);
+[[gnu::nonnull(2, 3, 5)]] void
+callLmdEach(machine_t *, lambda_t const *, double const *, size_t, double *);
+[[gnu::nonnull]] machine_t *newScratch(machine_t const *, lambda_t const *);
+elem_t realToElem(real_t);
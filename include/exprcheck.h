@@ -0,0 +1,20 @@
+/**
+ * @file include/exprcheck.h
+ * @brief Check real mode expressions before they are evaluated
+ *
+ * The evaluator trusts its input: it does not check for stack underflow,
+ * unset registers or calls of values that are not lambdas. The check runs
+ * an expression on the kinds of its values (number, lambda, unknown) in
+ * place of the values, following the lambdas it calls, and refuses what
+ * the evaluator would crash on, as far as the kinds can tell.
+ */
+
+#pragma once
+#include "errcode.h"
+#include "rtconf.h"
+
+constexpr size_t check_depth = 4;   // nested calls followed
+constexpr size_t check_calls = 256; // bodies run per expression
+
+[[gnu::nonnull]] errcode_t
+checkExprReal(char const *, rrtinfo_t const *, char const **);
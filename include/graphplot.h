@@ -3,8 +3,10 @@
  */
 
 #pragma once
+#include <stddef.h>
 
 void initPlotCfg();
 void plotexpr(char const *);
 void plotexprImplicit(char const *);
 void changePlotCfg(char const *);
+[[gnu::nonnull]] void plotPoints(double const *, size_t, size_t);
@@ -0,0 +1,26 @@
+/**
+ * @file include/jit.h
+ * @brief Native code for hot real number mode expressions
+ */
+
+#pragma once
+#include "regir.h"
+
+constexpr size_t jit_threshold = 64; // evaluations before compiling
+
+//! @brief SysV ABI, args[0] is $1
+typedef double (*jitfn_t)(double const *);
+
+typedef struct {
+  char const *expr;
+  size_t count; // interpreted evaluations, stops at jit_threshold
+  jitfn_t fn;   // nullptr until compiled
+  irprog_t *ir; // nullptr until compiled, run when fn is not available
+  void *page;
+  size_t pagesize;
+} jitexpr_t;
+
+[[gnu::nonnull]] void jitInit(jitexpr_t *, char const *);
+[[gnu::nonnull]] bool jitCompile(jitexpr_t *, machine_t *);
+[[gnu::nonnull]] real_t jitEval(jitexpr_t *, machine_t *, real_t *);
+[[gnu::nonnull]] void jitFree(jitexpr_t *);
@@ -0,0 +1,43 @@
+/**
+ * @file include/lambda.h
+ * @brief Interned lambda bodies
+ *
+ * Each distinct body is stored once and never freed, so a lambda on the
+ * stack or in a register is a plain pointer to its entry. Bodies that the
+ * register IR accepts are compiled when they are interned.
+ *
+ * A body starting with '#' is memoized: results are cached per argument
+ * bits in a bounded table with LRU eviction. The marker is a promise that
+ * the body depends on nothing but $1..$argc.
+ */
+
+#pragma once
+#include "regir.h"
+#include <stdint.h>
+
+constexpr size_t memo_ways = 8;   // entries probed per key
+constexpr size_t memo_sets = 512; // must be a power of 2
+
+struct lambda {
+  char *body;     // NUL-terminated, without the braces but preceded by '{'
+  size_t len;
+  uint64_t hash;
+  size_t argc;    // highest $k before ',' or ';' outside nested lambdas
+  bool memo;      // body starts with '#'
+  irinst_t *code; // nullptr if the body has to be interpreted
+  bool batch;     // code may run through irExecBatch
+};
+
+typedef struct {
+  uint64_t hits, misses, evictions;
+  size_t len; // entries in use
+} memostat_t;
+
+[[gnu::nonnull, gnu::returns_nonnull]] lambda_t const *
+lmdIntern(char const *, size_t);
+[[gnu::nonnull, gnu::returns_nonnull]] lambda_t const *lmdLiteral(char const *);
+[[gnu::nonnull]] size_t lmdArgc(char const *);
+[[gnu::nonnull]] bool memoGet(lambda_t const *, double const *, real_t *);
+[[gnu::nonnull]] void memoPut(lambda_t const *, double const *, real_t);
+memostat_t memoStat(void);
+void memoClear(void);
@@ -16,8 +16,6 @@ constexpr size_t buf_size = 64;
   case cas: \
     var = fn(var); \
     break;
-// overwrite the top of the stack with the function in the parameter
-#define OVERWRITE_REAL(cas, fn) OVERWRITE(cas, ei->s.rsp->elem.real, fn)
 #define OVERWRITE_COMP(cas, fn) OVERWRITE(cas, rsp->elem.comp, fn)
 
 //! @brief Set of types to handle
@@ -26,6 +24,7 @@ typedef enum {
   RTYPE_COMP = 0x02,
   RTYPE_MATR = 0x04,
   RTYPE_LAMB = 0x08,
+  RTYPE_VECT = 0x10,
 } rtype_t /* result type */;
 
 //! @brief Wrapper of types to handle
@@ -33,7 +32,8 @@ typedef union {
   double real;
   complex comp;
   matrix_t matr;
-  char *lamb;
+  char *lamb;       // interned body, never freed
+  struct vec *vect; // temporary of the evaluating thread, see vec.h
 } result_t;
 
 //! @brief Tagged union of types to handle
@@ -42,14 +42,22 @@ typedef struct {
   rtype_t rtype;
 } elem_t;
 
+typedef struct lambda lambda_t; // interned body, see lambda.h
+typedef struct vec vec_t;       // dense vector, see vec.h
+
 typedef struct {
   union {
     double real;
-    char *lamb;
+    lambda_t const *lamb;
+    vec_t *vec;
+    void *frame; // rbp saved by an open group
   } elem;
   bool isnum;
+  bool isvec; // only when !isnum, otherwise a lambda
 } real_t;
 
+extern void (*print_elem)(elem_t);
+
 void procAList(int, char const **);
 void readerLoop(FILE *);
 elem_t evalExprComplex(char const *);
@@ -59,5 +67,6 @@ void printComplexComplex(complex);
 void printComplexPolar(complex);
 void printMatrix(matrix_t);
 void printLambda(char const *);
+void printVector(vec_t const *);
 void procCmds(char const *);
 overloadable void printany(elem_t);
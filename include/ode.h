@@ -0,0 +1,43 @@
+/**
+ * @file include/ode.h
+ * @brief Runge-Kutta integration of small ODE systems
+ *
+ * The adaptive method is Dormand-Prince 5(4) with the step chosen from the
+ * embedded error estimate, reusing the last stage as the first one of the
+ * next step. The fixed one is the classic RK4 with a set number of steps.
+ * All stage buffers live on the stack, sized for ode_max_dim components.
+ */
+
+#pragma once
+#include "evalfn.h"
+
+constexpr size_t ode_max_dim = arg_n - 1; // $1 is t
+constexpr size_t ode_max_steps = 1 << 20;
+
+//! @brief dy = f(t, y), dim components each
+typedef void (*odefn_t)(
+  void *ctx, double t, double const *y, size_t dim, double *dy
+);
+//! @brief Receiver of every accepted point, the initial one first
+typedef void (*odesink_t)(void *ctx, double t, double const *y, size_t dim);
+
+//! @brief Where the operator sends trajectories
+typedef enum {
+  ODE_OUT_NONE,
+  ODE_OUT_PLOT,
+  ODE_OUT_BINARY,
+} odeout_t;
+
+//! @brief Report of the last integration of the calling thread
+typedef struct {
+  size_t steps, rejected, evals;
+  bool rk4;
+} odestat_t;
+
+[[gnu::nonnull(1, 6)]] void
+odeSolve(odefn_t, void *, size_t, double, double, double *, odesink_t, void *);
+odestat_t odeStat(void);
+void odeSetTol(double);
+void odeSetRk4(size_t);
+void odeSetOut(odeout_t);
+odeout_t odeOut(void);
@@ -4,4 +4,6 @@
 
 #pragma once
 
-void optexpr(char *);
+[[gnu::nonnull]] void optexpr(char *);
+[[gnu::nonnull]] void optexprInvariant(char *);
+[[gnu::nonnull]] void optexprSpaces(char *);
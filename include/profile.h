@@ -0,0 +1,42 @@
+/**
+ * @file include/profile.h
+ * @brief Opt-in profiler of the real and complex evaluators
+ *
+ * While it is on, every dispatched token is counted, per slot of
+ * eval_table in real mode and per character in complex mode. About one in
+ * prof_period tokens is timed with the cycle counter and stands for the
+ * tokens since the last sample, so the cycles are estimates. A sample also
+ * counts for the lambda bodies it runs under, once each, which makes their
+ * cycles inclusive; input lines are timed whole.
+ *
+ * Only the thread that turned it on records. The evaluators choose their
+ * instrumented dispatch loop once per evaluation, so the cost while it is
+ * off is one check per expression.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr uint32_t prof_period = 64; // mean tokens per sample
+constexpr size_t prof_depth = 32;    // frames of a folded stack, then cut
+
+typedef enum {
+  PROF_REAL,
+  PROF_COMPLEX,
+  PROF_MODE_N,
+} profmode_t;
+
+bool profOn(void);
+bool profToggle(void);
+void profClear(void);
+void profReport(void);
+[[gnu::nonnull]] bool profFolded(char const *);
+
+[[gnu::nonnull]] void profLineBegin(char const *);
+void profLineEnd(void);
+[[gnu::nonnull]] void profCall(char const *);
+[[gnu::nonnull]] void profEnter(char const *);
+void profLeave(void);
+bool profCount(profmode_t, char);
+void profSample(profmode_t, char, uint64_t);
@@ -0,0 +1,33 @@
+/**
+ * @file include/quad.h
+ * @brief Adaptive Gauss-Kronrod quadrature
+ *
+ * Panels are integrated with the 7-point Gauss and 15-point Kronrod rules,
+ * and the panels with the largest error estimates are bisected until the
+ * total estimate meets the tolerance. Infinite bounds are mapped onto a
+ * finite interval first.
+ */
+
+#pragma once
+#include <stddef.h>
+
+constexpr size_t quad_nodes = 15;       // integrand values per panel
+constexpr size_t quad_max_panels = 2000;
+
+/**
+ * @brief Integrand, evaluated at all quad_nodes nodes of a panel at once
+ * @param[out] ys n values of each of the dim components, component-major
+ */
+typedef void (*quadfn_t)(void *ctx, double const *xs, size_t n, double *ys);
+
+//! @brief Report of the last integral of the calling thread
+typedef struct {
+  double tol; // requested relative tolerance
+  double err; // estimated absolute error
+  size_t evals, panels;
+} quadstat_t;
+
+[[gnu::nonnull(1, 6)]] void
+quadIntegrate(quadfn_t, void *, size_t, double, double, double *, bool);
+quadstat_t quadStat(void);
+void quadSetTol(double);
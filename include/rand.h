@@ -8,3 +8,4 @@
 uint64_t xorsh();
 double xorsh0to1();
 void sxorsh(uint64_t);
+void initXorsh();
@@ -0,0 +1,63 @@
+/**
+ * @file include/regir.h
+ * @brief Register IR for real number mode expressions
+ *
+ * Stack depth is static in expressions without lambdas, so every stack slot
+ * becomes a virtual register and operators become three-address code.
+ */
+
+#pragma once
+#include "evalfn.h"
+
+constexpr size_t ir_cap = buf_size * 2;
+constexpr size_t ir_lanes = 8; // calls irExecBatch runs at once
+
+typedef enum {
+  IR_IMM,   // dst = imm
+  IR_ARG,   // dst = args[k]
+  IR_LOAD,  // dst = *src
+  IR_STORE, // *reg = a
+  IR_MOV,   // dst = a
+  IR_ADD,   // dst = a + b
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_CALL0, // dst = fn0()
+  IR_CALL1, // dst = fn1(a)
+  IR_CALL2, // dst = fn2(a, b)
+  IR_CALL3, // dst = fn3(a, b, c)
+  IR_CMP,   // dst = fnv(&dst, b, c): b slots from dst chained with op c
+  IR_RET,   // return a
+} irop_t;
+
+typedef struct {
+  irop_t op;
+  size_t dst, a, b, c;
+  size_t depth; // slots in use before the instruction
+  bool bimm;    // b is imm instead of a slot
+  union {
+    double imm;
+    size_t k;
+    double const *src;
+    real_t *reg;
+    double (*fn0)(void);
+    double (*fn1)(double);
+    double (*fn2)(double, double);
+    double (*fn3)(double, double, double);
+    double (*fnv)(double const *, size_t, int);
+  };
+} irinst_t;
+
+typedef struct {
+  irinst_t code[ir_cap];
+  size_t n;
+  size_t nslots; // highest depth reached
+} irprog_t;
+
+[[gnu::nonnull(1, 2)]] bool irCompile(irprog_t *, char const *, machine_t *);
+[[gnu::nonnull]] double irRun(irprog_t const *, double const *);
+[[gnu::nonnull]] double irExec(irinst_t const *, double const *);
+[[gnu::nonnull]] bool irBatchable(irinst_t const *);
+[[gnu::nonnull]] void irExecBatch(
+  irinst_t const *, double const *, double const *, size_t, double *
+);
@@ -0,0 +1,8 @@
+/**
+ * @file include/server.h
+ */
+
+#pragma once
+
+[[gnu::nonnull, noreturn]] void serve(char const *);
+[[gnu::nonnull]] void client(char const *);
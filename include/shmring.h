@@ -0,0 +1,60 @@
+/**
+ * @file include/shmring.h
+ * @brief Define shared-memory request/result rings
+ *
+ * The producer registers expressions by making gen[id] odd, writing
+ * exprs[id] and making gen[id] even again (a seqlock, so that rpx never
+ * compiles a half-written one), then pushes requests referring to id. rpx
+ * pops requests, evaluates the registered expression with args bound to
+ * $1..$argc and pushes results carrying the same seq.
+ *
+ * rpx attaches only to a segment of sizeof(shmseg_t) bytes that carries
+ * shm_magic or is still all zero.
+ */
+
+#pragma once
+#include "evalfn.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+constexpr size_t ring_size = 1 << 10; // must be a power of 2
+constexpr size_t shm_expr_n = 64;
+constexpr uint64_t shm_magic = 0x72'70'78'73'68'6d'00'01; // "rpxshm" v1
+
+typedef struct {
+  uint64_t seq;
+  uint32_t id;
+  uint32_t argc;
+  double args[arg_n];
+} shmreq_t;
+
+typedef struct {
+  uint64_t seq;
+  double result;
+} shmres_t;
+
+// single producer, single consumer
+#define DEF_RING(name, T) \
+  typedef struct { \
+    alignas(64) _Atomic uint64_t head; \
+    alignas(64) _Atomic uint64_t tail; \
+    alignas(64) T slots[ring_size]; \
+  } name##ring_t; \
+  [[gnu::nonnull]] bool name##Push(name##ring_t *, T const *); \
+  [[gnu::nonnull]] bool name##Pop(name##ring_t *, T *);
+DEF_RING(req, shmreq_t)
+DEF_RING(res, shmres_t)
+#undef DEF_RING
+
+typedef struct {
+  uint64_t magic;
+  _Atomic bool stop;
+  uint32_t spin;     // polls before backing off, 0 for default
+  uint32_t sleep_ns; // longest sleep between polls, 0 for default
+  _Atomic uint32_t gen[shm_expr_n];
+  char exprs[shm_expr_n][buf_size];
+  reqring_t req;
+  resring_t res;
+} shmseg_t;
+
+[[gnu::nonnull]] void shmServe(char const *);
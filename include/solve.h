@@ -0,0 +1,31 @@
+/**
+ * @file include/solve.h
+ * @brief Roots and minima of functions of one variable on a bracket
+ *
+ * Brent's root finder needs only values and a sign change over the
+ * bracket. The Newton variant takes the derivative too, and falls back to
+ * bisection whenever a step would leave the bracket or shrink it too
+ * slowly, so it keeps Brent's guarantee. Brent's minimizer combines golden
+ * section with parabolic steps and finds a local minimum inside the
+ * bracket.
+ */
+
+#pragma once
+#include "diff.h"
+
+constexpr size_t solve_max_iter = 200;
+
+typedef double (*solvefn_t)(void *ctx, double x);
+typedef dual_t (*solvedfn_t)(void *ctx, double x);
+
+//! @brief Report of the last solve of the calling thread
+typedef struct {
+  char const *method; // "brent", "newton" or "minimum"
+  size_t iters, evals;
+  bool converged; // false on a bracket without a sign change or at the cap
+} solvestat_t;
+
+[[gnu::nonnull(1)]] double solveBrent(solvefn_t, void *, double, double);
+[[gnu::nonnull(1)]] double solveNewton(solvedfn_t, void *, double, double);
+[[gnu::nonnull(1)]] double solveMin(solvefn_t, void *, double, double);
+solvestat_t solveStat(void);
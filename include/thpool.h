@@ -0,0 +1,32 @@
+/**
+ * @file include/thpool.h
+ * @brief Define fixed-size worker pool
+ */
+
+#pragma once
+#include <pthread.h>
+#include <stddef.h>
+
+typedef struct {
+  void (*fn)(void *);
+  void *arg;
+} job_t;
+
+typedef struct {
+  pthread_mutex_t mtx;
+  pthread_cond_t hasjob; // signaled on submit and stop
+  pthread_cond_t idle;   // signaled when the queue drains
+  job_t *jobs;           // ring buffer
+  size_t cap, head, len;
+  size_t active;
+  bool stop;
+  size_t nthreads;
+  pthread_t threads[];
+} thpool_t;
+
+[[nodiscard("allocation")]] thpool_t *thpoolNew(size_t);
+[[gnu::nonnull(1, 2)]] void thpoolSubmit(thpool_t *, void (*)(void *), void *);
+[[gnu::nonnull]] void thpoolWait(thpool_t *);
+[[gnu::nonnull]] void thpoolFree(thpool_t *);
+[[gnu::returns_nonnull]] thpool_t *thpoolShared(void);
+size_t cpuCount();
@@ -0,0 +1,62 @@
+/**
+ * @file include/vec.h
+ * @brief Dense vectors of real number mode
+ *
+ * Vectors are immutable. Every operation allocates its result as a
+ * temporary of the calling thread, and temporaries are released when the
+ * thread starts its next evaluation. Storing a vector in a register pins
+ * it, and pinned vectors live until exit like interned lambdas.
+ *
+ * The higher-order operators split their input into fixed chunks, so
+ * results do not depend on how many threads ran them.
+ *
+ * A lazy vector holds no data but the recipe of its elements, and yields
+ * them vec_chunk at a time through vecRead. Arithmetic and maps over lazy
+ * vectors are lazy again, so a reduction at the end of such a chain runs
+ * in constant memory.
+ */
+
+#pragma once
+#include "evalfn.h"
+
+constexpr size_t vec_max = 1 << 28; // elements
+constexpr size_t vec_chunk = 512;   // elements a lazy vector yields at once
+constexpr double seq_max = 0x1p53;  // longest lazy range
+
+//! @brief Folding operators, valued as their tokens
+typedef enum {
+  VOP_ADD = '+',
+  VOP_SUB = '-',
+  VOP_MUL = '*',
+  VOP_DIV = '/',
+  VOP_POW = '^',
+  VOP_MOD = '%',
+} vecop_t;
+
+struct vec {
+  struct vec *next; // temporaries of the same thread
+  size_t len;
+  bool pinned;
+  struct seq *seq; // lazy when not nullptr, data is then empty
+  alignas(32) double data[];
+};
+
+[[gnu::returns_nonnull]] vec_t *vecNew(size_t);
+vec_t *vecRange(double, double);
+vec_t *vecLazyRange(double, double);
+[[gnu::nonnull]] vec_t *vecLoad(char const *);
+[[gnu::nonnull]] void vecPin(vec_t *);
+void vecRelease(void);
+[[gnu::nonnull]] void vecRead(vec_t const *, size_t, size_t, double *);
+[[gnu::nonnull]] real_t vecFold(vecop_t, real_t const *, size_t);
+[[gnu::nonnull]] double vecExtreme(vec_t const *, bool);
+[[gnu::nonnull, gnu::returns_nonnull]] vec_t *
+vecMap(vec_t const *, double (*)(double));
+[[gnu::nonnull, gnu::returns_nonnull]] vec_t *
+vecMapLmd(machine_t *, lambda_t const *, vec_t const *);
+[[gnu::nonnull, gnu::returns_nonnull]] vec_t *
+vecFilter(machine_t *, lambda_t const *, vec_t const *);
+[[gnu::nonnull]] double
+vecReduce(machine_t *, lambda_t const *, vec_t const *, double, bool);
+[[gnu::nonnull]] double
+vecSigma(machine_t *, lambda_t const *, double, double);
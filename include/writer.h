@@ -0,0 +1,20 @@
+/**
+ * @file include/writer.h
+ * @brief Buffered output for evaluation results
+ */
+
+#pragma once
+#include <stddef.h>
+
+constexpr size_t writer_size = 1 << 14;
+constexpr size_t fmt_size = 32; // enough for any fmtReal/fmtInt output
+
+[[gnu::nonnull]] size_t fmtInt(long, char *);
+[[gnu::nonnull]] size_t fmtReal(double, char *);
+[[gnu::nonnull]] void writeBytes(void const *, size_t);
+[[gnu::nonnull]] void writeStr(char const *);
+void writeChar(char);
+void writeInt(long);
+void writeReal(double);
+void flushWriter();
+int setWriterFd(int);
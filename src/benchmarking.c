@@ -2,8 +2,466 @@
  * @file src/benchmarking.c
  */
 
+#define _DEFAULT_SOURCE // clock_gettime, syscall
 #ifdef BENCHMARK_MODE
+int benchReport();
 int main() {
+  return benchReport(); // the benchmarks ran as constructors
+}
+
+ #include "benchmarking.h"
+ #include "ansiesc.h"
+ #include "chore.h"
+ #include "error.h"
+ #include <linux/perf_event.h>
+ #include <math.h>
+ #include <stdint.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+
+ #ifndef VERSION
+  #define VERSION "unknown"
+ #endif
+ #ifndef BUILD_HASH
+  #define BUILD_HASH "unknown"
+ #endif
+
+constexpr size_t bench_min_samples = 16;
+constexpr size_t bench_warmup = 3;          // batches, however long they take
+constexpr size_t bench_max_batch = 1 << 30; // bodies optimized away
+constexpr size_t bench_calib = 31;          // timings of the empty batch
+constexpr double bench_min_ns = 2e3;        // per sample, above the clock cost
+constexpr size_t bench_max_records = 256;
+constexpr double bench_tolerance = 0.05; // slowdown of the median to flag
+constexpr double bench_t_crit = 3;       // Welch's t, about p < 0.001
+
+//! @brief Result of one benchmark, as written and read back
+typedef struct {
+  char name[64];
+  char unit[8]; // "us" or "cycles"
+  benchstat_t st;
+  double rate;       // units of work per second at the median, or NaN
+  char rate_unit[16];
+} benchrec_t;
+
+static benchrec_t records[bench_max_records];
+static size_t records_n;
+
+ #define CACHE_MISS(cache) \
+   (PERF_COUNT_HW_CACHE_##cache | PERF_COUNT_HW_CACHE_OP_READ << 8 \
+    | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static struct {
+  char const *name;
+  uint32_t type;
+  uint64_t config;
+} const bench_events[BENCH_EV_N] = {
+  [BENCH_EV_CYCLES] = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  [BENCH_EV_INSTRUCTIONS] =
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  [BENCH_EV_BRANCH_MISSES] =
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  [BENCH_EV_L1D_MISSES] = {"l1d_misses", PERF_TYPE_HW_CACHE, CACHE_MISS(L1D)},
+  [BENCH_EV_LLC_MISSES] = {"llc_misses", PERF_TYPE_HW_CACHE, CACHE_MISS(LL)},
+};
+
+static int perf_fds[BENCH_EV_N]; // -1 for events the machine lacks
+
+/**
+ * @brief Open the counters once if BENCH_PERF is set
+ * @return Whether at least the leader counts
+ */
+static bool perfOpen(void) {
+  static bool tried, ok;
+  if (tried) return ok;
+  tried = true;
+  if (getenv("BENCH_PERF") == nullptr) return false;
+  for (size_t i = 0; i < BENCH_EV_N; i++) {
+    struct perf_event_attr attr = {
+      .type = bench_events[i].type,
+      .size = sizeof attr,
+      .config = bench_events[i].config,
+      .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                   | PERF_FORMAT_TOTAL_TIME_RUNNING,
+      .exclude_kernel = 1,
+      .exclude_hv = 1,
+    };
+    if (i == 0) attr.disabled = 1;
+    int group = i == 0 ? -1 : perf_fds[0];
+    perf_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    if (perf_fds[0] == -1) break;
+  }
+  ok = perf_fds[0] != -1;
+  if (!ok) [[clang::unlikely]]
+    dispErr(__FUNCTION__, "counters unavailable, timing only");
+  return ok;
+}
+
+static void perfToggle(bool on) {
+  if (on) ioctl(perf_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(
+    perf_fds[0],
+    on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE,
+    PERF_IOC_FLAG_GROUP
+  );
+}
+
+//! @brief Counts of the group per batch, scaled up if it was multiplexed
+static void perfRead(double *events, size_t batches) {
+  uint64_t buf[3 + BENCH_EV_N]; // nr, time enabled, time running, values
+  ssize_t len = read(perf_fds[0], buf, sizeof buf);
+  if (len < (ssize_t)(3 * sizeof(uint64_t)) || buf[2] == 0) return;
+  double scale = (double)buf[1] / (double)buf[2] / (double)batches;
+  for (size_t i = 0, j = 0; i < BENCH_EV_N && j < buf[0]; i++)
+    if (perf_fds[i] != -1) events[i] = (double)buf[3 + j++] * scale;
+}
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double now(benchclock_t clk) {
+  switch (clk) {
+  case BENCH_TIME:
+    return nowNs() / 1e3;
+  case BENCH_CYCLE:
+    return (double)__builtin_readcyclecounter();
+  default:
+    [[clang::unlikely]];
+  }
+  return NAN;
+}
+
+[[gnu::noinline]] static void emptyBatch(size_t n) {
+  for (size_t i = 0; i < n; i++) __asm__ volatile("");
+}
+
+static double timeBatch(void (*batch)(size_t), size_t n, benchclock_t clk) {
+  double begin = now(clk);
+  batch(n);
+  return now(clk) - begin;
+}
+
+static int cmpDouble(void const *a, void const *b) {
+  double x = *(double const *)a, y = *(double const *)b;
+  return (x > y) - (x < y);
+}
+
+//! @brief q-quantile of n sorted values, interpolated between ranks
+static double quantile(double const *xs, size_t n, double q) {
+  double pos = q * (double)(n - 1);
+  size_t lo = (size_t)pos;
+  if (lo + 1 == n) return xs[lo];
+  return xs[lo] + (pos - (double)lo) * (xs[lo + 1] - xs[lo]);
+}
+
+//! @brief Does BENCH_FILTER let the benchmark run
+bool benchSelected(char const *name) {
+ #ifdef BENCH_FILTER
+  return strstr(name, BENCH_FILTER) != nullptr;
+ #else
+  _ = name;
+  return true;
+ #endif
+}
+
+//! @brief Measure and print the cost of one call of a benchmark
+static benchstat_t
+measure(char const *name, void (*batch)(size_t), benchclock_t clk) {
+  bool perf = perfOpen(); // complains before the line of the benchmark
+  printf(BENCH_HEADER ESBLD "%s" ESCLR "...", name);
+  fflush(stdout);
+
+  // warm caches and predictors up for a tenth of the budget, doubling the
+  // batch until reading the clock is a small part of a sample
+  size_t k = 1;
+  double begin = nowNs(), t;
+  for (size_t rounds = 0;; rounds++) {
+    double b = nowNs();
+    batch(k);
+    t = nowNs() - b;
+    if (t < bench_min_ns && k < bench_max_batch) k *= 2;
+    else if (bench_warmup <= rounds && BENCH_BUDGET * 1e8 <= nowNs() - begin)
+      break;
+  }
+  size_t n = (size_t)(BENCH_BUDGET * 1e9 / bigger(t, 1.0));
+  n = lesser(bigger(n, bench_min_samples), (size_t)REPEAT);
+
+  double calib[bench_calib], empty[BENCH_EV_N] = {};
+  if (perf) perfToggle(true);
+  for (size_t i = 0; i < bench_calib; i++)
+    calib[i] = timeBatch(emptyBatch, k, clk);
+  if (perf) {
+    perfToggle(false);
+    perfRead(empty, bench_calib);
+  }
+  qsort(calib, bench_calib, sizeof(double), cmpDouble);
+  double overhead = calib[bench_calib / 2];
+
+  double *xs drop = zalloc(double, n);
+  if (perf) perfToggle(true);
+  for (size_t i = 0; i < n; i++)
+    xs[i] = bigger((timeBatch(batch, k, clk) - overhead) / (double)k, 0.0);
+  if (perf) perfToggle(false);
+  qsort(xs, n, sizeof(double), cmpDouble);
+
+  benchstat_t st = {
+    .samples = n,
+    .batch = k,
+    .min = xs[0],
+    .median = quantile(xs, n, 0.5),
+    .p90 = quantile(xs, n, 0.9),
+    .p99 = quantile(xs, n, 0.99),
+  };
+  for (size_t i = 0; i < BENCH_EV_N; i++) st.events[i] = NAN;
+  if (perf) {
+    perfRead(st.events, n);
+    for (size_t i = 0; i < BENCH_EV_N; i++)
+      if (!isnan(st.events[i]))
+        st.events[i] = bigger((st.events[i] - empty[i]) / (double)k, 0.0);
+  }
+  for (size_t i = 0; i < n; i++) st.mean += xs[i] / (double)n;
+  for (size_t i = 0; i < n; i++)
+    st.stddev += (xs[i] - st.mean) * (xs[i] - st.mean) / (double)(n - 1);
+  st.stddev = sqrt(st.stddev);
+
+  printf(
+    " => median %.6f, min %.6f, p90 %.6f, p99 %.6f, sd %.6f %s (%zu x %zu)\n",
+    st.median,
+    st.min,
+    st.p90,
+    st.p99,
+    st.stddev,
+    clk == BENCH_TIME ? "microsecs" : "cycles",
+    n,
+    k
+  );
+  if (!isnan(st.events[BENCH_EV_CYCLES])) {
+    double const *ev = st.events;
+    printf(
+      "   per call: %.1f instructions, %.1f cycles (IPC %.2f), %.2f branch "
+      "misses, %.2f L1d misses, %.2f LLC misses\n",
+      ev[BENCH_EV_INSTRUCTIONS],
+      ev[BENCH_EV_CYCLES],
+      ev[BENCH_EV_INSTRUCTIONS] / ev[BENCH_EV_CYCLES],
+      ev[BENCH_EV_BRANCH_MISSES],
+      ev[BENCH_EV_L1D_MISSES],
+      ev[BENCH_EV_LLC_MISSES]
+    );
+  }
+  return st;
+}
+
+static void record(
+  char const *name, benchclock_t clk, benchstat_t const *st, double rate,
+  char const *rate_unit
+) {
+  if (records_n == bench_max_records) [[clang::unlikely]] return;
+  benchrec_t *r = records + records_n++;
+  snprintf(r->name, sizeof r->name, "%s", name);
+  strcpy(r->unit, clk == BENCH_TIME ? "us" : "cycles");
+  r->st = *st;
+  r->rate = rate;
+  snprintf(r->rate_unit, sizeof r->rate_unit, "%s", rate_unit);
+}
+
+/**
+ * @brief Measure, print and record the cost of one call of a benchmark
+ * @param[in] batch Runs the benchmark the given number of times
+ * @return All zero if the benchmark is filtered out
+ */
+benchstat_t
+benchRun(char const *name, void (*batch)(size_t), benchclock_t clk) {
+  if (!benchSelected(name)) return (benchstat_t){};
+  benchstat_t st = measure(name, batch, clk);
+  record(name, clk, &st, NAN, "");
+  return st;
+}
+
+/**
+ * @brief benchRun in time, also reporting the work done per second
+ * @param[in] units Work of the last call, set by batch
+ * @param[in] unit What the work is counted in, e.g. "ops"
+ */
+void benchRate(
+  char const *name, void (*batch)(size_t), double const *units,
+  char const *unit
+) {
+  if (!benchSelected(name)) return;
+  benchstat_t st = measure(name, batch, BENCH_TIME);
+  double rate = *units / st.median * 1e6;
+  record(name, BENCH_TIME, &st, rate, unit);
+  printf("   throughput: %.4g %s/s\n", rate, unit);
+}
+
+static bool isCsv(char const *path) {
+  char const *ext = strrchr(path, '.');
+  return ext != nullptr && strcmp(ext, ".csv") == 0;
+}
+
+//! @brief Append a field, as null in JSON if it is NaN
+static void writeField(FILE *fp, bool csv, char const *key, double x) {
+  if (csv) fprintf(fp, ",%.9g", x);
+  else if (isnan(x)) fprintf(fp, ", \"%s\": null", key);
+  else fprintf(fp, ", \"%s\": %.9g", key, x);
+}
+
+//! @brief Write the records as a JSON array, one object per line, or CSV
+static void writeRecords(char const *path) {
+  FILE *fp dropfile = fopen(path, "w");
+  if (fp == nullptr) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "cannot write %s", path);
+    return;
+  }
+  bool csv = isCsv(path);
+  if (csv) {
+    fputs("name,unit,samples,batch,min,median,p90,p99,mean,stddev", fp);
+    for (size_t i = 0; i < BENCH_EV_N; i++)
+      fprintf(fp, ",%s", bench_events[i].name);
+    fputs(",ipc,rate,rate_unit,version,build\n", fp);
+  } else fputs("[\n", fp);
+  for (size_t i = 0; i < records_n; i++) {
+    benchrec_t const *r = records + i;
+    benchstat_t const *st = &r->st;
+    fprintf(
+      fp,
+      csv ? "%s,%s,%zu,%zu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g"
+          : "  {\"name\": \"%s\", \"unit\": \"%s\", \"samples\": %zu, "
+            "\"batch\": %zu, \"min\": %.9g, \"median\": %.9g, \"p90\": %.9g, "
+            "\"p99\": %.9g, \"mean\": %.9g, \"stddev\": %.9g",
+      r->name,
+      r->unit,
+      st->samples,
+      st->batch,
+      st->min,
+      st->median,
+      st->p90,
+      st->p99,
+      st->mean,
+      st->stddev
+    );
+    for (size_t j = 0; j < BENCH_EV_N; j++)
+      writeField(fp, csv, bench_events[j].name, st->events[j]);
+    writeField(
+      fp,
+      csv,
+      "ipc",
+      st->events[BENCH_EV_INSTRUCTIONS] / st->events[BENCH_EV_CYCLES]
+    );
+    writeField(fp, csv, "rate", r->rate);
+    fprintf(
+      fp,
+      csv ? ",%s,%s,%s\n"
+          : ", \"rate_unit\": \"%s\", \"version\": \"%s\", "
+            "\"build\": \"%s\"}",
+      r->rate_unit,
+      VERSION,
+      BUILD_HASH
+    );
+    if (!csv) fputs(i + 1 < records_n ? ",\n" : "\n", fp);
+  }
+  if (!csv) fputs("]\n", fp);
+}
+
+//! @brief Parse a line of either format, false for anything else
+static bool readRecord(char const *line, benchrec_t *r) {
+  benchstat_t *st = &r->st;
+  return sscanf(
+           line,
+           " {\"name\": \"%63[^\"]\", \"unit\": \"%7[^\"]\", \"samples\": %zu, "
+           "\"batch\": %zu, \"min\": %lf, \"median\": %lf, \"p90\": %lf, "
+           "\"p99\": %lf, \"mean\": %lf, \"stddev\": %lf",
+           r->name,
+           r->unit,
+           &st->samples,
+           &st->batch,
+           &st->min,
+           &st->median,
+           &st->p90,
+           &st->p99,
+           &st->mean,
+           &st->stddev
+         )
+           == 10
+      || sscanf(
+           line,
+           "%63[^,],%7[^,],%zu,%zu,%lf,%lf,%lf,%lf,%lf,%lf",
+           r->name,
+           r->unit,
+           &st->samples,
+           &st->batch,
+           &st->min,
+           &st->median,
+           &st->p90,
+           &st->p99,
+           &st->mean,
+           &st->stddev
+         )
+           == 10;
+}
+
+/**
+ * @brief Is cur slower than base by more than the tolerance on the median,
+ *        and significantly so by Welch's t-test on the means
+ */
+static bool
+regressed(benchstat_t const *cur, benchstat_t const *base, double tol) {
+  double se = sqrt(
+    cur->stddev * cur->stddev / (double)cur->samples
+    + base->stddev * base->stddev / (double)base->samples
+  );
+  double diff = cur->mean - base->mean;
+  return base->median * (1 + tol) < cur->median
+      && (se == 0 ? 0 < diff : bench_t_crit < diff / se);
+}
+
+//! @return Number of benchmarks that regressed against the baseline file
+static int compareBaseline(char const *path, double tol) {
+  FILE *fp dropfile = fopen(path, "r");
+  if (fp == nullptr) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "cannot read %s", path);
+    return 1;
+  }
+  int n = 0;
+  char line[1024];
+  benchrec_t base;
+  while (fgets(line, sizeof line, fp) != nullptr) {
+    if (!readRecord(line, &base)) continue;
+    for (size_t i = 0; i < records_n; i++) {
+      benchrec_t const *r = records + i;
+      if (strcmp(r->name, base.name) != 0 || strcmp(r->unit, base.unit) != 0)
+        continue;
+      bool bad = regressed(&r->st, &base.st, tol);
+      n += bad;
+      printf(
+        " ■ " ESCBLU "Comparing " ESCLR ESBLD "%s" ESCLR
+        " => %+.1f%% median%s\n",
+        r->name,
+        (r->st.median / base.st.median - 1) * 100,
+        bad ? ESCRED ESBLD " [regressed]" ESCLR : ""
+      );
+    }
+  }
+  return n;
+}
+
+/**
+ * @brief Write the records to $BENCH_OUT (CSV if it ends with .csv, JSON
+ *        otherwise) and compare them with the file $BENCH_BASELINE,
+ *        flagging medians slower by more than $BENCH_TOLERANCE (0.05)
+ * @return Number of regressions, the exit status of the benchmark build
+ */
+int benchReport() {
+  char const *out = getenv("BENCH_OUT"), *base = getenv("BENCH_BASELINE");
+  if (out != nullptr) writeRecords(out);
+  if (base == nullptr) return 0;
+  char const *tol = getenv("BENCH_TOLERANCE");
+  return compareBaseline(base, tol ? strtod(tol, nullptr) : bench_tolerance);
 }
 #else
  #include "benchmarking.h"
@@ -14,3 +472,56 @@ bench (example) {
     for (int j = 0; j < 100; j++) a++;
 }
 #endif
+
+#include "chore.h"
+#include "error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr size_t bench_max_corpora = 16;
+
+static benchcorpus_t corpora[bench_max_corpora];
+static size_t corpora_n;
+
+//! @brief Split text into its lines, leaving out blank ones and comments
+static void splitCorpus(benchcorpus_t *c, size_t len) {
+  size_t cap = 1;
+  for (size_t i = 0; i < len; i++) cap += c->text[i] == '\n';
+  c->lines = zalloc(char *, cap);
+  for (char *line = c->text, *end; *line; line = end) {
+    end = line + strcspn(line, "\n");
+    if (*end) *end++ = '\0';
+    char const *p = line + strspn(line, " \t");
+    if (*p != '\0' && *p != ';') c->lines[c->n++] = line;
+  }
+}
+
+/**
+ * @brief Lines of the corpus file name in $BENCH_CORPUS (bench by default),
+ *        read once and kept for the run
+ * @return Empty if the file cannot be read
+ */
+benchcorpus_t const *benchCorpus(char const *name) {
+  static benchcorpus_t none;
+  for (size_t i = 0; i < corpora_n; i++)
+    if (strcmp(corpora[i].name, name) == 0) return corpora + i;
+  if (corpora_n == bench_max_corpora) [[clang::unlikely]] return &none;
+
+  benchcorpus_t *c = corpora + corpora_n++;
+  char const *dir = getenv("BENCH_CORPUS") ?: "bench";
+  snprintf(c->name, sizeof c->name, "%s", name);
+  snprintf(c->path, sizeof c->path, "%s/%s", dir, name);
+  FILE *fp dropfile = fopen(c->path, "r");
+  if (fp == nullptr || fseek(fp, 0, SEEK_END) != 0) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "cannot read %s", c->path);
+    return c;
+  }
+  long len = ftell(fp);
+  rewind(fp);
+  c->text = zalloc(char, (size_t)bigger(len, 0L) + 1);
+  size_t read = fread(c->text, 1, (size_t)bigger(len, 0L), fp);
+  c->text[read] = '\0';
+  splitCorpus(c, read);
+  return c;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file src/binio.c
+ * @brief Define binary result output and binary operand input
+ */
+
+#define _POSIX_C_SOURCE 200809L // fmemopen
+#include "binio.h"
+#include "error.h"
+#include "evalfn.h"
+#include "jit.h"
+#include "mathdef.h"
+#include "optexpr.h"
+#include "testing.h"
+#include "vec.h"
+#include "writer.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Output elem_t as a fixed-layout binary record
+ * @param[in] elem Output content
+ */
+void printElemBinary(elem_t elem) {
+  uint32_t tag = (uint32_t)elem.rtype;
+  writeBytes(&tag, sizeof tag);
+  switch (elem.rtype) {
+  case RTYPE_REAL:
+    writeBytes(&elem.elem.real, sizeof(double));
+    break;
+  case RTYPE_COMP:
+    writeBytes(&elem.elem.comp, sizeof(complex));
+    break;
+  case RTYPE_MATR: {
+    uint64_t dim[2] = {elem.elem.matr.rows, elem.elem.matr.cols};
+    writeBytes(dim, sizeof dim);
+    writeBytes(elem.elem.matr.matrix, dim[0] * dim[1] * sizeof(complex));
+    free(elem.elem.matr.matrix);
+  } break;
+  case RTYPE_LAMB: {
+    uint64_t len = strlen(elem.elem.lamb);
+    writeBytes(&len, sizeof len);
+    writeBytes(elem.elem.lamb, len);
+  } break;
+  case RTYPE_VECT: {
+    uint64_t len = elem.elem.vect->len;
+    writeBytes(&len, sizeof len);
+    double buf[vec_chunk];
+    for (size_t i = 0; i < len; i += vec_chunk) {
+      size_t n = lesser(vec_chunk, len - i);
+      vecRead(elem.elem.vect, i, n, buf);
+      writeBytes(buf, n * sizeof(double));
+    }
+  } break;
+  default:
+    [[clang::unlikely]];
+  }
+}
+
+/**
+ * @brief Output n doubles as one RTYPE_VECT record
+ * @param[in] xs Output content
+ */
+void printDoublesBinary(double const *xs, size_t n) {
+  uint32_t tag = RTYPE_VECT;
+  uint64_t len = n;
+  writeBytes(&tag, sizeof tag);
+  writeBytes(&len, sizeof len);
+  writeBytes(xs, n * sizeof(double));
+}
+
+/**
+ * @brief Read one input frame into args
+ * @param[in] fp Input stream
+ * @param[out] args Arguments in machine order ($1 is args[arg_n - 1]), NaN
+ *                  above argc rather than left from the previous frame
+ * @return Is a complete frame read
+ */
+static bool readFrame(FILE *restrict fp, real_t *restrict args) {
+  uint32_t argc;
+  double argv[arg_n];
+  if (fread(&argc, sizeof argc, 1, fp) != 1) return false;
+  if (arg_n < argc) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "too many operands in a frame: %u", argc);
+    return false;
+  }
+  if (fread(argv, sizeof(double), argc, fp) != argc) return false;
+  for (size_t i = 0; i < arg_n; i++)
+    args[arg_n - 1 - i] = (real_t){
+      .elem = {.real = i < argc ? argv[i] : NAN},
+      .isnum = true
+    };
+  return true;
+}
+
+/**
+ * @brief Evaluate expr for each frame read from fp
+ * @param[in] fp Input stream of frames
+ * @param[in] expr Expression referring to $1..$8
+ */
+void binReaderLoop(FILE *restrict fp, char const *expr) {
+  char code[buf_size];
+  strncpy(code, expr, buf_size - 1);
+  code[buf_size - 1] = '\0';
+  optexprInvariant(code);
+
+  machine_t ei;
+  initEvalinfo(&ei);
+  jitexpr_t jit ondrop(jitFree);
+  jitInit(&jit, code);
+  real_t args[arg_n] = {};
+
+  while (readFrame(fp, args)) {
+    print_elem(realToElem(jitEval(&jit, &ei, args)));
+  }
+  flushWriter();
+}
+
+static double evalFrame(char const *expr, double a1, double a2) {
+  struct [[gnu::packed]] {
+    uint32_t argc;
+    double argv[2];
+  } frame = {2, {a1, a2}};
+  FILE *fp dropfile = fmemopen(&frame, sizeof frame, "r");
+  real_t args[arg_n] = {};
+  if (!readFrame(fp, args)) return NAN;
+  machine_t ei;
+  initEvalinfo(&ei);
+  return evalWithArgs(&ei, expr, args).elem.real;
+}
+
+test_table(
+  bin_frame, evalFrame, (double, char const *, double, double),
+  {
+    { 5.0, "$1 $2 +", 2.0, 3.0},
+    {-1.0, "$1 $2 -", 2.0, 3.0},
+    { 8.0, "$1 $2 ^", 2.0, 3.0},
+}
+)
+
+test (bin_frame_sizes) {
+  struct [[gnu::packed]] {
+    uint32_t argc2;
+    double argv2[2];
+    uint32_t argc1;
+    double argv1[1];
+  } frames = {2, {2.0, 3.0}, 1, {4.0}};
+  FILE *fp dropfile = fmemopen(&frames, sizeof frames, "r");
+  real_t args[arg_n] = {};
+  expect(readFrame(fp, args));
+  expecteq(3.0, args[arg_n - 2].elem.real);
+  expect(readFrame(fp, args));
+  expecteq(4.0, args[arg_n - 1].elem.real);
+  expect(isnan(args[arg_n - 2].elem.real)); // not the 3 of the last frame
+  expect(!readFrame(fp, args));
+}
@@ -100,7 +100,7 @@ void freecl(void *p) {
   free(*(void **)p);
 }
 void fclosecl(FILE **fp) {
-  fclose(*fp);
+  if (*fp != nullptr) fclose(*fp); // fopen may have failed
 }
 void closedircl(DIR **fp) {
   closedir(*fp);
@@ -0,0 +1,151 @@
+/**
+ * @file src/csv.c
+ * @brief Define column-wise evaluation of numeric data files
+ */
+
+#include "csv.h"
+#include "chore.h"
+#include "evalfn.h"
+#include "jit.h"
+#include "mathdef.h"
+#include "optexpr.h"
+#include "testing.h"
+#include "writer.h"
+#include <string.h>
+
+constexpr size_t csv_bufsize = 1 << 20;
+
+static bool isDelim(char c) {
+  return c == ',' || c == ';' || c == '\t';
+}
+
+/**
+ * @brief Parse numeric fields of a row into argument slots
+ * @param[in] line Row terminated by '\n' or '\0'
+ * @param[out] args Arguments in machine order ($1 is args[arg_n - 1])
+ * @return Number of fields parsed, 0 for blank and non-numeric rows such
+ *         as headers
+ * @note Fields are separated by one ',', ';' or tab, or by spaces. An empty
+ *       field is NaN and keeps the columns after it in place
+ */
+static size_t parseRow(char const *line, real_t *restrict args) {
+  size_t n = 0;
+  char const first = line[strspn(line, " \t\r")]; // strtod skips '\n' too
+  bool const blank = first == '\n' || first == '\0';
+  for (char const *p = line; !blank && n < arg_n; n++) {
+    p += strspn(p, " \r");
+    if (*p == '\n' || *p == '\0') break;
+    double v = NAN;
+    if (!isDelim(*p)) {
+      char *next;
+      v = strtod(p, &next);
+      if (next == p) break;
+      p = next + strspn(next, " \r");
+    }
+    args[arg_n - 1 - n] = (real_t){.elem = {.real = v}, .isnum = true};
+    if (isDelim(*p)) p++;
+  }
+  for (size_t i = n; i < arg_n; i++)
+    args[arg_n - 1 - i] = (real_t){.elem = {.real = NAN}, .isnum = true};
+  return n;
+}
+
+/**
+ * @brief Evaluate every complete row in [p, end)
+ * @return Start of the incomplete last row
+ */
+static char *evalRows(
+  machine_t *restrict ei, jitexpr_t *restrict jit, char *p, char const *end
+) {
+  real_t args[arg_n];
+  for (char *nl; (nl = memchr(p, '\n', (size_t)(end - p))); p = nl + 1) {
+    if (parseRow(p, args) == 0) continue;
+    real_t res = jitEval(jit, ei, args);
+    if (isInt(res.elem.real)) writeInt((long)res.elem.real);
+    else writeReal(res.elem.real);
+    writeChar('\n');
+  }
+  return p;
+}
+
+/**
+ * @brief Apply expr to every row of fp and print the output column
+ * @param[in] fp Comma, semicolon, tab or space separated numeric data
+ * @param[in] expr Expression referring to columns as $1..$8
+ */
+void csvLoop(FILE *restrict fp, char const *expr) {
+  char compiled[buf_size];
+  strncpy(compiled, expr, buf_size - 1);
+  compiled[buf_size - 1] = '\0';
+  optexprInvariant(compiled);
+
+  machine_t ei;
+  initEvalinfo(&ei);
+  jitexpr_t jit ondrop(jitFree);
+  jitInit(&jit, compiled);
+
+  char *buf drop = zalloc(char, csv_bufsize + 2);
+  size_t len = 0;
+  for (size_t n; (n = fread(buf + len, 1, csv_bufsize - len, fp)) != 0;) {
+    len += n;
+    buf[len] = '\0';
+    char *rest = evalRows(&ei, &jit, buf, buf + len);
+    len -= (size_t)(rest - buf);
+    memmove(buf, rest, len);
+    if (len == csv_bufsize) [[clang::unlikely]]
+      len = 0; // a single row larger than the buffer
+  }
+  if (len != 0) { // last row without newline
+    buf[len++] = '\n';
+    buf[len] = '\0';
+    _ = evalRows(&ei, &jit, buf, buf + len);
+  }
+  flushWriter();
+}
+
+static double evalRow(char const *expr, char const *line) {
+  real_t args[arg_n];
+  if (parseRow(line, args) == 0) return NAN;
+  machine_t ei;
+  initEvalinfo(&ei);
+  return evalWithArgs(&ei, expr, args).elem.real;
+}
+
+test_table(
+  csv_row, evalRow, (double, char const *, char const *),
+  {
+    { 6.0, "$1 $2 * 100 /", "20,30\n"},
+    { 7.0,       "$1 $2 +", "3\t4\n"},
+    { 9.0,    "$1 $2 $3 +",   "2; 3; 4"},
+    {10.0,       "$1 2 *",  "5 99 99\n"},
+    { 4.0,      "$1 $3 +",    "1,,3\n"},
+    { 4.0,      "$1 $3 +",  "1\t\t3\n"},
+}
+)
+
+static size_t fieldsOf(char const *line) {
+  real_t args[arg_n];
+  return parseRow(line, args);
+}
+
+test_table(
+  csv_fields, fieldsOf, (size_t, char const *),
+  {
+    {0,            "\n"},
+    {0,              ""},
+    {0,    " \t \r\n1,2\n"}, // blank, not the next row
+    {3,       "1,,3\n"},
+    {2,      "1, 2,\n"},
+    {1,       "7 x 8\n"},
+}
+)
+
+test (csv_header) {
+  real_t args[arg_n];
+  expecteq(0, parseRow("x,y\n", args));
+  expecteq(2, parseRow("1.5,2e3\n", args));
+  expecteq(2000.0, args[arg_n - 2].elem.real);
+  expecteq(2, parseRow(",5,\n", args));
+  expecteq(true, isnan(args[arg_n - 1].elem.real));
+  expecteq(5.0, args[arg_n - 2].elem.real);
+}
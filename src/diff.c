@@ -0,0 +1,465 @@
+/**
+ * @file src/diff.c
+ * @brief Define the dual number engine and Ridders' extrapolation
+ */
+
+#include "diff.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "gene.h"
+#include "lambda.h"
+#include "mathdef.h"
+#include "phyconst.h"
+#include "rand.h"
+#include "testing.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr size_t dual_depth = 256; // slots, longer bodies are refused
+constexpr size_t diff_max_dim = 2; // components of a sampled function
+constexpr double diff_shrink = 1.4; // ratio of successive steps
+
+//! @brief Machine running a lambda body on dual numbers
+typedef struct {
+  dual_t payload[dual_depth];
+  dual_t *rbp, *rsp;
+  dual_t *frames[dual_depth]; // rbp of the enclosing groups
+  size_t fp;
+  double const *argv;
+  rrtinfo_t const *info;
+  char const *rip;
+  bool iscontinue, fail;
+} dualvm_t;
+
+#define PUSH (*++vm->rsp)
+#define POP  (*vm->rsp--)
+
+static void dualFail(dualvm_t *vm) {
+  vm->fail = true;
+}
+
+static void dualAdd(dualvm_t *vm) {
+  for (dual_t *x = vm->rbp + 1; x < vm->rsp;) {
+    dual_t y = POP;
+    x->v += y.v;
+    x->d += y.d;
+  }
+}
+
+static void dualSub(dualvm_t *vm) {
+  for (dual_t *x = vm->rbp + 1; x < vm->rsp;) {
+    dual_t y = POP;
+    x->v -= y.v;
+    x->d -= y.d;
+  }
+}
+
+static void dualMul(dualvm_t *vm) {
+  for (dual_t *x = vm->rbp + 1; x < vm->rsp;) {
+    dual_t y = POP;
+    x->d = x->d * y.v + x->v * y.d;
+    x->v *= y.v;
+  }
+}
+
+static void dualDiv(dualvm_t *vm) {
+  for (dual_t *x = vm->rbp + 1; x < vm->rsp;) {
+    dual_t y = POP;
+    x->v /= y.v;
+    x->d = (x->d - x->v * y.d) / y.v;
+  }
+}
+
+static void dualMod(dualvm_t *vm) {
+  for (dual_t *x = vm->rbp + 1; x < vm->rsp;) {
+    dual_t y = POP;
+    x->d -= trunc(x->v / y.v) * y.d;
+    x->v = fmod(x->v, y.v);
+  }
+}
+
+static void dualPow(dualvm_t *vm) {
+  for (dual_t *x = vm->rbp + 1; x < vm->rsp;) {
+    dual_t y = POP;
+    double p = pow(x->v, y.v);
+    // a constant exponent keeps the rule valid for negative bases
+    x->d = y.d == 0 ? y.v * pow(x->v, y.v - 1) * x->d
+                    : p * (y.d * log(x->v) + y.v * x->d / x->v);
+    x->v = p;
+  }
+}
+
+static void dualEql(dualvm_t *vm) {
+  for (; vm->rbp + 1 < vm->rsp && eq(vm->rsp[-1].v, vm->rsp->v); POP);
+  vm->rbp[1] = (dual_t){vm->rbp + 1 == vm->rsp ?: NAN, 0};
+  vm->rsp = vm->rbp + 1;
+}
+
+#define DEF_LTGT(tok, op) \
+  static void dual##tok(dualvm_t *vm) { \
+    for (; vm->rbp + 1 < vm->rsp && vm->rsp[-1].v op vm->rsp->v; POP); \
+    vm->rbp[1] = (dual_t){vm->rbp + 1 == vm->rsp ?: NAN, 0}; \
+    vm->rsp = vm->rbp + 1; \
+  }
+APPLY_LTGT(DEF_LTGT)
+
+// u is the argument and y = f(u)
+#define DEF_ONEARGFN(f, df) \
+  static void dual_##f(dualvm_t *vm) { \
+    double u = vm->rsp->v, y = f(u); \
+    vm->rsp->v = y; \
+    vm->rsp->d *= (df); \
+  }
+DEF_ONEARGFN(sin, cos(u))
+DEF_ONEARGFN(cos, -sin(u))
+DEF_ONEARGFN(tan, 1 + y * y)
+DEF_ONEARGFN(fabs, signbit(u) ? -1 : 1)
+DEF_ONEARGFN(ceil, 0)
+DEF_ONEARGFN(floor, 0)
+DEF_ONEARGFN(round, 0)
+DEF_ONEARGFN(sinh, cosh(u))
+DEF_ONEARGFN(cosh, sinh(u))
+DEF_ONEARGFN(tanh, 1 - y * y)
+DEF_ONEARGFN(asin, 1 / sqrt(1 - u * u))
+DEF_ONEARGFN(acos, -1 / sqrt(1 - u * u))
+DEF_ONEARGFN(atan, 1 / (1 + u * u))
+DEF_ONEARGFN(log2, 1 / (u * log(2)))
+DEF_ONEARGFN(log10, 1 / (u * log(10)))
+DEF_ONEARGFN(log, 1 / u)
+
+#define DEF_MULTI(name, factor) \
+  static void dual_##name(dualvm_t *vm) { \
+    vm->rsp->v *= factor; \
+    vm->rsp->d *= factor; \
+  }
+DEF_MULTI(negate, -1)
+DEF_MULTI(torad, pi / 180)
+DEF_MULTI(todeg, 180 / pi)
+
+#define DEF_TWOCHARFN(name, c1, f1, c2, f2, c3, f3) \
+  static void dual##name(dualvm_t *vm) { \
+    switch (*++vm->rip) { \
+    case c1: \
+      dual_##f1(vm); \
+      break; \
+    case c2: \
+      dual_##f2(vm); \
+      break; \
+    case c3: \
+      dual_##f3(vm); \
+      break; \
+    default: \
+      [[clang::unlikely]] dualFail(vm); \
+    } \
+  }
+DEF_TWOCHARFN(Hyp, 's', sinh, 'c', cosh, 't', tanh)
+DEF_TWOCHARFN(Arc, 's', asin, 'c', acos, 't', atan)
+DEF_TWOCHARFN(Log, '2', log2, 'c', log10, 'e', log)
+
+static void dualLogBase(dualvm_t *vm) {
+  if (vm->rsp - 1 <= vm->rbp) [[clang::unlikely]] {
+    dualFail(vm);
+    return;
+  }
+  dual_t b = POP, *x = vm->rsp;
+  double u = x->v, lb = log(b.v);
+  x->v = log(u) / lb;
+  x->d = (x->d / u - x->v * b.d / b.v) / lb;
+}
+
+static void dualConst(dualvm_t *vm) {
+  PUSH = (dual_t){getConst(*++vm->rip), 0};
+}
+
+static void dualParse(dualvm_t *vm) {
+  char *next = nullptr;
+  PUSH = (dual_t){strtod(vm->rip, &next), 0};
+  vm->rip = next - 1;
+}
+
+static void dualSpace(dualvm_t *vm) {
+  _ = vm;
+}
+
+static void dualSysFn(dualvm_t *vm) {
+  switch (*++vm->rip) {
+  case 'a': { // ANS
+    real_t const *ans = vm->info->hist + lesser(vm->info->histi, buf_size - 1);
+    if (ans->isnum) PUSH = (dual_t){ans->elem.real, 0};
+    else dualFail(vm);
+  } break;
+  case 'n':
+    PUSH = (dual_t){NAN, 0};
+    break;
+  case 'p':
+    vm->rsp[1] = *vm->rsp;
+    vm->rsp++;
+    break;
+  case 'r':
+    PUSH = (dual_t){xorsh0to1(), 0};
+    break;
+  default: // I/O and stack introspection have no derivative
+    dualFail(vm);
+  }
+}
+
+//! @brief $1 is the variable, the other arguments and registers constants
+static void dualLRegs(dualvm_t *vm) {
+  char r = *++vm->rip;
+  if ('1' <= r && r <= '0' + (int)arg_n)
+    PUSH = (dual_t){vm->argv[r - '1'], r == '1'};
+  else if (islower(r) && vm->info->reg[r - 'a'].isnum)
+    PUSH = (dual_t){vm->info->reg[r - 'a'].elem.real, 0};
+  else dualFail(vm);
+}
+
+static void dualEnd(dualvm_t *vm) {
+  vm->iscontinue = false;
+}
+
+static void dualGrpBgn(dualvm_t *vm) {
+  vm->frames[vm->fp++] = vm->rbp;
+  vm->rbp = ++vm->rsp;
+}
+
+static void dualGrpEnd(dualvm_t *vm) {
+  if (vm->fp == 0) [[clang::unlikely]] {
+    dualFail(vm);
+    return;
+  }
+  dual_t ret = *vm->rsp;
+  vm->rsp = vm->rbp - 1;
+  vm->rbp = vm->frames[--vm->fp];
+  PUSH = ret;
+}
+
+static void dualCond(dualvm_t *vm) {
+  if (vm->rsp - 3 < vm->rbp) [[clang::unlikely]] {
+    dualFail(vm);
+    return;
+  }
+  vm->rsp -= 2;
+  *vm->rsp = vm->rsp[isnan(vm->rsp[2].v)];
+}
+
+//! @brief eval_table of real mode, with the tokens of no rule failing
+static void (*const dual_table['~' - ' ' + 1])(dualvm_t *) = {
+  dualSpace,   // ' '
+  dualFail,    // '!'
+  dualFail,    // '"'
+  dualFail,    // '#'
+  dualLRegs,   // '$'
+  dualMod,     // '%'
+  dualFail,    // '&'
+  dualFail,    // '''
+  dualGrpBgn,  // '('
+  dualGrpEnd,  // ')'
+  dualMul,     // '*'
+  dualAdd,     // '+'
+  dualEnd,     // ','
+  dualSub,     // '-'
+  dualFail,    // '.'
+  dualDiv,     // '/'
+  dualParse,   // '0'
+  dualParse,   // '1'
+  dualParse,   // '2'
+  dualParse,   // '3'
+  dualParse,   // '4'
+  dualParse,   // '5'
+  dualParse,   // '6'
+  dualParse,   // '7'
+  dualParse,   // '8'
+  dualParse,   // '9'
+  dualFail,    // ':'
+  dualEnd,     // ';'
+  dualLt,      // '<'
+  dualEql,     // '='
+  dualGt,      // '>'
+  dualCond,    // '?'
+  dualSysFn,   // '@'
+  dual_fabs,   // 'A'
+  dualFail,    // 'B'
+  dual_ceil,   // 'C'
+  dualFail,    // 'D'
+  dualFail,    // 'E'
+  dual_floor,  // 'F'
+  dualFail,    // 'G'
+  dualFail,    // 'H'
+  dualFail,    // 'I'
+  dualFail,    // 'J'
+  dualFail,    // 'K'
+  dualLogBase, // 'L'
+  dualFail,    // 'M'
+  dualFail,    // 'N'
+  dualFail,    // 'O'
+  dualFail,    // 'P'
+  dualFail,    // 'Q'
+  dual_round,  // 'R'
+  dualFail,    // 'S'
+  dualFail,    // 'T'
+  dualFail,    // 'U'
+  dualFail,    // 'V'
+  dualFail,    // 'W'
+  dualFail,    // 'X'
+  dualFail,    // 'Y'
+  dualFail,    // 'Z'
+  dualFail,    // '['
+  dualConst,   // '\'
+  dualFail,    // ']'
+  dualPow,     // '^'
+  dualFail,    // '_'
+  dualFail,    // '`'
+  dualArc,     // 'a'
+  dualFail,    // 'b'
+  dual_cos,    // 'c'
+  dual_todeg,  // 'd'
+  dualFail,    // 'e'
+  dualFail,    // 'f'
+  dualFail,    // 'g' no digamma in libm
+  dualHyp,     // 'h'
+  dualFail,    // 'i'
+  dualFail,    // 'j'
+  dualFail,    // 'k'
+  dualLog,     // 'l'
+  dual_negate, // 'm'
+  dualFail,    // 'n'
+  dualFail,    // 'o'
+  dualFail,    // 'p'
+  dualFail,    // 'q'
+  dual_torad,  // 'r'
+  dual_sin,    // 's'
+  dual_tan,    // 't'
+  dualFail,    // 'u'
+  dualFail,    // 'v'
+  dualFail,    // 'w'
+  dualFail,    // 'x'
+  dualFail,    // 'y'
+  dualFail,    // 'z'
+  dualFail,    // '{'
+  dualFail,    // '|'
+  dualFail,    // '}'
+  dualFail,    // '~'
+};
+
+/**
+ * @brief Value and derivative by $1 of l at argv, in one pass
+ * @param[in] argv $1..$8 in order
+ * @param[in] info Registers and history the body sees
+ * @return Whether every token of the body has a rule
+ */
+bool diffDual(
+  lambda_t const *l, double const *argv, rrtinfo_t const *info, dual_t *ret
+) {
+  if (dual_depth <= l->len + 1) return false;
+  dualvm_t vm = {.argv = argv, .info = info, .iscontinue = true};
+  vm.rbp = vm.rsp = vm.payload;
+  for (vm.rip = l->body + l->memo; *vm.rip && vm.iscontinue; vm.rip++) {
+    if (*vm.rip < ' ' || '~' < *vm.rip) [[clang::unlikely]]
+      dualFail(&vm);
+    else dual_table[*vm.rip - ' '](&vm);
+    if (vm.fail) return false;
+  }
+  if (vm.rsp == vm.payload) return false;
+  *ret = *vm.rsp;
+  return true;
+}
+
+//! @brief Ridders' tableau over central differences, the steps shrinking
+static double extrapolate(double const *xs, double const *ys) {
+  double t[diff_rows][diff_rows], best = NAN, err = INFINITY;
+  for (size_t i = 0; i < diff_rows; i++) {
+    t[i][0] = (ys[2 * i] - ys[2 * i + 1]) / (xs[2 * i] - xs[2 * i + 1]);
+    double fac = diff_shrink * diff_shrink;
+    for (size_t j = 1; j <= i; j++, fac *= diff_shrink * diff_shrink) {
+      t[i][j] = (t[i][j - 1] * fac - t[i - 1][j - 1]) / (fac - 1);
+      double e = bigger(
+        fabs(t[i][j] - t[i][j - 1]), fabs(t[i][j] - t[i - 1][j - 1])
+      );
+      if (e <= err) {
+        err = e;
+        best = t[i][j];
+      }
+    }
+    // higher orders only grow the rounding error from here
+    if (0 < i && 2 * err <= fabs(t[i][i] - t[i - 1][i - 1])) break;
+  }
+  return best;
+}
+
+/**
+ * @brief Derivative of f at x by extrapolated central differences
+ * @param[in] dim Components of f, at most 2
+ * @param[out] out dim components of the derivative
+ * @note f is sampled once, at all 2 * diff_rows points
+ */
+void diffRichardson(
+  difffn_t f, void *ctx, size_t dim, double x, double *out
+) {
+  constexpr size_t n = 2 * diff_rows;
+  double xs[n], ys[n * diff_max_dim], h = 0.1 * bigger(fabs(x), 1.0);
+  for (size_t i = 0; i < diff_rows; i++, h /= diff_shrink) {
+    xs[2 * i] = x + h;
+    xs[2 * i + 1] = x - h;
+  }
+  f(ctx, xs, n, ys);
+  for (size_t d = 0; d < lesser(dim, diff_max_dim); d++)
+    out[d] = extrapolate(xs, ys + d * n);
+}
+
+static double diffDualOf(char const *body, double x) {
+  dual_t y = {NAN, NAN};
+  rrtinfo_t info = {};
+  diffDual(lmdIntern(body, strlen(body)), (double[arg_n]){x}, &info, &y);
+  return y.d;
+}
+
+test_table(
+  diff_dual, diffDualOf, (double, char const *, double),
+  {
+    {               6.0,                   "$1 3 ^", 1.4142135623730951},
+    {               0.0,    "$1 s 2 ^ ($1 c 2 ^) +",                0.7},
+    {0.5403023058681398,                     "$1 s",                1.0},
+    {              -0.5,                   "1 $1 /", 1.4142135623730951},
+    {1.3591409142295225,           "\\E ($1 2 /) ^",                2.0},
+    {               1.0,                    "$1 lc", 0.4342944819032518},
+    {               2.0, "$1 2 * (3 m) ($1 0 >) ?",                4.0},
+    {              -1.0,                     "$1 A",               -5.0},
+}
+)
+
+test (diff_dual_fail) {
+  rrtinfo_t info = {};
+  dual_t y;
+  lambda_t const *l = lmdIntern("$1 {$1}!", 8);
+  expecteq(false, diffDual(l, (double[arg_n]){1}, &info, &y));
+  l = lmdIntern("$1 &x", 5);
+  expecteq(false, diffDual(l, (double[arg_n]){1}, &info, &y));
+}
+
+static void cube(void *ctx, double const *xs, size_t n, double *ys) {
+  _ = ctx;
+  for (size_t i = 0; i < n; i++) {
+    ys[i] = xs[i] * xs[i] * xs[i];
+    ys[n + i] = exp(xs[i]);
+  }
+}
+
+test (diff_richardson) {
+  double d[2];
+  diffRichardson(cube, nullptr, 2, 2, d);
+  expecteq(12.0, d[0]);
+  expecteq(exp(2), d[1]);
+  diffRichardson(cube, nullptr, 1, -1e4, d);
+  expecteq(3e8, d[0]);
+}
+
+bench (diff_dual) {
+  rrtinfo_t info = {};
+  char const *body = "$1 s 2 ^ ($1 c 3 ^) +";
+  lambda_t const *l = lmdIntern(body, strlen(body));
+  dual_t y;
+  for (int i = 0; i < 1000; i++)
+    diffDual(l, (double[arg_n]){(double)i}, &info, &y);
+}
@@ -34,6 +34,12 @@ char const *codetomsg(int code) {
     return "Unknown command";
   case ERR_UNKNOWN_OPTION:
     return "Unknown option";
+  case ERR_CONNECTION_FAILURE:
+    return "Connection failure";
+  case ERR_MISSING_OPERAND:
+    return "Missing operand";
+  case ERR_UNSET_REGISTER:
+    return "Unset register";
   default:
     [[clang::unlikely]] return "";
   }
@@ -6,15 +6,29 @@
 #include "evalfn.h"
 #include "arthfn.h"
 #include "benchmarking.h"
+#include "binio.h"
+#include "diff.h"
 #include "error.h"
 #include "exproriented.h"
 #include "gene.h"
+#include "graphplot.h"
+#include "lambda.h"
 #include "mathdef.h"
+#include "ode.h"
 #include "phyconst.h"
+#include "profile.h"
+#include "quad.h"
 #include "rand.h"
+#include "solve.h"
 #include "testing.h"
+#include "vec.h"
+#include "writer.h"
 #include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef OPPROFILE_MODE
+ #include <stdatomic.h>
+#endif
 
 elem_t evalExprReal(char const *);
 
@@ -29,20 +43,85 @@ elem_t evalExprReal(char const *);
   (real_t) { \
     .elem = {.lamb = v}, .isnum = false \
   }
+#define SET_VEC(v) \
+  (real_t) { \
+    .elem = {.vec = v}, .isnum = false, .isvec = true \
+  }
+
+#ifdef BENCHMARK_MODE
+static bool fusion = true; // toggled to measure the unfused dispatch
+#else
+constexpr bool fusion = true;
+#endif
+
+/**
+ * @brief Superinstruction: apply the operator after the current token to a
+ *        frame holding only lhs, without pushing rhs
+ * @param[in] rhs Value the current token would push
+ * @return Whether the operator was consumed
+ */
+static bool fuseArthm(machine_t *ei, double rhs) {
+  if (!fusion || ei->s.rbp + 1 != ei->s.rsp || !ei->s.rsp->isnum) return false;
+  char const *op = ei->c.rip + 1;
+  for (; *op == ' '; op++);
+  double *lhs = &ei->s.rsp->elem.real;
+  switch (*op) {
+  case '+':
+    *lhs += rhs;
+    break;
+  case '-':
+    *lhs -= rhs;
+    break;
+  case '*':
+    *lhs *= rhs;
+    break;
+  case '/':
+    *lhs /= rhs;
+    break;
+  case '^':
+    *lhs = rhs == 2 ? *lhs * *lhs : pow(*lhs, rhs);
+    break;
+  default:
+    return false;
+  }
+  ei->c.rip = op;
+  return true;
+}
+
+static bool isVec(real_t const *x) {
+  return !x->isnum && x->isvec;
+}
+
+/**
+ * @brief Fold the frame with the vector kernels if it holds a vector
+ * @return Whether the frame was folded
+ */
+static bool foldVec(machine_t *ei, vecop_t op) {
+  real_t *bot = ei->s.rbp + 1, *x = bot;
+  for (; x <= ei->s.rsp && !isVec(x); x++);
+  if (ei->s.rsp < x) [[clang::likely]]
+    return false;
+  *bot = vecFold(op, bot, (size_t)(ei->s.rsp - bot + 1));
+  ei->s.rsp = bot;
+  return true;
+}
 
 #define DEF_ARTHMS(tok, op) \
   static void rpx##tok(machine_t *ei) { \
+    if (foldVec(ei, (vecop_t) * #op)) return; \
     for (; ei->s.rbp + 1 < ei->s.rsp; \
          ei->s.rbp[1].elem.real op## = POP.elem.real); \
   }
 APPLY_ARTHM(DEF_ARTHMS)
 
 static void rpxMod(machine_t *ei) {
+  if (foldVec(ei, VOP_MOD)) return;
   for (; ei->s.rbp + 1 < ei->s.rsp;
        ei->s.rbp[1].elem.real = fmod(ei->s.rbp[1].elem.real, POP.elem.real));
 }
 
 static void rpxPow(machine_t *ei) {
+  if (foldVec(ei, VOP_POW)) return;
   for (; ei->s.rbp + 1 < ei->s.rsp;
        ei->s.rbp[1].elem.real = pow(ei->s.rbp[1].elem.real, POP.elem.real));
 }
@@ -51,7 +130,7 @@ static void rpxEql(machine_t *ei) {
   for (; ei->s.rbp + 1 < ei->s.rsp
          && eq(ei->s.rsp[-1].elem.real, ei->s.rsp->elem.real);
        POP);
-  ei->s.rbp[1].elem.real = ei->s.rbp + 1 == ei->s.rsp ?: NAN;
+  ei->s.rbp[1] = SET_REAL(ei->s.rbp + 1 == ei->s.rsp ?: NAN);
   ei->s.rsp = ei->s.rbp + 1;
 }
 
@@ -60,14 +139,21 @@ static void rpxEql(machine_t *ei) {
     for (; ei->s.rbp + 1 < ei->s.rsp \
            && ei->s.rsp[-1].elem.real op ei->s.rsp->elem.real; \
          POP); \
-    ei->s.rbp[1].elem.real = ei->s.rbp + 1 == ei->s.rsp ?: NAN; \
+    ei->s.rbp[1] = SET_REAL(ei->s.rbp + 1 == ei->s.rsp ?: NAN); \
     ei->s.rsp = ei->s.rbp + 1; \
   }
 APPLY_LTGT(DEF_LTGT)
 
+//! @brief Overwrite the top of the stack with f of it, elementwise
+static void applyFn(machine_t *ei, double (*f)(double)) {
+  if (isVec(ei->s.rsp)) [[clang::unlikely]]
+    ei->s.rsp->elem.vec = vecMap(ei->s.rsp->elem.vec, f);
+  else ei->s.rsp->elem.real = f(ei->s.rsp->elem.real);
+}
+
 #define DEF_ONEARGFN(f) \
   static void rpx_##f(machine_t *ei) { \
-    ei->s.rsp->elem.real = f(ei->s.rsp->elem.real); \
+    applyFn(ei, f); \
   }
 DEF_ONEARGFN(sin)
 DEF_ONEARGFN(cos)
@@ -80,7 +166,11 @@ DEF_ONEARGFN(round)
 
 #define DEF_MULTI(name, factor) \
   static void rpx_##name(machine_t *ei) { \
-    ei->s.rsp->elem.real *= factor; \
+    if (isVec(ei->s.rsp)) [[clang::unlikely]] \
+      *ei->s.rsp = vecFold( \
+        VOP_MUL, (real_t[]){*ei->s.rsp, SET_REAL(factor)}, 2 \
+      ); \
+    else ei->s.rsp->elem.real *= factor; \
   }
 DEF_MULTI(negate, -1)
 DEF_MULTI(torad, pi / 180)
@@ -89,9 +179,15 @@ DEF_MULTI(todeg, 180 / pi)
 #define DEF_TWOCHARFN(name, c1, f1, c2, f2, c3, f3) \
   static void rpx_##name(machine_t *ei) { \
     switch (*++ei->c.rip) { \
-      OVERWRITE_REAL(c1, f1) \
-      OVERWRITE_REAL(c2, f2) \
-      OVERWRITE_REAL(c3, f3) \
+    case c1: \
+      applyFn(ei, f1); \
+      break; \
+    case c2: \
+      applyFn(ei, f2); \
+      break; \
+    case c3: \
+      applyFn(ei, f3); \
+      break; \
     default: \
       [[clang::unlikely]]; \
     } \
@@ -100,9 +196,16 @@ DEF_TWOCHARFN(hyp, 's', sinh, 'c', cosh, 't', tanh)
 DEF_TWOCHARFN(arc, 's', asin, 'c', acos, 't', atan)
 DEF_TWOCHARFN(log, '2', log2, 'c', log10, 'e', log)
 
+static real_t logOf(real_t x) {
+  return isVec(&x) ? SET_VEC(vecMap(x.elem.vec, log))
+                   : SET_REAL(log(x.elem.real));
+}
+
 static void rpxLogBase(machine_t *ei) {
-  double x = POP.elem.real;
-  ei->s.rsp->elem.real = log(ei->s.rsp->elem.real) / log(x);
+  real_t x = POP;
+  if (isVec(&x) || isVec(ei->s.rsp)) [[clang::unlikely]]
+    *ei->s.rsp = vecFold(VOP_DIV, (real_t[]){logOf(*ei->s.rsp), logOf(x)}, 2);
+  else *ei->s.rsp = SET_REAL(log(ei->s.rsp->elem.real) / log(x.elem.real));
 }
 
 static void rpxConst(machine_t *ei) {
@@ -111,8 +214,9 @@ static void rpxConst(machine_t *ei) {
 
 static void rpxParse(machine_t *ei) {
   char *next = nullptr;
-  PUSH = SET_REAL(strtod(ei->c.rip, &next));
+  double x = strtod(ei->c.rip, &next);
   ei->c.rip = next - 1;
+  if (!fuseArthm(ei, x)) PUSH = SET_REAL(x);
 }
 
 static void rpxSpace(machine_t *ei) {
@@ -123,7 +227,7 @@ static void rpxSpace(machine_t *ei) {
 #define CASE_TWOARGFN(c, f) \
   case c: { \
     double x = POP.elem.real; \
-    ei->s.rsp->elem.real = f(ei->s.rsp->elem.real, x); \
+    *ei->s.rsp = SET_REAL(f(ei->s.rsp->elem.real, x)); \
   } break;
 static void rpxIntFn(machine_t *ei) {
   switch (*++ei->c.rip) {
@@ -142,45 +246,49 @@ static void rpxSysFn(machine_t *ei) {
     PUSH = ei->e.info.hist[lesser(ei->e.info.histi, buf_size - 1)];
     break;
   case 'd': // display
-    printany(ei->s.rsp->elem.real);
-    putchar('\n');
-    break;
-  case 'h':
-    ei->s.rsp->elem.real
-      = ei->e.info.hist[ei->e.info.histi - (size_t)ei->s.rsp->elem.real]
-          .elem.real;
+    writeReal(ei->s.rsp->elem.real);
+    writeChar('\n');
     break;
+  case 'h': { // n @h is the result n lines back, NaN past the history
+    double n = ei->s.rsp->elem.real;
+    size_t i = ei->e.info.histi;
+    *ei->s.rsp = SET_REAL(
+      0 <= n && n <= (double)i && i - (size_t)n < buf_size
+        ? ei->e.info.hist[i - (size_t)n].elem.real
+        : NAN
+    );
+  } break;
   case 'n':
     PUSH = SET_REAL(NAN);
     break;
   case 'p':
+    if (fuseArthm(ei, ei->s.rsp->elem.real)) break;
     ei->s.rsp[1] = *ei->s.rsp;
     ei->s.rsp++;
     break;
   case 'r':
     PUSH = SET_REAL(xorsh0to1());
     break;
-  case 's':
-    *ei->s.rsp = *(ei->s.rsp - (int)ei->s.rsp->elem.real - 1);
-    break;
+  case 's': { // k @s is the value k below it, NaN past the frame
+    double k = ei->s.rsp->elem.real;
+    *ei->s.rsp = 0 <= k && k < (double)(ei->s.rsp - ei->s.rbp - 1)
+                 ? *(ei->s.rsp - (size_t)k - 1)
+                 : SET_REAL(NAN);
+  } break;
   default:
     [[clang::unlikely]];
   }
 }
 
-static real_t handleFnArgs(machine_t *ei) {
-  char argnum = *ei->c.rip - '0';
-  if (ei->d.argc[ei->d.argci] < argnum) ei->d.argc[ei->d.argci] = argnum;
-  return ei->e.args[8 - argnum];
-}
-
 static void rpxLRegs(machine_t *ei) {
-  *++ei->s.rsp = (isdigit(*++ei->c.rip)) ? handleFnArgs(ei)
-               : (islower(*ei->c.rip))   ? ei->e.info.reg[*ei->c.rip - 'a']
-                                       : *(real_t *)$panic(ERR_CHAR_NOT_FOUND);
+  real_t x = (isdigit(*++ei->c.rip)) ? ei->e.args[8 - (*ei->c.rip - '0')]
+           : (islower(*ei->c.rip))   ? ei->e.info.reg[*ei->c.rip - 'a']
+                                     : *(real_t *)$panic(ERR_CHAR_NOT_FOUND);
+  if (!x.isnum || !fuseArthm(ei, x.elem.real)) PUSH = x;
 }
 
 static void rpxWRegs(machine_t *ei) {
+  if (isVec(ei->s.rsp)) vecPin(ei->s.rsp->elem.vec);
   ei->e.info.reg[*++ei->c.rip - 'a'] = *ei->s.rsp;
 }
 
@@ -189,57 +297,138 @@ static void rpxEnd(machine_t *ei) {
 }
 
 static void rpxGrpBgn(machine_t *ei) {
-  PUSH.elem.lamb = (char *)ei->s.rbp;
+  PUSH.elem.frame = ei->s.rbp;
   ei->s.rbp = ei->s.rsp;
 }
 
-static void rpxGrpEnd(machine_t *ei) {
+static void leaveGrp(machine_t *ei) {
   real_t *rbp = ei->s.rbp;
-  ei->s.rbp = *(real_t **)ei->s.rbp;
+  ei->s.rbp = ei->s.rbp->elem.frame;
   *rbp = *ei->s.rsp;
   ei->s.rsp = rbp;
 }
 
-static void rpxLmdBgn(machine_t *ei) {
-  ei->c.rip++;
-  size_t i = 0;
-  for (int nest = 1; *ei->c.rip; i++)
-    if (ei->c.rip[i] == '{') nest++;
-    else if (ei->c.rip[i] == '}' && !--nest) break;
+static void rpxGrpEnd(machine_t *ei) {
+  real_t ret = *ei->s.rsp;
+  real_t *rbp = ei->s.rbp;
+  ei->s.rbp = ei->s.rbp->elem.frame;
+  ei->s.rsp = rbp - 1;
+  if (!ret.isnum || !fuseArthm(ei, ret.elem.real)) PUSH = ret;
+}
 
-  *++ei->s.rsp = SET_LAMB(zalloc(char, i + 1));
-  memcpy(ei->s.rsp->elem.lamb, ei->c.rip, i);
-  ei->s.rsp->elem.lamb[i] = '\0';
-  ei->c.rip += i;
+static void rpxLmdBgn(machine_t *ei) {
+  lambda_t const *l = lmdLiteral(++ei->c.rip);
+  PUSH = SET_LAMB(l);
+  ei->c.rip += l->len;
+  if (*ei->c.rip == '\0') ei->c.rip--; // unterminated, stop at the end
 }
 
 static void rpxLmbEnd(machine_t *ei) {
   _ = ei;
 }
 
-static void callFn(machine_t *ei) {
-  ei->d.callstack[++ei->d.callstacki] = ei->e.args;
+static callframe_t *pushFrame(machine_t *ei) {
+  if (ei->d.framei == ei->d.framecap) {
+    callframe_t *frames = zalloc(callframe_t, ei->d.framecap * 2);
+    memcpy(frames, ei->d.frames, ei->d.framecap * sizeof(callframe_t));
+    if (ei->d.frames != ei->d.inl) free(ei->d.frames);
+    ei->d.frames = frames;
+    ei->d.framecap *= 2;
+  }
+  return ei->d.frames + ei->d.framei++;
+}
+
+//! @brief Whether the '!' at rip is the last token of a lambda body
+static bool isTailCall(machine_t const *ei) {
+  if (ei->d.framei == 0 || ei->d.frames[ei->d.framei - 1].memo) return false;
+  char const *p = ei->c.rip + 1;
+  for (; *p == ' '; p++);
+  return *p == '\0';
+}
+
+/**
+ * @brief Return from the innermost call before it finishes, keeping the
+ *        callee and its arguments so they replace the caller's
+ * @return Whether the callee's arguments are all inside the frame
+ */
+static bool leaveForTailCall(machine_t *ei, lambda_t const *callee) {
+  callframe_t *f = ei->d.frames + ei->d.framei - 1;
+  real_t *src = ei->s.rsp - callee->argc;
+  if (src <= ei->s.rbp) return false;
+  ei->s.rbp = ei->s.rbp->elem.frame;
+  real_t *dst = ei->e.args + 8 - f->lmd->argc;
+  memmove(dst, src, (callee->argc + 1) * sizeof(real_t));
+  ei->s.rsp = dst + callee->argc;
+  ei->e.args = f->args;
+  ei->d.framei--;
+  return true;
+}
+
+/**
+ * @brief Enter a lambda body; rpxEval runs it and returns through retFn,
+ *        so recursion does not grow the C stack
+ * @param[in] argv $1..$argc when the result is to be memoized
+ */
+static void callFn(machine_t *ei, lambda_t const *l, double const *argv) {
+  char const *expr = ei->c.expr, *rip = ei->c.rip;
+  if (isTailCall(ei) && leaveForTailCall(ei, l)) {
+    expr = ei->d.frames[ei->d.framei].expr; // resume where the caller would
+    rip = ei->d.frames[ei->d.framei].rip;
+  }
+  if (ei->s.payload + stack_size - buf_size <= ei->s.rsp) {
+    dispErr(__FUNCTION__, "%s: operand stack", codetomsg(ERR_BUFFER_DEPLETION));
+    ei->e.iscontinue = false;
+    return;
+  }
+  callframe_t *f = pushFrame(ei);
+  *f = (callframe_t){
+    .lmd = l, .args = ei->e.args, .expr = expr, .rip = rip, .memo = !!argv
+  };
+  if (argv != nullptr) memcpy(f->argv, argv, l->argc * sizeof(double));
   ei->e.args = ei->s.rsp - 8;
-  ei->d.argc[++ei->d.argci] = 0;
   rpxGrpBgn(ei);
+  ei->c.expr = l->body + l->memo;
+  ei->c.rip = ei->c.expr - 1; // the '{' or '#' before it, rpxEval steps over
 }
 
 static void retFn(machine_t *ei) {
-  rpxGrpEnd(ei);
+  callframe_t const *f = ei->d.frames + --ei->d.framei;
+  leaveGrp(ei); // rip is at the end of the lambda, nothing to fuse
   real_t ret = *ei->s.rsp;
-  ei->s.rsp = ei->e.args + 8;
-  ei->s.rsp -= ei->d.argc[ei->d.argci--];
+  ei->s.rsp = ei->e.args + 8 - f->lmd->argc;
   *ei->s.rsp = ret;
-  ei->e.args = ei->d.callstack[ei->d.callstacki--];
+  ei->e.args = f->args;
+  ei->c.expr = f->expr;
+  ei->c.rip = f->rip;
+  if (f->memo && !isVec(&ret)) memoPut(f->lmd, f->argv, ret);
+}
+
+//! @brief Read $1..$argc below the lambda, false if one of them is a lambda
+static bool loadArgs(machine_t const *ei, size_t argc, double *argv) {
+  real_t const *arg = ei->s.rsp;
+  for (size_t i = 0; i < argc; i++) {
+    if (!(--arg)->isnum) return false;
+    argv[i] = arg->elem.real;
+  }
+  return true;
 }
 
 static void rpxRunLmd(machine_t *ei) {
-  char const *temp = ei->c.rip;
-  _ drop = ei->c.expr = ei->c.rip = ei->s.rsp->elem.lamb;
-  callFn(ei);
-  rpxEval(ei);
-  retFn(ei);
-  ei->c.rip = temp;
+  lambda_t const *l = ei->s.rsp->elem.lamb;
+  double argv[arg_n];
+  if (!loadArgs(ei, l->argc, argv)) { // lambda arguments need the interpreter
+    callFn(ei, l, nullptr);
+    return;
+  }
+  real_t ret;
+  if (l->memo && memoGet(l, argv, &ret)) {
+    ei->s.rsp -= l->argc;
+    *ei->s.rsp = ret;
+  } else if (l->code != nullptr) {
+    ei->s.rsp -= l->argc;
+    *ei->s.rsp = SET_REAL(irExec(l->code, argv));
+    if (l->memo) memoPut(l, argv, *ei->s.rsp);
+  } else callFn(ei, l, l->memo ? argv : nullptr);
 }
 
 static void rpxCond(machine_t *ei) {
@@ -258,120 +447,572 @@ static void rpxUndfned(machine_t *ei) {
   );
 }
 
+//! @brief a b .. is the vector a, a+1, ..., b, and a b ... its lazy form
+static void rpxRange(machine_t *ei) {
+  if (*++ei->c.rip != '.') {
+    ei->c.rip--;
+    rpxUndfned(ei);
+    return;
+  }
+  bool lazy = ei->c.rip[1] == '.';
+  ei->c.rip += lazy;
+  double b = POP.elem.real;
+  vec_t *v = (lazy ? vecLazyRange : vecRange)(ei->s.rsp->elem.real, b);
+  if (v != nullptr) [[clang::likely]]
+    *ei->s.rsp = SET_VEC(v);
+  else {
+    dispErr(__FUNCTION__, "%s: range", codetomsg(ERR_BUFFER_DEPLETION));
+    *ei->s.rsp = SET_REAL(NAN);
+  }
+}
+
+//! @brief "path" is the vector of the numbers in the file
+static void rpxLoad(machine_t *ei) {
+  char const *path = ++ei->c.rip, *end = strchr(path, '"');
+  size_t len = end ? (size_t)(end - path) : strlen(path);
+  char *name drop = zalloc(char, len + 1);
+  memcpy(name, path, len);
+  vec_t *v = vecLoad(name);
+  if (v != nullptr) PUSH = SET_VEC(v);
+  else {
+    dispErr(__FUNCTION__, "%s: %s", codetomsg(ERR_FILE_NOT_FOUND), name);
+    PUSH = SET_REAL(NAN);
+  }
+  ei->c.rip = path + len - !end; // at the closing '"', or before the end
+}
+
+//! @brief Count (vc), minimum (vn) or maximum (vx) of a vector
+static void rpxVecStat(machine_t *ei) {
+  real_t *v = ei->s.rsp;
+  if (!isVec(v)) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "%s: v%c", codetomsg(ERR_TYPE_MISMATCH), *ei->c.rip);
+    *v = SET_REAL(NAN);
+    return;
+  }
+  vec_t const *x = v->elem.vec;
+  *v = SET_REAL(
+    *ei->c.rip == 'c' ? (double)x->len : vecExtreme(x, *ei->c.rip == 'x')
+  );
+}
+
+//! @brief Higher-order vector operators: vm, vf, and the folds vr and vl
+static void rpxVecFn(machine_t *ei) {
+  char op = *++ei->c.rip;
+  if (op == 'c' || op == 'n' || op == 'x') {
+    rpxVecStat(ei);
+    return;
+  }
+  bool fold = op == 'r' || op == 'l';
+  real_t l = POP, v = POP, init = fold ? POP : SET_REAL(0);
+  if (l.isnum || l.isvec || !isVec(&v) || !init.isnum) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "%s: v%c", codetomsg(ERR_TYPE_MISMATCH), op);
+    PUSH = SET_REAL(NAN);
+    return;
+  }
+  switch (op) {
+  case 'm':
+    PUSH = SET_VEC(vecMapLmd(ei, l.elem.lamb, v.elem.vec));
+    break;
+  case 'f':
+    PUSH = SET_VEC(vecFilter(ei, l.elem.lamb, v.elem.vec));
+    break;
+  case 'l':
+  case 'r':
+    PUSH = SET_REAL(
+      vecReduce(ei, l.elem.lamb, v.elem.vec, init.elem.real, op == 'r')
+    );
+    break;
+  default:
+    [[clang::unlikely]] dispErr(
+      __FUNCTION__, "%s: v%c", codetomsg(ERR_UNKNOWN_FN), op
+    );
+    PUSH = SET_REAL(NAN);
+  }
+}
+
+//! @brief a b <lambda> S is the sum of the lambda at a, a+1, ..., b
+static void rpxSigma(machine_t *ei) {
+  real_t l = POP, b = POP, *a = ei->s.rsp;
+  if (l.isnum || l.isvec || !b.isnum || !a->isnum) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "%s", codetomsg(ERR_TYPE_MISMATCH));
+    *a = SET_REAL(NAN);
+    return;
+  }
+  *a = SET_REAL(vecSigma(ei, l.elem.lamb, a->elem.real, b.elem.real));
+}
+
+//! @brief Lambda sampled by quadIntegrate, diffRichardson and the solvers
+typedef struct {
+  machine_t *ei; // scratch machine, nullptr when lmd is compiled
+  lambda_t const *lmd;
+  rrtinfo_t const *info; // registers for diffDual
+} sampler_t;
+
+static void sample(void *ctx, double const *xs, size_t n, double *ys) {
+  sampler_t const *f = ctx;
+  callLmdEach(f->ei, f->lmd, xs, n, ys);
+}
+
+static double sampleOne(void *ctx, double x) {
+  sampler_t const *f = ctx;
+  return callLmd(f->ei, f->lmd, (double[arg_n]){x});
+}
+
+static dual_t sampleDual(void *ctx, double x) {
+  sampler_t const *f = ctx;
+  dual_t y = {NAN, NAN};
+  diffDual(f->lmd, (double[arg_n]){x}, f->info, &y);
+  return y;
+}
+
+//! @brief a b <lambda> I is the integral of the lambda from a to b
+static void rpxIntegral(machine_t *ei) {
+  real_t l = POP, b = POP, *a = ei->s.rsp;
+  if (l.isnum || l.isvec || !b.isnum || !a->isnum) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "%s", codetomsg(ERR_TYPE_MISMATCH));
+    *a = SET_REAL(NAN);
+    return;
+  }
+  machine_t *m drop = newScratch(ei, l.elem.lamb);
+  sampler_t f = {.ei = m, .lmd = l.elem.lamb};
+  double v;
+  quadIntegrate(sample, &f, 1, a->elem.real, b.elem.real, &v, !m);
+  *a = SET_REAL(v);
+}
+
+/**
+ * @brief x <lambda> D is the derivative of the lambda at x, exact on dual
+ *        numbers unless the body has a token without a rule
+ */
+static void rpxDiff(machine_t *ei) {
+  real_t l = POP, *x = ei->s.rsp;
+  if (l.isnum || l.isvec || !x->isnum) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "%s", codetomsg(ERR_TYPE_MISMATCH));
+    *x = SET_REAL(NAN);
+    return;
+  }
+  dual_t y;
+  if (diffDual(l.elem.lamb, (double[arg_n]){x->elem.real}, &ei->e.info, &y)) {
+    *x = SET_REAL(y.d);
+    return;
+  }
+  machine_t *m drop = newScratch(ei, l.elem.lamb);
+  sampler_t f = {.ei = m, .lmd = l.elem.lamb};
+  diffRichardson(sample, &f, 1, x->elem.real, &x->elem.real);
+}
+
+/**
+ * @brief a b <lambda> Z is a zero of the lambda between a and b, and
+ *        a b <lambda> M is where it is least between them
+ * @note Interpreted bodies run on one scratch machine for every step
+ */
+static void rpxSolve(machine_t *ei) {
+  real_t l = POP, b = POP, *a = ei->s.rsp;
+  if (l.isnum || l.isvec || !b.isnum || !a->isnum) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "%s", codetomsg(ERR_TYPE_MISMATCH));
+    *a = SET_REAL(NAN);
+    return;
+  }
+  machine_t *m drop = newScratch(ei, l.elem.lamb);
+  sampler_t f = {.ei = m, .lmd = l.elem.lamb, .info = &ei->e.info};
+  double lo = a->elem.real, hi = b.elem.real;
+  dual_t y;
+  if (*ei->c.rip == 'M') *a = SET_REAL(solveMin(sampleOne, &f, lo, hi));
+  else if (diffDual(f.lmd, (double[arg_n]){lo}, f.info, &y))
+    *a = SET_REAL(solveNewton(sampleDual, &f, lo, hi));
+  else *a = SET_REAL(solveBrent(sampleOne, &f, lo, hi));
+}
+
+//! @brief Right-hand sides of a system, one lambda per component
+typedef struct {
+  machine_t *ei; // scratch machine, nullptr when every lambda is compiled
+  lambda_t const *lmds[ode_max_dim];
+} system_t;
+
+static void
+stepSystem(void *ctx, double t, double const *y, size_t dim, double *dy) {
+  system_t const *s = ctx;
+  double argv[arg_n] = {t};
+  memcpy(argv + 1, y, dim * sizeof(double));
+  for (size_t i = 0; i < dim; i++) dy[i] = callLmd(s->ei, s->lmds[i], argv);
+}
+
+//! @brief Trajectory kept for plotting, t and the components of each point
+typedef struct {
+  double *pts;
+  size_t n, cap;
+} track_t;
+
+static void trackFree(track_t *tr) {
+  free(tr->pts);
+}
+
+static void keepPoint(void *ctx, double t, double const *y, size_t dim) {
+  track_t *tr = ctx;
+  if (tr->n == tr->cap) {
+    tr->cap = tr->cap ? tr->cap * 2 : 64;
+    tr->pts = realloc(tr->pts, tr->cap * (dim + 1) * sizeof(double))
+      orelse p$panic(ERR_ALLOCATION_FAILURE);
+  }
+  double *pt = tr->pts + tr->n++ * (dim + 1);
+  pt[0] = t;
+  memcpy(pt + 1, y, dim * sizeof(double));
+}
+
+static void writePoint(void *ctx, double t, double const *y, size_t dim) {
+  _ = ctx;
+  double rec[arg_n] = {t};
+  memcpy(rec + 1, y, dim * sizeof(double));
+  printDoublesBinary(rec, dim + 1);
+}
+
+/**
+ * @brief t0 t1 y1 .. yk <f1> .. <fk> O integrates y' = f(t, y) from t0 to
+ *        t1, where fi gets t as $1 and y as $2 ..
+ * @return yk at t1 for a single equation, otherwise the vector of them
+ */
+static void rpxOde(machine_t *ei) {
+  size_t k = 0;
+  for (real_t *l = ei->s.rsp; ei->s.rbp < l && !l->isnum && !l->isvec; l--)
+    k++;
+  real_t *t = ei->s.rsp - 2 * k - 1;
+  bool ok = 0 < k && k <= ode_max_dim && ei->s.rbp < t;
+  for (real_t *x = t; ok && x < ei->s.rsp - k + 1; x++) ok = x->isnum;
+  if (!ok) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "%s", codetomsg(ERR_TYPE_MISMATCH));
+    ei->s.rsp = t <= ei->s.rbp ? ei->s.rbp + 1 : t;
+    *ei->s.rsp = SET_REAL(NAN);
+    return;
+  }
+  system_t s = {};
+  double y[ode_max_dim];
+  for (size_t i = 0; i < k; i++) {
+    s.lmds[i] = t[k + 2 + i].elem.lamb;
+    y[i] = t[2 + i].elem.real;
+  }
+  machine_t *m drop = nullptr;
+  for (size_t i = 0; i < k && m == nullptr; i++) m = newScratch(ei, s.lmds[i]);
+  s.ei = m;
+  double t0 = t[0].elem.real, t1 = t[1].elem.real;
+  switch (odeOut()) {
+  case ODE_OUT_NONE:
+    odeSolve(stepSystem, &s, k, t0, t1, y, nullptr, nullptr);
+    break;
+  case ODE_OUT_PLOT: {
+    track_t tr ondrop(trackFree) = {};
+    odeSolve(stepSystem, &s, k, t0, t1, y, keepPoint, &tr);
+    flushWriter();
+    plotPoints(tr.pts, tr.n, k);
+    fflush(stdout);
+  } break;
+  case ODE_OUT_BINARY:
+    odeSolve(stepSystem, &s, k, t0, t1, y, writePoint, nullptr);
+    break;
+  default:
+    [[clang::unlikely]];
+  }
+  ei->s.rsp = t;
+  if (k == 1) *t = SET_REAL(y[0]);
+  else {
+    vec_t *v = vecNew(k);
+    memcpy(v->data, y, k * sizeof(double));
+    *t = SET_VEC(v);
+  }
+}
+
 void (*const eval_table['~' - ' ' + 1])(machine_t *) = {
-  rpxSpace,   // ' '
-  rpxRunLmd,  // '!'
-  rpxUndfned, // '"'
-  rpxUndfned, // '#'
-  rpxLRegs,   // '$'
-  rpxMod,     // '%'
-  rpxWRegs,   // '&'
-  rpxUndfned, // '''
-  rpxGrpBgn,  // '('
-  rpxGrpEnd,  // ')'
-  rpxMul,     // '*'
-  rpxAdd,     // '+'
-  rpxEnd,     // ','
-  rpxSub,     // '-'
-  rpxUndfned, // '.'
-  rpxDiv,     // '/'
-  rpxParse,   // '0'
-  rpxParse,   // '1'
-  rpxParse,   // '2'
-  rpxParse,   // '3'
-  rpxParse,   // '4'
-  rpxParse,   // '5'
-  rpxParse,   // '6'
-  rpxParse,   // '7'
-  rpxParse,   // '8'
-  rpxParse,   // '9'
-  rpxUndfned, // ':'
-  rpxEnd,     // ';'
-  rpxLt,      // '<'
-  rpxEql,     // '='
-  rpxGt,      // '>'
-  rpxCond,    // '?'
-  rpxSysFn,   // '@'
-  rpx_fabs,   // 'A'
-  rpxUndfned, // 'B'
-  rpx_ceil,   // 'C'
-  rpxUndfned, // 'D'
-  rpxUndfned, // 'E'
-  rpx_floor,  // 'F'
-  rpxUndfned, // 'G'
-  rpxUndfned, // 'H'
-  rpxUndfned, // 'I'
-  rpxUndfned, // 'J'
-  rpxUndfned, // 'K'
-  rpxLogBase, // 'L'
-  rpxUndfned, // 'M'
-  rpxUndfned, // 'N'
-  rpxUndfned, // 'O'
-  rpxUndfned, // 'P'
-  rpxUndfned, // 'Q'
-  rpx_round,  // 'R'
-  rpxUndfned, // 'S'
-  rpxUndfned, // 'T'
-  rpxUndfned, // 'U'
-  rpxUndfned, // 'V'
-  rpxUndfned, // 'W'
-  rpxUndfned, // 'X'
-  rpxUndfned, // 'Y'
-  rpxUndfned, // 'Z'
-  rpxUndfned, // '['
-  rpxConst,   // '\'
-  rpxUndfned, // ']'
-  rpxPow,     // '^'
-  rpxUndfned, // '_'
-  rpxUndfned, // '`'
-  rpx_arc,    // 'a'
-  rpxUndfned, // 'b'
-  rpx_cos,    // 'c'
-  rpx_todeg,  // 'd'
-  rpxUndfned, // 'e'
-  rpxUndfned, // 'f'
-  rpx_tgamma, // 'g'
-  rpx_hyp,    // 'h'
-  rpxIntFn,   // 'i'
-  rpxUndfned, // 'j'
-  rpxUndfned, // 'k'
-  rpx_log,    // 'l'
-  rpx_negate, // 'm'
-  rpxUndfned, // 'n'
-  rpxUndfned, // 'o'
-  rpxUndfned, // 'p'
-  rpxUndfned, // 'q'
-  rpx_torad,  // 'r'
-  rpx_sin,    // 's'
-  rpx_tan,    // 't'
-  rpxUndfned, // 'u'
-  rpxUndfned, // 'v'
-  rpxUndfned, // 'w'
-  rpxUndfned, // 'x'
-  rpxUndfned, // 'y'
-  rpxUndfned, // 'z'
-  rpxLmdBgn,  // '{'
-  rpxUndfned, // '|'
-  rpxLmbEnd,  // '}'
-  rpxUndfned, // '~'
+  rpxSpace,    // ' '
+  rpxRunLmd,   // '!'
+  rpxLoad,     // '"'
+  rpxUndfned,  // '#'
+  rpxLRegs,    // '$'
+  rpxMod,      // '%'
+  rpxWRegs,    // '&'
+  rpxUndfned,  // '''
+  rpxGrpBgn,   // '('
+  rpxGrpEnd,   // ')'
+  rpxMul,      // '*'
+  rpxAdd,      // '+'
+  rpxEnd,      // ','
+  rpxSub,      // '-'
+  rpxRange,    // '.'
+  rpxDiv,      // '/'
+  rpxParse,    // '0'
+  rpxParse,    // '1'
+  rpxParse,    // '2'
+  rpxParse,    // '3'
+  rpxParse,    // '4'
+  rpxParse,    // '5'
+  rpxParse,    // '6'
+  rpxParse,    // '7'
+  rpxParse,    // '8'
+  rpxParse,    // '9'
+  rpxUndfned,  // ':'
+  rpxEnd,      // ';'
+  rpxLt,       // '<'
+  rpxEql,      // '='
+  rpxGt,       // '>'
+  rpxCond,     // '?'
+  rpxSysFn,    // '@'
+  rpx_fabs,    // 'A'
+  rpxUndfned,  // 'B'
+  rpx_ceil,    // 'C'
+  rpxDiff,     // 'D'
+  rpxUndfned,  // 'E'
+  rpx_floor,   // 'F'
+  rpxUndfned,  // 'G'
+  rpxUndfned,  // 'H'
+  rpxIntegral, // 'I'
+  rpxUndfned,  // 'J'
+  rpxUndfned,  // 'K'
+  rpxLogBase,  // 'L'
+  rpxSolve,    // 'M'
+  rpxUndfned,  // 'N'
+  rpxOde,      // 'O'
+  rpxUndfned,  // 'P'
+  rpxUndfned,  // 'Q'
+  rpx_round,   // 'R'
+  rpxSigma,    // 'S'
+  rpxUndfned,  // 'T'
+  rpxUndfned,  // 'U'
+  rpxUndfned,  // 'V'
+  rpxUndfned,  // 'W'
+  rpxUndfned,  // 'X'
+  rpxUndfned,  // 'Y'
+  rpxSolve,    // 'Z'
+  rpxUndfned,  // '['
+  rpxConst,    // '\'
+  rpxUndfned,  // ']'
+  rpxPow,      // '^'
+  rpxUndfned,  // '_'
+  rpxUndfned,  // '`'
+  rpx_arc,     // 'a'
+  rpxUndfned,  // 'b'
+  rpx_cos,     // 'c'
+  rpx_todeg,   // 'd'
+  rpxUndfned,  // 'e'
+  rpxUndfned,  // 'f'
+  rpx_tgamma,  // 'g'
+  rpx_hyp,     // 'h'
+  rpxIntFn,    // 'i'
+  rpxUndfned,  // 'j'
+  rpxUndfned,  // 'k'
+  rpx_log,     // 'l'
+  rpx_negate,  // 'm'
+  rpxUndfned,  // 'n'
+  rpxUndfned,  // 'o'
+  rpxUndfned,  // 'p'
+  rpxUndfned,  // 'q'
+  rpx_torad,   // 'r'
+  rpx_sin,     // 's'
+  rpx_tan,     // 't'
+  rpxUndfned,  // 'u'
+  rpxVecFn,    // 'v'
+  rpxUndfned,  // 'w'
+  rpxUndfned,  // 'x'
+  rpxUndfned,  // 'y'
+  rpxUndfned,  // 'z'
+  rpxLmdBgn,   // '{'
+  rpxUndfned,  // '|'
+  rpxLmbEnd,   // '}'
+  rpxUndfned,  // '~'
 };
 
 void (*getEvalTable(char c))(machine_t *) {
   return eval_table[c - ' '];
 }
 
+#ifdef OPPROFILE_MODE
+constexpr size_t op_n = '~' - ' ' + 1;
+static _Atomic size_t op_pairs[op_n][op_n];
+static thread_local char prev_op = ' ';
+
+//! @brief Count dispatched token pairs (numbers are counted as '0')
+static void profileOp(char op) {
+  if (op == ' ') return;
+  if (isdigit(op)) op = '0';
+  atomic_fetch_add_explicit(
+    &op_pairs[prev_op - ' '][op - ' '], 1, memory_order_relaxed
+  );
+  prev_op = op;
+}
+
+static int cmpPairCount(void const *a, void const *b) {
+  size_t x = *(_Atomic size_t const *)*(void *const *)a;
+  size_t y = *(_Atomic size_t const *)*(void *const *)b;
+  return (x < y) - (x > y);
+}
+
+/**
+ * @brief Print the dispatched op pairs to stderr, most frequent first
+ * @note Fused pairs are not dispatched, so the list shows what is left to fuse
+ */
+[[gnu::destructor]] static void dumpOpPairs() {
+  static _Atomic size_t *sorted[op_n * op_n];
+  size_t n = 0;
+  for (size_t i = 0; i < op_n; i++)
+    for (size_t j = 0; j < op_n; j++)
+      if (op_pairs[i][j]) sorted[n++] = &op_pairs[i][j];
+  qsort(sorted, n, sizeof *sorted, cmpPairCount);
+
+  fputs("op pair profile:\n", stderr);
+  for (size_t k = 0; k < n; k++) {
+    size_t idx = (size_t)(sorted[k] - &op_pairs[0][0]);
+    fprintf(
+      stderr,
+      "  %c%c %zu\n",
+      (char)(idx / op_n + ' '),
+      (char)(idx % op_n + ' '),
+      (size_t)*sorted[k]
+    );
+  }
+}
+#else
+ #define profileOp(op)
+#endif
+
+/**
+ * @brief Dispatch the token at rip for the profiler, keeping its frames in
+ *        step with the calls the token enters
+ */
+static void dispatchProfiled(machine_t *ei) {
+  char op = *ei->c.rip;
+  char const *expr = ei->c.expr;
+  size_t framei = ei->d.framei;
+  lambda_t const *l = op == '!' && !ei->s.rsp->isnum && !isVec(ei->s.rsp)
+                      ? ei->s.rsp->elem.lamb
+                      : nullptr;
+  if (l != nullptr) {
+    profCall(l->body);
+    profEnter(l->body); // '!' and compiled bodies run under it too
+  }
+  if (profCount(PROF_REAL, op)) {
+    uint64_t begin = __builtin_readcyclecounter();
+    getEvalTable (op)(ei);
+    profSample(PROF_REAL, op, __builtin_readcyclecounter() - begin);
+  } else getEvalTable (op)(ei);
+  if (l == nullptr) return;
+  if (ei->c.expr == expr) profLeave(); // compiled, memoized or refused
+  else if (ei->d.framei == framei) {    // tail call, in place of the caller
+    profLeave();
+    profLeave();
+    profEnter(l->body);
+  }
+}
+
+[[gnu::always_inline]] static inline void
+evalLoop(machine_t *restrict ei, bool const prof) {
+  size_t base = ei->d.framei;
+  for (;; ei->c.rip++) [[clang::likely]] {
+    if (!*ei->c.rip || !ei->e.iscontinue) [[clang::unlikely]] {
+      if (ei->d.framei == base) break;
+      retFn(ei); // back at the caller's '!'
+      if (prof) profLeave();
+      continue;
+    }
+    profileOp(*ei->c.rip);
+    if (prof) dispatchProfiled(ei);
+    else getEvalTable (*ei->c.rip)(ei);
+  }
+  if (base == 0 && ei->d.frames != ei->d.inl) {
+    free(ei->d.frames);
+    ei->d.frames = ei->d.inl;
+    ei->d.framecap = arg_n;
+  }
+}
+
+//! @brief Run the machine, on its own copy of the loop while profiling
 void rpxEval(machine_t *restrict ei) {
-  for (; *ei->c.rip && ei->e.iscontinue; ei->c.rip++) [[clang::likely]]
-    getEvalTable (*ei->c.rip)(ei);
+  if (profOn()) [[clang::unlikely]]
+    evalLoop(ei, true);
+  else evalLoop(ei, false);
 }
 
 void initEvalinfo(machine_t *restrict ret) {
   ret->s.rbp = ret->s.rsp = ret->s.payload;
   ret->e.info = getRRuntimeInfo();
   ret->e.iscontinue = true;
-  ret->d.argci = 0;
-  ret->d.callstacki = ~(unsigned)0;
-  memset(ret->d.argc, 0, sizeof ret->d.argc);
+  ret->d.frames = ret->d.inl;
+  ret->d.framei = 0;
+  ret->d.framecap = arg_n;
+}
+
+static real_t runWithArgs(machine_t *ei, char const *expr, real_t *args) {
+  ei->s.rbp = ei->s.rsp = ei->s.payload;
+  ei->e.args = args;
+  ei->e.iscontinue = true;
+  ei->c.expr = ei->c.rip = expr;
+  rpxEval(ei);
+  return *ei->s.rsp;
+}
+
+/**
+ * @brief Evaluate expression on a reset stack with bound arguments
+ * @param[in,out] ei Machine initialized by initEvalinfo
+ * @param[in] expr String of expression
+ * @param[in] args Arguments in reverse order ($1 is args[arg_n - 1])
+ * @return Top of the stack
+ */
+real_t evalWithArgs(machine_t *restrict ei, char const *expr, real_t *args) {
+  vecRelease();
+  return runWithArgs(ei, expr, args);
+}
+
+/**
+ * @brief Call l from C, in the middle of an evaluation
+ * @param[in,out] ei Scratch machine for bodies that are interpreted, unused
+ *                   when l is compiled
+ * @param[in] argv $1..$8 in order
+ * @return NaN unless l returns a number
+ * @note The result is neither looked up nor stored when l is memoized
+ */
+double callLmd(machine_t *ei, lambda_t const *l, double const *argv) {
+  bool prof = profOn();
+  if (prof) [[clang::unlikely]]
+    profCall(l->body);
+  if (l->code != nullptr) return irExec(l->code, argv);
+  real_t args[arg_n];
+  for (size_t i = 0; i < arg_n; i++) args[arg_n - 1 - i] = SET_REAL(argv[i]);
+  if (prof) [[clang::unlikely]]
+    profEnter(l->body);
+  real_t ret = runWithArgs(ei, l->body + l->memo, args);
+  if (prof) [[clang::unlikely]]
+    profLeave();
+  return ret.isnum ? ret.elem.real : NAN;
+}
+
+/**
+ * @brief out[i] = l($1 = xs[i]), batched when l is compiled
+ * @param[in] ei Scratch machine from newScratch, for interpreted calls
+ * @param[out] out n results, may be xs itself
+ */
+void callLmdEach(
+  machine_t *ei, lambda_t const *l, double const *xs, size_t n, double *out
+) {
+  double argv[arg_n] = {};
+  if (l->batch) {
+    if (profOn()) [[clang::unlikely]]
+      for (size_t i = 0; i < n; i++) profCall(l->body);
+    irExecBatch(l->code, argv, xs, n, out);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    argv[0] = xs[i];
+    out[i] = callLmd(ei, l, argv);
+  }
+}
+
+/**
+ * @brief Machine for interpreted calls of l from C, seeing the registers
+ *        of ei without disturbing its evaluation
+ * @return nullptr if l is compiled, otherwise to be freed by the caller
+ */
+machine_t *newScratch(machine_t const *ei, lambda_t const *l) {
+  if (l->code != nullptr) return nullptr;
+  machine_t *m = palloc(sizeof(machine_t));
+  initEvalinfo(m);
+  m->e.info = ei->e.info;
+  return m;
 }
 
 /**
@@ -380,14 +1021,25 @@ void initEvalinfo(machine_t *restrict ret) {
  * @return Expression evaluation result
  */
 elem_t evalExprReal(char const *restrict a_expr) {
+  vecRelease();
   machine_t ei;
   initEvalinfo(&ei);
   ei.c.expr = ei.c.rip = a_expr;
   rpxEval(&ei);
-  if (++ei.e.info.histi < buf_size) ei.e.info.hist[ei.e.info.histi] = *ei.s.rsp;
+  // vectors are released by the next evaluation, @a sees NaN instead
+  real_t ans = isVec(ei.s.rsp) ? SET_REAL(NAN) : *ei.s.rsp;
+  if (++ei.e.info.histi < buf_size) ei.e.info.hist[ei.e.info.histi] = ans;
   setRRuntimeInfo(ei.e.info);
-  return (elem_t){{ei.s.rsp->elem.real},
-                  ei.s.rsp->isnum ? RTYPE_REAL : RTYPE_LAMB};
+  return realToElem(*ei.s.rsp);
+}
+
+/**
+ * @brief Widen a stack value, lambdas become their interned body
+ */
+elem_t realToElem(real_t x) {
+  if (x.isnum) return (elem_t){{.real = x.elem.real}, RTYPE_REAL};
+  if (x.isvec) return (elem_t){{.vect = x.elem.vec}, RTYPE_VECT};
+  return (elem_t){{.lamb = x.elem.lamb->body}, RTYPE_LAMB};
 }
 
 test (eval_expr_real) {
@@ -396,6 +1048,26 @@ test (eval_expr_real) {
   expecteq(10.0, evalExprReal("5$f!").elem.real);
 }
 
+static double evalWithTwoArgs(char const *expr, double a1, double a2) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  real_t args[arg_n] = {[arg_n - 1] = SET_REAL(a1), [arg_n - 2] = SET_REAL(a2)};
+  return evalWithArgs(&ei, expr, args).elem.real;
+}
+
+test_table(
+  eval_with_args, evalWithTwoArgs, (double, char const *, double, double),
+  {
+    {  7.0, "$1 $2 +",  3.0, 4.0},
+    { -1.0, "$1 $2 -",  3.0, 4.0},
+    {100.0,  "$1 2 ^", 10.0, 0.0},
+    {  9.0, "$1 @p *",  3.0, 0.0}, // fused dup
+    {  1.0, "$1 (2 3 +) -", 6.0, 0.0}, // fused group
+    { 14.0, "($1 1 +) ($2 3 +) *", 1.0, 4.0},
+    { -4.0, "1 2 $1 -", 3.0, 0.0}, // whole frame, not fused
+}
+)
+
 #define eval_expr_real_return_double(expr) evalExprReal(expr).elem.real
 test_table(
   eval_real, eval_expr_real_return_double, (double, char const *),
@@ -413,6 +1085,115 @@ test_table(
   {
     { 8.0,                                      "4 {$1 2 *}!"}, // lamb
     {19.0, "1 5 {$1 3 +}! {5 $1 * {$1 4 -}! {$1 2 /}! $2 +}!"}, // nest lamb
+    {-1.0,                                   "3 4 {$2 $1 -}!"}, // compiled
+    { 6.0,                                   "3 {$1 2 *}&d !"},
+    {20.0,                                        "5 $d! $d!"}, // reg, twice
+    { 6.0,                               "3 {$1 2 *} {$1}! !"}, // lamb arg
+}
+)
+test_table(
+  eval_recursion, eval_expr_real_return_double, (double, char const *),
+  {
+    // memoized fibonacci
+    {   2.0,  "{#$1 {$1} {$1 1 - $f! ($1 2 - $f!) +} ($1 2 <) ? !}&f 3 $f!"},
+    {   5.0,                                                        "5 $f!"},
+    // deeper than the inline call frames
+    {6765.0,                                                       "20 $f!"},
+    // tail calls run in constant space
+    {   0.0,             "{$1 {$1} {$1 1 - $g!} ($1 1 <) ? !}&g 100000 $g!"},
+    {   0.0, "{$2 $1 {$2} {($2 $1 +) ($1 1 -) $h!} ($1 1 <) ? !}&h 0 0 $h!"},
+    {5050.0,                                                    "0 100 $h!"},
+    // not a tail call
+    { 100.0,             "{$1 {0} {$1 1 - $k! 1 +} ($1 1 <) ? !}&k 100 $k!"},
+}
+)
+test_table(
+  eval_vector, eval_expr_real_return_double, (double, char const *),
+  {
+    {5050.0,             "1 100 .. +"}, // reduce
+    {  30.0,           "1 4 .. 2 ^ +"}, // broadcast
+    {  10.0,    "1 3 .. (3 1 ..) * +"}, // elementwise
+    {   2.0, "0 3 .. \\P * 2 / s A +"}, // map
+    {  18.0,    "1 3 .. &v $v $v + +"}, // pinned
+    {  30.0,     "1 5 .. {$1 2 * +}!"}, // lambda arg
+}
+)
+test_table(
+  eval_vector_hof, eval_expr_real_return_double, (double, char const *),
+  {
+    {         385.0,            "1 10 .. {$1 2 ^} vm +"},
+    {          30.0,        "1 10 .. {$1 2 % 0 =} vf +"}, // evens
+    {        5060.0,         "10 1 100 .. {$1 $2 +} vr"},
+    {         -55.0,          "0 1 10 .. {$2 $1 -} vl"}, // in order
+    {           2.0,                             "2 &k"},
+    {          16.0,  "1 4 .. {$1 {$1 $k *}! 1 -} vm +"}, // interpreted
+    {125000250000.0,       "0 1 500000 .. {$1 $2 +} vr"}, // pooled
+}
+)
+test_table(
+  eval_vector_lazy, eval_expr_real_return_double, (double, char const *),
+  {
+    {333833500.0,                              "1 1000 ... 2 ^ +"},
+    {       30.0,                          "1 4 ... (1 4 ..) * +"}, // mixed
+    {       10.0,                                   "1 10 ... vc"},
+    {        1.0,                                   "1 10 ... vn"},
+    {       20.0,                       "1 10 ... {$1 2 *} vm vx"},
+    {  1000000.0, "1 1000000 ... s 2 ^ (1 1000000 ... c 2 ^) + +"},
+}
+)
+test_table(
+  eval_sigma, eval_expr_real_return_double, (double, char const *),
+  {
+    {              5050.0,              "1 100 {$1} S"},
+    {                 0.0,                "1 0 {$1} S"}, // empty
+    {                55.0,        "0 10 {$1 {$1}! } S"}, // interpreted
+    {  1.6449240668982263, "1 100000 {1 ($1 2 ^) /} S"},
+    {-0.11710952409815874,        "1 1000000 {$1 s} S"},
+}
+)
+test_table(
+  eval_integral, eval_expr_real_return_double, (double, char const *),
+  {
+    {    0.33333333333333331,     "0 1 {$1 2 ^} I"},
+    {                    2.0,       "0 \\P {$1 s} I"},
+    {                   -2.0,       "\\P 0 {$1 s} I"}, // reversed
+    {                    0.0,         "1 1 {$1} I"},
+    {     1.7724538509055159, "\\Im \\I {\\E ($1 2 ^ m) ^} I"},
+    {                    1.0,     "1 \\I {1 ($1 2 ^) /} I"},
+    {                    2.0,     "0 1 {1 ($1 0.5 ^) /} I"}, // singular
+    {                    2.0,     "0 \\P {$1 {$1 s}!} I"}, // interpreted
+}
+)
+test_table(
+  eval_solve, eval_expr_real_return_double, (double, char const *),
+  {
+    {1.5707963267948966,             "0 2 {$1 c} Z"},
+    {1.4142135623730951,       "2 1 {$1 2 ^ 2 -} Z"},
+    {1.4142135623730951, "1 2 {$1 {$1 2 ^}! 2 -} Z"}, // Brent
+    {3.1415926535897931,             "2 4 {$1 c} M"},
+    {               2.0,       "0 5 {$1 2 - 2 ^} M"},
+    {               3.0,    "3&a 0 9 {$1 $a - A} M"},
+}
+)
+test_table(
+  eval_diff, eval_expr_real_return_double, (double, char const *),
+  {
+    {12.0,         "2 {$1 3 ^} D"},
+    { 1.0,           "0 {$1 s} D"},
+    { 0.0,          "\\P {$1 c} D"},
+    { 3.0,  "3&a 2 {$1 $a *} D"},
+    {0.25,       "4 {$1 0.5 ^} D"},
+    { 4.0, "2 {$1 {$1 2 ^}!} D"}, // extrapolated
+}
+)
+test_table(
+  eval_ode, eval_expr_real_return_double, (double, char const *),
+  {
+    {2.7182818284590451,             "0 1 1 {$2} O"},
+    {7.3890560989306504,       "0 2 1 {$1 $2 *} O"},
+    {               1.0,         "1 0 \\E {$2} O"}, // backward
+    {              -1.0, "0 \\P 1 0 {$3} {$2 m} O +"},
+    {2.7182818284590451,     "0 1 1 {$2 {$1}!} O"}, // interpreted
 }
 )
 #undef eval_expr_real_return_double
@@ -433,3 +1214,126 @@ bench (eval_expr_real) {
   evalExprReal("100 lc");
   evalExprReal("1 0 /");
 }
+
+bench (eval_lambda_call) {
+  evalExprReal("1 {$1 2 * 1 +}! {$1 2 * 1 +}! {$1 2 * 1 +}! {$1 2 * 1 +}!");
+  evalExprReal("2 3 {$1 $2 ^ ($2 $1 ^) +}! {$1 s}!");
+  evalExprReal("4 {$1 {$1 1 -}! *}!"); // interpreted
+}
+
+bench (eval_vector) {
+  evalExprReal("1 100000 .. 2 ^ s +");
+}
+
+bench (eval_sigma) {
+  evalExprReal("1 100000 {$1 2 ^ s} S");
+}
+
+bench (eval_integral) {
+  evalExprReal("0 \\P {$1 s 2 ^} I");
+}
+
+bench (eval_solve) {
+  evalExprReal("1 2 {$1 3 ^ 2 -} Z");
+}
+
+bench (eval_diff) {
+  evalExprReal("1 {$1 s 2 ^ ($1 c 3 ^) +} D");
+}
+
+bench (eval_ode) {
+  evalExprReal("0 10 1 0 {$3} {$2 m} O");
+}
+
+bench (eval_tail_call) {
+  evalExprReal("{$1 {$1} {$1 1 - $g!} ($1 1 <) ? !}&g 10000 $g!");
+}
+
+#ifdef BENCHMARK_MODE
+static char const *const fusion_corpus[] = {
+  "$1 2 ^ ($2 2 ^) +",
+  "$1 s 2 ^ ($1 c 2 ^) +",
+  "$x 2 * 1 +",
+  "$1 @p * 3 /",
+  "2 3 ^ (4 5 *) + (6 7 /) -",
+  "$1 $2 * 100 /",
+};
+
+//! @brief Tokens the unfused interpreter dispatches for expr
+static size_t countOps(char const *expr) {
+  size_t n = 0;
+  for (char const *p = expr; *p; p++) {
+    if (*p == ' ') continue;
+    n++;
+    if (isdigit(*p)) for (; isdigit(p[1]) || p[1] == '.'; p++);
+    else if (strchr("$&@\\ahil", *p)) p++;
+  }
+  return n;
+}
+
+/**
+ * @brief Evaluate the corpus once, with or without superinstructions
+ * @return Tokens the unfused interpreter dispatches for it
+ */
+static double fusionCorpus(bool fused) {
+  constexpr size_t corpus_n = sizeof fusion_corpus / sizeof *fusion_corpus;
+  static size_t ops;
+  if (ops == 0)
+    for (size_t j = 0; j < corpus_n; j++) ops += countOps(fusion_corpus[j]);
+  fusion = fused;
+  machine_t ei;
+  initEvalinfo(&ei);
+  real_t args[arg_n] = {[arg_n - 1] = SET_REAL(1.5), [arg_n - 2] = SET_REAL(2)};
+  for (size_t j = 0; j < corpus_n; j++)
+    evalWithArgs(&ei, fusion_corpus[j], args);
+  fusion = true;
+  return (double)ops;
+}
+
+bench_rate(superinstructions_unfused, "ops") {
+  return fusionCorpus(false);
+}
+
+bench_rate(superinstructions_fused, "ops") {
+  return fusionCorpus(true);
+}
+
+//! @brief Evaluate every line of a corpus
+//! @return Lines evaluated
+static double evalCorpus(benchcorpus_t const *c) {
+  for (size_t i = 0; i < c->n; i++) evalExprReal(c->lines[i]);
+  return (double)c->n;
+}
+
+//! @brief Operators the lines of c dispatch, counted at the first call
+static double corpusOps(benchcorpus_t const *c, double *memo) {
+  if (*memo < 0) {
+    size_t ops = 0;
+    for (size_t i = 0; i < c->n; i++) ops += countOps(c->lines[i]);
+    *memo = (double)ops;
+  }
+  return *memo;
+}
+
+bench_rate(workload_arith, "ops") {
+  static double ops = -1;
+  benchcorpus_t const *c = benchCorpus("arith.rpx");
+  evalCorpus(c);
+  return corpusOps(c, &ops);
+}
+
+bench_rate(workload_groups, "ops") {
+  static double ops = -1;
+  benchcorpus_t const *c = benchCorpus("groups.rpx");
+  evalCorpus(c);
+  return corpusOps(c, &ops);
+}
+
+bench_rate(workload_lambda, "exprs") {
+  return evalCorpus(benchCorpus("lambda.rpx"));
+}
+
+bench_rate(workload_registers, "exprs") {
+  return evalCorpus(benchCorpus("registers.rpx"));
+}
+#endif
@@ -0,0 +1,465 @@
+/**
+ * @file src/exprcheck.c
+ * @brief Define the check of real mode expressions before evaluation
+ */
+
+#include "exprcheck.h"
+#include "chore.h"
+#include "evalfn.h"
+#include "exproriented.h"
+#include "lambda.h"
+#include "testing.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! @brief What a stack slot holds, as far as it can be told
+typedef struct {
+  enum { SLOT_NUM, SLOT_LAMB, SLOT_ANY } kind; // SLOT_NUM for vectors too
+  lambda_t const *lmd, *alt; // of SLOT_LAMB, alt the other case of a '?'
+  size_t rbp;                // of a group marker, the frame it hides
+} slot_t;
+
+//! @brief Machine running an expression on the kinds of its values
+typedef struct {
+  slot_t slots[stack_size];
+  size_t sp, rbp;         // slots in use, and those below the frame
+  slot_t reg[alpha_n];    // of the registers in set
+  bool set[alpha_n];      // registers holding a value
+  bool assigned[alpha_n]; // registers written anywhere in the expression
+  rrtinfo_t const *info;
+  size_t depth, calls; // of the bodies followed
+  char const *at;      // token that failed
+} check_t;
+
+static slot_t const num = {.kind = SLOT_NUM};
+
+static bool isUnset(real_t const *x) {
+  return !x->isnum && !x->isvec && x->elem.lamb == nullptr;
+}
+
+static slot_t slotOf(real_t const *x) {
+  if (x->isnum || x->isvec) return num;
+  return (slot_t){.kind = SLOT_LAMB, .lmd = x->elem.lamb};
+}
+
+//! @brief Slot that may hold either a or b
+static slot_t merge(slot_t a, slot_t b) {
+  if (a.kind != b.kind) return (slot_t){.kind = SLOT_ANY};
+  if (a.kind != SLOT_LAMB || (a.lmd == b.lmd && a.alt == b.alt)) return a;
+  return (slot_t){.kind = SLOT_LAMB, .lmd = a.lmd, .alt = b.lmd};
+}
+
+//! @brief Whether the frame holds n values
+static errcode_t need(check_t const *k, size_t n) {
+  return k->sp - k->rbp < n ? ERR_MISSING_OPERAND : ERR_SUCCESS;
+}
+
+/**
+ * @brief Whether the frame holds n values, the one at first a number,
+ *        since operators writing a number in place keep a lambda a lambda
+ */
+static errcode_t needNum(check_t const *k, size_t n, size_t first) {
+  if (k->sp - k->rbp < n) return ERR_MISSING_OPERAND;
+  return k->slots[first].kind == SLOT_NUM ? ERR_SUCCESS : ERR_TYPE_MISMATCH;
+}
+
+static errcode_t push(check_t *k, slot_t x) {
+  if (k->sp == stack_size - 2) return ERR_BUFFER_DEPLETION;
+  k->slots[k->sp++] = x;
+  return ERR_SUCCESS;
+}
+
+//! @brief Replace the top n values with x
+static void reduce(check_t *k, size_t n, slot_t x) {
+  k->sp -= n - 1;
+  k->slots[k->sp - 1] = x;
+}
+
+/**
+ * @brief Check the registers, groups and two-letter tokens of a lambda
+ *        literal, whose stack is only known when it is called
+ * @param[in] p Body after '{'
+ * @param[in] end Its '}', or the end of the expression
+ */
+static errcode_t checkBody(check_t *k, char const *p, char const *end) {
+  size_t open = 0;
+  for (; p < end; p++) {
+    k->at = p;
+    if (*p < ' ' || '~' < *p) return ERR_UNKNOWN_CHAR;
+    if (strchr("\\$&@ahilv", *p) && end <= p + 1) return ERR_CHAR_NOT_FOUND;
+    switch (*p) {
+    case '0' ... '9': {
+      char *next;
+      _ = strtod(p, &next);
+      p = next - 1;
+    } break;
+    case '$':
+      if ('1' <= p[1] && p[1] <= '8') {
+        p++;
+        break;
+      }
+      [[fallthrough]];
+    case '&':
+      if (!islower(*++p)) return ERR_UNKNOWN_CHAR;
+      if (p[-1] == '$' && !k->set[*p - 'a'] && !k->assigned[*p - 'a'])
+        return ERR_UNSET_REGISTER;
+      break;
+    case '\\':
+    case '@':
+    case 'a':
+    case 'h':
+    case 'i':
+    case 'l':
+    case 'v':
+      p++;
+      break;
+    case '"':
+      for (p++; p < end && *p != '"'; p++);
+      break;
+    case '(':
+      open++;
+      break;
+    case ')':
+      if (open-- == 0) return ERR_CHAR_NOT_FOUND;
+      break;
+    case '{': {
+      lambda_t const *l = lmdLiteral(p + 1);
+      errcode_t e = checkBody(k, p + 1, p + 1 + l->len);
+      if (e != ERR_SUCCESS) return e;
+      p += l->len + 1;
+    } break;
+    default:
+      break;
+    }
+  }
+  k->at = end;
+  return open == 0 ? ERR_SUCCESS : ERR_CHAR_NOT_FOUND;
+}
+
+static errcode_t
+run(check_t *k, char const *p, slot_t const *args, size_t argc);
+
+/**
+ * @brief Run the body of l on its own frame
+ * @param[in] args $1..$argc
+ * @param[out] ret What it returns
+ * @note Calls nested deeper than check_depth, or past check_calls of the
+ *       expression, are not followed but taken to return a number: the
+ *       bodies they would run have been checked once already
+ */
+static errcode_t
+runBody(check_t *k, lambda_t const *l, slot_t const *args, slot_t *ret) {
+  *ret = num;
+  if (k->depth == check_depth || k->calls == check_calls) return ERR_SUCCESS;
+  k->calls++;
+  k->depth++;
+  size_t sp = k->sp, rbp = k->rbp;
+  k->rbp = k->sp;
+  errcode_t e = run(k, l->body + l->memo, args, l->argc);
+  if (e == ERR_SUCCESS) *ret = k->slots[k->sp - 1];
+  k->sp = sp;
+  k->rbp = rbp;
+  k->depth--;
+  return e;
+}
+
+/**
+ * @brief Call the lambda, or either lambda, in slot f on args
+ * @param[out] ret What it returns
+ * @note A failure is reported at the token calling it
+ */
+static errcode_t
+call(check_t *k, slot_t const *f, slot_t const *args, slot_t *ret) {
+  char const *at = k->at;
+  slot_t x;
+  errcode_t e = runBody(k, f->lmd, args, ret);
+  if (e == ERR_SUCCESS && f->alt != nullptr) {
+    e = runBody(k, f->alt, args, &x);
+    *ret = merge(*ret, x);
+  }
+  if (e != ERR_SUCCESS) k->at = at;
+  return e;
+}
+
+//! @brief '!': call the lambda on top of the frame on the values below it
+static errcode_t callTop(check_t *k) {
+  if (k->sp == k->rbp) return ERR_MISSING_OPERAND;
+  slot_t f = k->slots[k->sp - 1];
+  if (f.kind != SLOT_LAMB) return ERR_TYPE_MISMATCH;
+  size_t argc = f.lmd->argc;
+  if (f.alt != nullptr) argc = bigger(argc, f.alt->argc);
+  if (need(k, argc + 1) != ERR_SUCCESS) return ERR_MISSING_OPERAND;
+  slot_t args[arg_n], ret;
+  for (size_t i = 0; i < argc; i++) args[i] = k->slots[k->sp - 2 - i];
+  errcode_t e = call(k, &f, args, &ret);
+  if (e == ERR_SUCCESS) reduce(k, argc + 1, ret);
+  return e;
+}
+
+/**
+ * @brief Call the n lambdas on top with numbers, as the operators sampling
+ *        them do
+ */
+static errcode_t sample(check_t *k, size_t n) {
+  slot_t args[arg_n], ret;
+  for (size_t i = 0; i < arg_n; i++) args[i] = num;
+  errcode_t e = ERR_SUCCESS;
+  for (size_t i = 0; i < n && e == ERR_SUCCESS; i++) {
+    slot_t const *f = k->slots + k->sp - 1 - i;
+    if (f->kind == SLOT_LAMB) e = call(k, f, args, &ret);
+  }
+  return e;
+}
+
+//! @brief Replace the top n values, the last a lambda, with a number
+static errcode_t sampleTop(check_t *k, size_t n) {
+  errcode_t e = need(k, n);
+  if (e == ERR_SUCCESS) e = sample(k, 1);
+  if (e == ERR_SUCCESS) reduce(k, n, num);
+  return e;
+}
+
+//! @brief Two-letter tokens starting with '@'
+static errcode_t runSysFn(check_t *k, char c) {
+  errcode_t e = ERR_SUCCESS;
+  switch (c) {
+  case 'a': {
+    rrtinfo_t const *info = k->info;
+    real_t const *x = info->hist + lesser(info->histi, buf_size - 1);
+    return isUnset(x) ? ERR_MISSING_OPERAND : push(k, slotOf(x));
+  }
+  case 'n':
+  case 'r':
+    return push(k, num);
+  case 'h':
+    if ((e = need(k, 1)) == ERR_SUCCESS) reduce(k, 1, num);
+    return e;
+  case 'p':
+    if ((e = need(k, 1)) == ERR_SUCCESS) e = push(k, k->slots[k->sp - 1]);
+    return e;
+  case 's': { // a value of the frame below it, or NaN
+    if ((e = need(k, 1)) != ERR_SUCCESS) return e;
+    slot_t x = num;
+    for (size_t i = k->rbp; i < k->sp - 1; i++) x = merge(x, k->slots[i]);
+    k->slots[k->sp - 1] = x;
+    return e;
+  }
+  default:
+    return ERR_SUCCESS;
+  }
+}
+
+/**
+ * @brief Run the expression at p up to its end, ',' or ';'
+ * @param[in] args $1..$argc, nullptr outside lambdas
+ */
+static errcode_t
+run(check_t *k, char const *p, slot_t const *args, size_t argc) {
+  size_t floor = k->rbp; // groups of an enclosing body stay closed
+  errcode_t e = ERR_SUCCESS;
+  for (; *p != '\0' && *p != ',' && *p != ';' && e == ERR_SUCCESS; p++) {
+    k->at = p;
+    if (*p < ' ' || '~' < *p) return ERR_UNKNOWN_CHAR;
+    if (strchr("\\$&@ahilv", *p) && p[1] == '\0') return ERR_CHAR_NOT_FOUND;
+    slot_t *top = k->slots + k->sp - 1; // valid once need(k, 1) holds
+    switch (*p) {
+    case ' ':
+      while (isspace(p[1])) p++;
+      break;
+    case '0' ... '9': {
+      char *next;
+      _ = strtod(p, &next);
+      p = next - 1;
+      e = push(k, num);
+    } break;
+    case '\\':
+      p++;
+      e = push(k, num);
+      break;
+    case '"':
+      p = strchr(p + 1, '"') orelse p + strlen(p) - 1;
+      e = push(k, num);
+      break;
+    case '$':
+      p++;
+      if (isdigit(*p)) {
+        size_t i = (size_t)(*p - '1');
+        if (args == nullptr || *p == '0' || *p == '9') e = ERR_UNKNOWN_CHAR;
+        else e = push(k, i < argc ? args[i] : num);
+      } else if (!islower(*p)) e = ERR_UNKNOWN_CHAR;
+      else if (!k->set[*p - 'a']) e = ERR_UNSET_REGISTER;
+      else e = push(k, k->reg[*p - 'a']);
+      break;
+    case '&':
+      p++;
+      if (!islower(*p)) e = ERR_UNKNOWN_CHAR;
+      else if ((e = need(k, 1)) == ERR_SUCCESS) {
+        k->reg[*p - 'a'] = *top;
+        k->set[*p - 'a'] = true;
+      }
+      break;
+    case '{': {
+      lambda_t const *l = lmdLiteral(p + 1);
+      e = checkBody(k, p + 1, p + 1 + l->len);
+      if (e == ERR_SUCCESS)
+        e = push(k, (slot_t){.kind = SLOT_LAMB, .lmd = l});
+      p += l->len + 1;
+      if (*p == '\0') p--;
+    } break;
+    case '(':
+      e = push(k, (slot_t){.rbp = k->rbp});
+      k->rbp = k->sp;
+      break;
+    case ')':
+      if (k->rbp == floor) e = ERR_CHAR_NOT_FOUND;
+      else if ((e = need(k, 1)) == ERR_SUCCESS) {
+        slot_t ret = *top;
+        k->sp = k->rbp;
+        k->rbp = k->slots[k->sp - 1].rbp;
+        k->slots[k->sp - 1] = ret;
+      }
+      break;
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+    case '%':
+    case '^':
+      if (k->sp == k->rbp) break; // an empty frame is left alone
+      if ((e = needNum(k, 1, k->rbp)) == ERR_SUCCESS)
+        reduce(k, k->sp - k->rbp, num);
+      break;
+    case '<':
+    case '=':
+    case '>':
+      if ((e = need(k, 1)) == ERR_SUCCESS) reduce(k, k->sp - k->rbp, num);
+      break;
+    case 'h':
+    case 'a':
+    case 'l':
+      p++;
+      [[fallthrough]];
+    case 'A':
+    case 'C':
+    case 'F':
+    case 'R':
+    case 'g':
+    case 'c':
+    case 's':
+    case 't':
+    case 'm':
+    case 'r':
+    case 'd':
+      e = needNum(k, 1, k->sp - 1);
+      break;
+    case 'i':
+      if (!strchr("glpc", *++p)) break;
+      [[fallthrough]];
+    case 'L':
+      if ((e = need(k, 2)) == ERR_SUCCESS) reduce(k, 2, num);
+      break;
+    case '.':
+      if (p[1] != '.') break;
+      p += 1 + (p[2] == '.');
+      if ((e = need(k, 2)) == ERR_SUCCESS) reduce(k, 2, num);
+      break;
+    case 'D':
+      e = sampleTop(k, 2);
+      break;
+    case 'S':
+    case 'I':
+    case 'Z':
+    case 'M':
+      e = sampleTop(k, 3);
+      break;
+    case 'v': {
+      char op = *++p;
+      if (!strchr("cnx", op)) e = sampleTop(k, strchr("rl", op) ? 3 : 2);
+      else if ((e = need(k, 1)) == ERR_SUCCESS) reduce(k, 1, num);
+    } break;
+    case 'O': { // as rpxOde counts its lambdas, failing or not
+      size_t n = 0;
+      while (n < k->sp - k->rbp && top[-(ptrdiff_t)n].kind == SLOT_LAMB) n++;
+      if ((e = sample(k, n)) != ERR_SUCCESS) break;
+      k->sp = bigger(k->rbp + 1, k->sp - lesser(k->sp, 2 * n + 1));
+      k->slots[k->sp - 1] = num;
+    } break;
+    case '?':
+      if ((e = need(k, 3)) == ERR_SUCCESS)
+        reduce(k, 3, merge(top[-2], top[-1]));
+      break;
+    case '!':
+      e = callTop(k);
+      break;
+    case '@':
+      e = runSysFn(k, *++p);
+      break;
+    default:
+      break;
+    }
+  }
+  if (e == ERR_SUCCESS && k->sp == k->rbp) e = ERR_MISSING_OPERAND;
+  return e;
+}
+
+/**
+ * @brief Refuse what the evaluator would crash on: stack underflow and
+ *        overflow, unset and unknown registers, calls of values that are
+ *        not lambdas, unbalanced groups and tokens cut by the end
+ * @param[in] info Registers and history the expression would see
+ * @param[out] at Token that failed
+ */
+errcode_t
+checkExprReal(char const *expr, rrtinfo_t const *info, char const **at) {
+  check_t *k drop = palloc(sizeof(check_t));
+  k->sp = k->rbp = k->depth = k->calls = 0;
+  k->info = info;
+  for (size_t i = 0; i < alpha_n; i++) {
+    k->set[i] = !isUnset(info->reg + i);
+    k->reg[i] = slotOf(info->reg + i);
+    k->assigned[i] = false;
+  }
+  for (char const *q = expr; (q = strchr(q, '&')) != nullptr && *++q;)
+    if (islower(*q)) k->assigned[*q - 'a'] = true;
+  errcode_t e = run(k, expr, nullptr, 0);
+  *at = k->at;
+  return e;
+}
+
+//! @brief Check with $f holding {$1 2 ^} and no history
+static int checkOf(char const *expr) {
+  rrtinfo_t info = {.histi = ~0UL};
+  info.reg['f' - 'a'] = (real_t){.elem = {.lamb = lmdIntern("$1 2 ^", 6)}};
+  char const *at;
+  return checkExprReal(expr, &info, &at);
+}
+
+test_table(
+  exprcheck, checkOf, (int, char const *),
+  {
+    {        ERR_SUCCESS,                              "1 2 +"},
+    {        ERR_SUCCESS,                             "3 $f !"},
+    {        ERR_SUCCESS,                     "3 {$1 2 ^}&g !"},
+    {        ERR_SUCCESS, "2 {$1 {$1} {$1 1 -} ($1 1 <) ? !}!"},
+    {        ERR_SUCCESS,                     "0 1 {$1 2 *} I"},
+    {        ERR_SUCCESS,                          "(1 2 +) 3"},
+    {        ERR_SUCCESS,                             "1 2 ,)"},
+    {   ERR_UNKNOWN_CHAR,                                 "$?"},
+    {   ERR_UNKNOWN_CHAR,                                "\t1"},
+    {   ERR_UNKNOWN_CHAR,                                 "$1"},
+    {ERR_MISSING_OPERAND,                                  "+"},
+    {ERR_MISSING_OPERAND,                                "1 ?"},
+    {ERR_MISSING_OPERAND,                                "1 ("},
+    {ERR_MISSING_OPERAND,                              "{$1}!"},
+    {ERR_MISSING_OPERAND,                       "0 1 {$1 ?} S"},
+    {ERR_MISSING_OPERAND,                                 "@a"},
+    { ERR_UNSET_REGISTER,                             "1 $q +"},
+    { ERR_UNSET_REGISTER,                           "{$q} 1 +"},
+    {  ERR_TYPE_MISMATCH,                                "3 !"},
+    {  ERR_TYPE_MISMATCH,                      "{1} {$1 2 +}!"},
+    { ERR_CHAR_NOT_FOUND,                           "(1 2 +))"},
+    { ERR_CHAR_NOT_FOUND,                            "1 {)} +"},
+    { ERR_CHAR_NOT_FOUND,                                "1 h"},
+}
+)
@@ -4,9 +4,14 @@
  */
 
 #include "graphplot.h"
+#include "benchmarking.h"
 #include "evalfn.h"
+#include "jit.h"
+#include "optexpr.h"
 #include "rtconf.h"
 #include "testing.h"
+#include <math.h>
+#include <string.h>
 #include <sys/ioctl.h>
 
 constexpr double fontrow = 2;
@@ -47,28 +52,41 @@ static void drawAxisX(double const xn, int const disp_size, double const dx) {
   putchar('\n');
 }
 
+/**
+ * @brief Optimize expr for the sweep
+ * @param[out] code Buffer of buf_size bytes
+ */
+static void compilePlotExpr(char *code, char const *expr) {
+  strncpy(code, expr, buf_size - 1);
+  code[buf_size - 1] = '\0';
+  optexprInvariant(code);
+}
+
+static double
+evalAt(machine_t *restrict ei, jitexpr_t *restrict jit, double x, double y) {
+  real_t args[arg_n] = {
+    [arg_n - 1] = (real_t){.elem = {.real = x}, .isnum = true},
+    [arg_n - 2] = (real_t){.elem = {.real = y}, .isnum = true},
+  };
+  return jitEval(jit, ei, args).elem.real;
+}
+
 [[gnu::nonnull]] void plotexpr(char const *restrict expr) {
   plotcfg_t pcfg = getPlotCfg();
+  char code[buf_size];
+  compilePlotExpr(code, expr);
   machine_t ei;
+  initEvalinfo(&ei);
+  jitexpr_t jit ondrop(jitFree);
+  jitInit(&jit, code);
 
   for (int i = 0; i < pcfg.dispy; i++) {
     double y = pcfg.yx - pcfg.dy * i;
     printf("%.3lf\t|", y);
-    double x0 = pcfg.xn - pcfg.dx;
-    real_t stack = (real_t){.elem = {.real = x0}, .isnum = true};
-    initEvalinfo(&ei);
-    ei.e.args = &stack - 7;
-    ei.c.expr = expr;
-    rpxEval(&ei);
-    double y0 = ei.s.rsp->elem.real;
+    double y0 = evalAt(&ei, &jit, pcfg.xn - pcfg.dx, 0);
     for (int j = 0; j < pcfg.dispx / font_ratio; j++) {
-      stack.elem.real = pcfg.xn + pcfg.dx * j + pcfg.dx;
-
-      ei.c.expr = expr;
-      rpxEval(&ei);
-      double y1 = ei.s.rsp->elem.real;
+      double y1 = evalAt(&ei, &jit, pcfg.xn + pcfg.dx * j + pcfg.dx, 0);
       putchar(isPointGraph(y0, y1, y, pcfg.dy) ? '*' : ' ');
-      fflush(stdout);
       y0 = y1;
     }
 
@@ -80,30 +98,21 @@ static void drawAxisX(double const xn, int const disp_size, double const dx) {
 
 [[gnu::nonnull]] void plotexprImplicit(char const *restrict expr) {
   plotcfg_t pcfg = getPlotCfg();
+  char code[buf_size];
+  compilePlotExpr(code, expr);
   machine_t ei;
+  initEvalinfo(&ei);
+  jitexpr_t jit ondrop(jitFree);
+  jitInit(&jit, code);
 
   double y0 = pcfg.yx + pcfg.dy;
   for (int i = 0; i < pcfg.dispy; i++) {
     double y = pcfg.yx - pcfg.dy * i;
     printf("%.3lf\t|", y);
-    double x0 = pcfg.xn - pcfg.dx;
     double y1 = pcfg.yx - pcfg.dy * (i - 1);
-    real_t stack[2] = {
-      (real_t){.elem = {.real = y0}, .isnum = true},
-      (real_t){.elem = {.real = x0}, .isnum = true},
-    };
-    initEvalinfo(&ei);
-    ei.e.args = stack - 6;
-    ei.c.expr = expr;
-    rpxEval(&ei);
-    double res0 = ei.s.rsp->elem.real;
+    double res0 = evalAt(&ei, &jit, pcfg.xn - pcfg.dx, y0);
     for (int j = 0; j < pcfg.dispx / font_ratio; j++) {
-      double x1 = pcfg.xn + pcfg.dx * (j + 1);
-      stack[0] = (real_t){.elem = {.real = y1}, .isnum = true};
-      stack[1] = (real_t){.elem = {.real = x1}, .isnum = true};
-      ei.c.expr = expr;
-      rpxEval(&ei);
-      double res1 = ei.s.rsp->elem.real;
+      double res1 = evalAt(&ei, &jit, pcfg.xn + pcfg.dx * (j + 1), y1);
       putchar(isPointGraph(res0, res1, 0, pcfg.dy) ? '*' : ' ');
       res0 = res1;
     }
@@ -115,6 +124,84 @@ static void drawAxisX(double const xn, int const disp_size, double const dx) {
   drawAxisX(pcfg.xn, pcfg.dispx, pcfg.dx);
 }
 
+/**
+ * @brief Compile every expression of the plot corpus and evaluate it at
+ *        cols points of [-10, 10], as plotexpr does for one row
+ * @return Points evaluated
+ */
+static double sweepCorpus(int cols) {
+  benchcorpus_t const *c = benchCorpus("plot.rpx");
+  machine_t ei;
+  initEvalinfo(&ei);
+  for (size_t i = 0; i < c->n; i++) {
+    char code[buf_size];
+    compilePlotExpr(code, c->lines[i]);
+    jitexpr_t jit ondrop(jitFree);
+    jitInit(&jit, code);
+    for (int j = 0; j < cols; j++) evalAt(&ei, &jit, 20.0 * j / cols - 10, 0);
+  }
+  return (double)c->n * cols;
+}
+
+bench_rate(workload_plot_64, "points") {
+  return sweepCorpus(64);
+}
+
+bench_rate(workload_plot_256, "points") {
+  return sweepCorpus(256);
+}
+
+bench_rate(workload_plot_1024, "points") {
+  return sweepCorpus(1024);
+}
+
+/**
+ * @brief Component c at x, linear between the two points around it
+ * @param[in] pts n points of t and dim components, t monotonic
+ * @return NaN outside of the points
+ */
+static double
+interpAt(double const *pts, size_t n, size_t dim, size_t c, double x) {
+  size_t w = dim + 1, lo = 0, hi = n;
+  bool asc = pts[0] <= pts[(n - 1) * w];
+  while (lo < hi) { // first point not before x
+    size_t mid = (lo + hi) / 2;
+    if (asc ? pts[mid * w] < x : x < pts[mid * w]) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo == n || (lo == 0 && pts[0] != x)) return NAN;
+  if (lo == 0) return pts[1 + c];
+  double const *p0 = pts + (lo - 1) * w, *p1 = p0 + w;
+  return p0[1 + c] + (x - p0[0]) / (p1[0] - p0[0]) * (p1[1 + c] - p0[1 + c]);
+}
+
+/**
+ * @brief Plot every component of a trajectory over t
+ * @param[in] pts n points of t and dim components, as ODE sinks see them
+ */
+[[gnu::nonnull]] void plotPoints(double const *pts, size_t n, size_t dim) {
+  if (n == 0) return;
+  plotcfg_t pcfg = getPlotCfg();
+  for (int i = 0; i < pcfg.dispy; i++) {
+    double y = pcfg.yx - pcfg.dy * i;
+    printf("%.3lf\t|", y);
+    for (int j = 0; j < pcfg.dispx / font_ratio; j++) {
+      double x = pcfg.xn + pcfg.dx * j;
+      bool point = false;
+      for (size_t c = 0; c < dim && !point; c++) {
+        double y0 = interpAt(pts, n, dim, c, x);
+        double y1 = interpAt(pts, n, dim, c, x + pcfg.dx);
+        point = isPointGraph(y0, y1, y, pcfg.dy);
+      }
+      putchar(point ? '*' : ' ');
+    }
+
+    putchar('\n');
+  }
+
+  drawAxisX(pcfg.xn, pcfg.dispx, pcfg.dx);
+}
+
 static void setPlotBounds(
   double const xx, double const xn, double const yx, double const yn
 ) {
@@ -0,0 +1,398 @@
+/**
+ * @file src/jit.c
+ * @brief Define template JIT for real number mode expressions
+ *
+ * Register IR is translated instruction by instruction into x86-64. IR slots
+ * 0..13 live in xmm2..xmm15 and the rest in the native stack frame
+ * ([rsp + 8i] is slot i), with the arguments in rbx. Every xmm register is
+ * caller-saved, so live slots are spilled around libm calls.
+ */
+
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include "jit.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "testing.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+constexpr size_t jit_codesize = 1 << 13;
+constexpr int32_t jit_framesize = (int32_t)(buf_size * sizeof(double));
+constexpr size_t jit_xmm_n = 14; // slots kept in registers
+
+constexpr uint8_t reg_rax = 0;
+constexpr uint8_t reg_rbx = 3;
+constexpr uint8_t reg_rsp = 4;
+
+constexpr uint8_t op_load = 0x10;
+constexpr uint8_t op_store = 0x11;
+constexpr uint8_t op_add = 0x58;
+constexpr uint8_t op_mul = 0x59;
+constexpr uint8_t op_sub = 0x5C;
+constexpr uint8_t op_div = 0x5E;
+
+typedef struct {
+  uint8_t *code;
+  size_t len;
+  bool fail;
+} jitbuf_t;
+
+static void emit(jitbuf_t *b, void const *bytes, size_t n) {
+  if (jit_codesize < b->len + n) [[clang::unlikely]] {
+    b->fail = true;
+    return;
+  }
+  memcpy(b->code + b->len, bytes, n);
+  b->len += n;
+}
+
+#define EMIT(b, ...) \
+  emit( \
+    b, (uint8_t const[]){__VA_ARGS__}, sizeof((uint8_t const[]){__VA_ARGS__}) \
+  )
+
+static void emit32(jitbuf_t *b, int32_t v) {
+  emit(b, &v, sizeof v);
+}
+
+static void emit64(jitbuf_t *b, uint64_t v) {
+  emit(b, &v, sizeof v);
+}
+
+static int32_t disp(size_t i) {
+  return (int32_t)(i * sizeof(double));
+}
+
+static bool inXmm(size_t slot) {
+  return slot < jit_xmm_n;
+}
+
+static uint8_t xmmOf(size_t slot) {
+  return (uint8_t)(slot + 2);
+}
+
+//! @brief F2 [REX] 0F op /r between two xmm registers
+static void sseRR(jitbuf_t *b, uint8_t op, uint8_t reg, uint8_t rm) {
+  EMIT(b, 0xF2);
+  if (reg >= 8 || rm >= 8) EMIT(b, (uint8_t)(0x40 | (reg >> 3) << 2 | rm >> 3));
+  EMIT(b, 0x0F, op, (uint8_t)(0xC0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+//! @brief F2 [REX] 0F op /r with [base + disp32]
+static void
+sseMem(jitbuf_t *b, uint8_t op, uint8_t reg, uint8_t base, int32_t d) {
+  EMIT(b, 0xF2);
+  if (reg >= 8) EMIT(b, 0x44);
+  EMIT(b, 0x0F, op, (uint8_t)(0x80 | (reg & 7) << 3 | base));
+  if (base == reg_rsp) EMIT(b, 0x24); // SIB
+  emit32(b, d);
+}
+
+//! @brief mov rax, imm64
+static void loadRax(jitbuf_t *b, uint64_t v) {
+  EMIT(b, 0x48, 0xB8);
+  emit64(b, v);
+}
+
+static void loadImm(jitbuf_t *b, uint8_t x, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof bits);
+  loadRax(b, bits);
+  EMIT(b, 0x66, (uint8_t)(0x48 | (x >> 3) << 2), 0x0F, 0x6E); // movq
+  EMIT(b, (uint8_t)(0xC0 | (x & 7) << 3));
+}
+
+//! @brief xmm{x} = slot
+static void fromSlot(jitbuf_t *b, uint8_t x, size_t slot) {
+  if (!inXmm(slot)) sseMem(b, op_load, x, reg_rsp, disp(slot));
+  else if (xmmOf(slot) != x) sseRR(b, op_load, x, xmmOf(slot));
+}
+
+//! @brief slot = xmm{x}
+static void toSlot(jitbuf_t *b, size_t slot, uint8_t x) {
+  if (!inXmm(slot)) sseMem(b, op_store, x, reg_rsp, disp(slot));
+  else if (xmmOf(slot) != x) sseRR(b, op_load, xmmOf(slot), x);
+}
+
+//! @brief Register the result of an instruction is computed in
+static uint8_t target(size_t slot) {
+  return inXmm(slot) ? xmmOf(slot) : 0;
+}
+
+static void spill(jitbuf_t *b, size_t depth) {
+  for (size_t i = 0; i < lesser(depth, jit_xmm_n); i++)
+    sseMem(b, op_store, xmmOf(i), reg_rsp, disp(i));
+}
+
+static void reload(jitbuf_t *b, size_t depth, size_t except) {
+  for (size_t i = 0; i < lesser(depth, jit_xmm_n); i++)
+    if (i != except) sseMem(b, op_load, xmmOf(i), reg_rsp, disp(i));
+}
+
+static void emitArith(jitbuf_t *b, uint8_t op, irinst_t const *in) {
+  uint8_t x = inXmm(in->dst) && in->dst == in->a ? xmmOf(in->dst) : 0;
+  fromSlot(b, x, in->a);
+  uint8_t rhs = 1;
+  if (in->bimm) loadImm(b, 1, in->imm);
+  else if (inXmm(in->b)) rhs = xmmOf(in->b);
+  else fromSlot(b, 1, in->b);
+  sseRR(b, op, x, rhs);
+  toSlot(b, in->dst, x);
+}
+
+//! @brief Call a helper with every live slot saved in the frame
+static void emitCall(jitbuf_t *b, irinst_t const *in, uintptr_t fn) {
+  spill(b, in->depth);
+  if (in->op == IR_CMP) {
+    EMIT(b, 0x48, 0x8D, 0xBC, 0x24); // lea rdi, [rsp + 8dst]
+    emit32(b, disp(in->dst));
+    EMIT(b, 0xBE); // mov esi, n
+    emit32(b, (int32_t)in->b);
+    EMIT(b, 0xBA); // mov edx, op
+    emit32(b, (int32_t)in->c);
+  }
+  // xmm2 holds slot 0, so it is overwritten last
+  if (IR_CALL1 <= in->op && in->op <= IR_CALL3) fromSlot(b, 0, in->a);
+  if (IR_CALL2 <= in->op && in->op <= IR_CALL3) fromSlot(b, 1, in->b);
+  if (in->op == IR_CALL3) fromSlot(b, 2, in->c);
+  loadRax(b, fn);
+  EMIT(b, 0xFF, 0xD0); // call rax
+  reload(b, in->depth, in->dst);
+  toSlot(b, in->dst, 0);
+}
+
+static void emitInst(jitbuf_t *b, irinst_t const *in) {
+  uint8_t x = target(in->dst);
+  switch (in->op) {
+  case IR_IMM:
+    loadImm(b, x, in->imm);
+    toSlot(b, in->dst, x);
+    break;
+  case IR_ARG:
+    sseMem(b, op_load, x, reg_rbx, disp(in->k));
+    toSlot(b, in->dst, x);
+    break;
+  case IR_LOAD:
+    loadRax(b, (uint64_t)(uintptr_t)in->src);
+    sseMem(b, op_load, x, reg_rax, 0);
+    toSlot(b, in->dst, x);
+    break;
+  case IR_STORE:
+    fromSlot(b, 0, in->a);
+    loadRax(b, (uint64_t)(uintptr_t)in->reg);
+    sseMem(b, op_store, 0, reg_rax, 0);
+    EMIT(b, 0xC6, 0x40, (uint8_t)offsetof(real_t, isnum), 1); // isnum = true
+    break;
+  case IR_MOV:
+    fromSlot(b, x, in->a);
+    toSlot(b, in->dst, x);
+    break;
+  case IR_ADD:
+    emitArith(b, op_add, in);
+    break;
+  case IR_SUB:
+    emitArith(b, op_sub, in);
+    break;
+  case IR_MUL:
+    emitArith(b, op_mul, in);
+    break;
+  case IR_DIV:
+    emitArith(b, op_div, in);
+    break;
+  case IR_CALL0:
+    emitCall(b, in, (uintptr_t)in->fn0);
+    break;
+  case IR_CALL1:
+    emitCall(b, in, (uintptr_t)in->fn1);
+    break;
+  case IR_CALL2:
+    emitCall(b, in, (uintptr_t)in->fn2);
+    break;
+  case IR_CALL3:
+    emitCall(b, in, (uintptr_t)in->fn3);
+    break;
+  case IR_CMP:
+    emitCall(b, in, (uintptr_t)in->fnv);
+    break;
+  case IR_RET:
+    fromSlot(b, 0, in->a);
+    EMIT(b, 0x48, 0x81, 0xC4); // add rsp, framesize
+    emit32(b, jit_framesize);
+    EMIT(b, 0x5B, 0xC3); // pop rbx; ret
+    break;
+  default:
+    b->fail = true;
+  }
+}
+
+#ifdef __x86_64__
+static bool emitNative(jitexpr_t *j) {
+  size_t pg = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (jit_codesize + pg - 1) / pg * pg;
+  void *page = mmap(
+    nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+  );
+  if (page == MAP_FAILED) [[clang::unlikely]]
+    return false;
+
+  jitbuf_t b = {.code = page};
+  EMIT(&b, 0x53);             // push rbx
+  EMIT(&b, 0x48, 0x81, 0xEC); // sub rsp, framesize
+  emit32(&b, jit_framesize);
+  EMIT(&b, 0x48, 0x89, 0xFB); // mov rbx, rdi
+  for (size_t i = 0; i < j->ir->n; i++) emitInst(&b, j->ir->code + i);
+
+  if (b.fail || mprotect(page, size, PROT_READ | PROT_EXEC) < 0) {
+    munmap(page, size);
+    return false;
+  }
+  j->page = page;
+  j->pagesize = size;
+  j->fn = (jitfn_t)(uintptr_t)page;
+  return true;
+}
+#endif
+
+/**
+ * @brief Compile the expression of j to register IR, then to native code
+ * @param[in] ei Machine whose registers and history the code refers to
+ * @return Whether the expression left the stack interpreter
+ */
+bool jitCompile(jitexpr_t *j, machine_t *ei) {
+  irprog_t *ir = palloc(sizeof(irprog_t));
+  if (!irCompile(ir, j->expr, ei)) {
+    free(ir);
+    return false;
+  }
+  j->ir = ir;
+#ifdef __x86_64__
+  emitNative(j); // IR interpreter otherwise
+#endif
+  return true;
+}
+
+void jitInit(jitexpr_t *j, char const *expr) {
+  *j = (jitexpr_t){
+    .expr = expr, .count = 0, .fn = nullptr, .ir = nullptr, .page = nullptr
+  };
+}
+
+void jitFree(jitexpr_t *j) {
+  if (j->page != nullptr) munmap(j->page, j->pagesize);
+  nfree(j->ir);
+  j->page = nullptr;
+  j->fn = nullptr;
+}
+
+/**
+ * @brief Evaluate with bound arguments, compiling once the expression is hot
+ * @param[in,out] ei Machine used for every evaluation of j
+ * @param[in] args Arguments in reverse order ($1 is args[arg_n - 1])
+ * @return Same as evalWithArgs
+ */
+real_t jitEval(jitexpr_t *j, machine_t *ei, real_t *args) {
+  if (j->ir != nullptr) [[clang::likely]] {
+    double argv[arg_n];
+    for (size_t i = 0; i < arg_n; i++) argv[i] = args[arg_n - 1 - i].elem.real;
+    double res = j->fn ? j->fn(argv) : irRun(j->ir, argv);
+    return (real_t){.elem = {.real = res}, .isnum = true};
+  }
+  if (j->count < jit_threshold && ++j->count == jit_threshold)
+    jitCompile(j, ei); // stays interpreted on failure
+  return evalWithArgs(ei, j->expr, args);
+}
+
+static bool jitMatches(char const *expr) {
+#ifdef __x86_64__
+  machine_t ei;
+  initEvalinfo(&ei);
+  real_t args[arg_n] = {
+    [arg_n - 1] = (real_t){.elem = {.real = 3}, .isnum = true},
+    [arg_n - 2] = (real_t){.elem = {.real = 4}, .isnum = true},
+  };
+  double want = evalWithArgs(&ei, expr, args).elem.real;
+  jitexpr_t j ondrop(jitFree) = {};
+  jitInit(&j, expr);
+  if (!jitCompile(&j, &ei)) return false;
+  double got = jitEval(&j, &ei, args).elem.real;
+  return got == want || (isnan(got) && isnan(want));
+#else
+  _ = expr;
+  return true;
+#endif
+}
+
+test_table(
+  jit, jitMatches, (bool, char const *),
+  {
+    {true,               "$1 $2 +"},
+    {true,           "1 2 3 4 5 +"},
+    {true,          "$1 $2 - $1 /"},
+    {true, "$1 s 2 ^ ($1 c 2 ^) +"},
+    {true,           "$1 $2 2 ^ %"},
+    {true,      "$1 $2 ($2 5 <) ?"},
+    {true,     "$1 @n ($2 $1 <) ?"},
+    {true,                "$1 3 ="},
+    {true,             "\\P 2 / s"},
+    {true,              "$1 m A R"},
+    {true,          "$1 r d hs at"},
+    {true,            "$1 10 L l2"},
+    {true,              "12 $1 ig"},
+    {true,               "$1 @p *"},
+    {true,        "1 2 (3 $2 *) +"},
+    {true,            "$1 &x $x *"},
+    {true,              "$1 , 2 +"},
+}
+)
+
+test (jit_spill) { // more slots than xmm registers
+  expect(jitMatches(
+    "1 (2 (3 (4 (5 (6 (7 (8 (9 (10 (11 (12 (13 (14 (15 (16 ($1 s $2 @n ? "
+    "+) +) +) +) +) +) +) +) +) +) +) +) +) +) +) +)"
+  ));
+}
+
+test (jit_fallback) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  real_t args[arg_n] = {[arg_n - 1] = {.elem = {.real = 5}, .isnum = true}};
+  char const *const refused[] = {"$1 {$1 2 *} !", "@h", "@s", "+", "1 )"};
+  for (size_t i = 0; i < sizeof refused / sizeof *refused; i++) {
+    jitexpr_t j ondrop(jitFree) = {};
+    jitInit(&j, refused[i]);
+    expect(!jitCompile(&j, &ei));
+  }
+
+  jitexpr_t j ondrop(jitFree) = {};
+  jitInit(&j, "{$1 2 *} !");
+  for (size_t i = 0; i <= jit_threshold; i++)
+    expecteq(10, jitEval(&j, &ei, args).elem.real);
+  expect(j.fn == nullptr);
+}
+
+static char const bench_expr[] = "$1 s 2 ^ ($1 c 2 ^) + $2 *";
+
+bench (interp_sweep) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  real_t args[arg_n] = {};
+  for (int i = 0; i < 1000; i++) {
+    args[arg_n - 1] = (real_t){.elem = {.real = i}, .isnum = true};
+    _ = evalWithArgs(&ei, bench_expr, args);
+  }
+}
+
+bench (jit_sweep) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  real_t args[arg_n] = {};
+  jitexpr_t j ondrop(jitFree) = {};
+  jitInit(&j, bench_expr);
+  for (int i = 0; i < 1000; i++) {
+    args[arg_n - 1] = (real_t){.elem = {.real = i}, .isnum = true};
+    _ = jitEval(&j, &ei, args);
+  }
+}
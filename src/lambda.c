@@ -0,0 +1,259 @@
+/**
+ * @file src/lambda.c
+ * @brief Define the lambda intern table
+ */
+
+#include "lambda.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "testing.h"
+#include <pthread.h>
+#include <string.h>
+
+constexpr size_t lmd_init_cap = 64; // must be a power of 2
+constexpr size_t lit_cache_n = 256; // must be a power of 2
+
+static pthread_mutex_t lmd_mtx = PTHREAD_MUTEX_INITIALIZER;
+static lambda_t **lmd_slots; // open addressing, nullptr is empty
+static size_t lmd_cap, lmd_len;
+
+//! @brief Last lambda built from each literal, keyed by its address
+typedef struct {
+  char const *src;
+  lambda_t const *lmd;
+} litcache_t;
+
+static thread_local litcache_t lit_cache[lit_cache_n];
+
+typedef struct {
+  lambda_t const *lmd; // nullptr if empty
+  double args[arg_n];  // compared bitwise, only argc of them
+  real_t ret;
+  uint64_t used; // memo_clock at the last hit or insertion
+} memoent_t;
+
+static pthread_mutex_t memo_mtx = PTHREAD_MUTEX_INITIALIZER;
+static memoent_t (*memo)[memo_ways]; // memo_sets sets, allocated on demand
+static uint64_t memo_clock;
+static memostat_t memo_stat;
+
+static uint64_t fnv1a(char const *s, size_t len) {
+  uint64_t h = 0xcbf2'9ce4'8422'2325;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 0x100'0000'01b3;
+  return h;
+}
+
+static lambda_t **
+findSlot(lambda_t **slots, size_t cap, char const *body, size_t len) {
+  uint64_t hash = fnv1a(body, len);
+  size_t i = hash & (cap - 1);
+  for (lambda_t *l; (l = slots[i]) != nullptr; i = (i + 1) & (cap - 1))
+    if (l->hash == hash && l->len == len && !memcmp(l->body, body, len))
+      break;
+  return slots + i;
+}
+
+static void grow(void) {
+  size_t cap = lmd_cap ? lmd_cap * 2 : lmd_init_cap;
+  lambda_t **slots = zalloc(lambda_t *, cap);
+  for (size_t i = 0; i < lmd_cap; i++)
+    if (lmd_slots[i] != nullptr)
+      *findSlot(slots, cap, lmd_slots[i]->body, lmd_slots[i]->len) =
+        lmd_slots[i];
+  free(lmd_slots);
+  lmd_slots = slots;
+  lmd_cap = cap;
+}
+
+/**
+ * @brief Arguments a body takes: the highest $1..$8 before ',' or ';',
+ *        outside nested lambdas
+ * @note The interpreter, the register IR and the optimizer all go by it
+ */
+size_t lmdArgc(char const *body) {
+  size_t argc = 0;
+  for (int nest = 0; *body; body++)
+    if (*body == '{') nest++;
+    else if (*body == '}') nest--;
+    else if (nest == 0 && (*body == ',' || *body == ';')) break;
+    else if (nest == 0 && *body == '$' && '1' <= body[1] && body[1] <= '8')
+      argc = bigger(argc, (size_t)(body[1] - '0'));
+  return argc;
+}
+
+static void compileBody(lambda_t *l) {
+  // ',' and ';' stop the caller too, which only the interpreter does
+  if (strpbrk(l->body, ",;") != nullptr) return;
+  irprog_t *p drop = palloc(sizeof(irprog_t));
+  if (!irCompile(p, l->body + l->memo, nullptr)) return;
+  l->code = zalloc(irinst_t, p->n);
+  memcpy(l->code, p->code, p->n * sizeof(irinst_t));
+  l->batch = irBatchable(l->code);
+}
+
+static lambda_t *newLambda(char const *body, size_t len) {
+  lambda_t *l = palloc(sizeof(lambda_t));
+  *l = (lambda_t){
+    .body = zalloc(char, len + 2) + 1, .len = len, .hash = fnv1a(body, len)
+  };
+  l->body[-1] = '{';
+  memcpy(l->body, body, len);
+  l->body[len] = '\0';
+  l->argc = lmdArgc(l->body);
+  l->memo = l->body[0] == '#';
+  compileBody(l);
+  return l;
+}
+
+/**
+ * @brief Find or create the entry holding body
+ * @param[in] body Not necessarily NUL-terminated
+ * @return Entry that lives until exit
+ */
+lambda_t const *lmdIntern(char const *body, size_t len) {
+  pthread_mutex_lock(&lmd_mtx);
+  if (2 * (lmd_len + 1) > lmd_cap) grow();
+  lambda_t **slot = findSlot(lmd_slots, lmd_cap, body, len);
+  if (*slot == nullptr) {
+    *slot = newLambda(body, len);
+    lmd_len++;
+  }
+  lambda_t const *l = *slot;
+  pthread_mutex_unlock(&lmd_mtx);
+  return l;
+}
+
+/**
+ * @brief Intern the lambda literal whose body starts at src
+ * @param[in] src Just after '{'
+ * @return Entry whose len is the distance to the matching '}'
+ */
+lambda_t const *lmdLiteral(char const *src) {
+  litcache_t *e = lit_cache + ((uintptr_t)src >> 2 & (lit_cache_n - 1));
+  if (e->src == src) {
+    size_t len = e->lmd->len;
+    if (!strncmp(src, e->lmd->body, len) && src[len] == '}') return e->lmd;
+  }
+  size_t len = 0;
+  for (int nest = 1; src[len]; len++)
+    if (src[len] == '{') nest++;
+    else if (src[len] == '}' && !--nest) break;
+  *e = (litcache_t){src, lmdIntern(src, len)};
+  return e->lmd;
+}
+
+static memoent_t *memoSet(lambda_t const *l, double const *args) {
+  uint64_t h = l->hash ^ fnv1a((char const *)args, l->argc * sizeof(double));
+  return memo[(h ^ h >> 29) & (memo_sets - 1)];
+}
+
+static bool memoHit(memoent_t const *e, lambda_t const *l, double const *args) {
+  return e->lmd == l && !memcmp(e->args, args, l->argc * sizeof(double));
+}
+
+/**
+ * @brief Look up the result of a memoized call
+ * @param[in] args $1..$argc in order
+ * @param[out] ret Cached result, untouched on a miss
+ */
+bool memoGet(lambda_t const *l, double const *args, real_t *ret) {
+  pthread_mutex_lock(&memo_mtx);
+  memoent_t *e = nullptr;
+  if (memo != nullptr) {
+    memoent_t *set = memoSet(l, args);
+    for (size_t i = 0; e == nullptr && i < memo_ways; i++)
+      if (memoHit(set + i, l, args)) e = set + i;
+  }
+  if (e == nullptr) memo_stat.misses++;
+  else {
+    memo_stat.hits++;
+    e->used = ++memo_clock;
+    *ret = e->ret;
+  }
+  pthread_mutex_unlock(&memo_mtx);
+  return e != nullptr;
+}
+
+/**
+ * @brief Cache the result of a call, evicting the least recently used
+ *        entry of its set when the set is full
+ * @param[in] args $1..$argc in order
+ */
+void memoPut(lambda_t const *l, double const *args, real_t ret) {
+  pthread_mutex_lock(&memo_mtx);
+  if (memo == nullptr) memo = palloc(memo_sets * sizeof *memo);
+  memoent_t *set = memoSet(l, args), *e = set;
+  for (size_t i = 0; i < memo_ways; i++) {
+    if (memoHit(set + i, l, args) || set[i].lmd == nullptr) {
+      e = set + i;
+      break;
+    }
+    if (set[i].used < e->used) e = set + i;
+  }
+  if (e->lmd == nullptr) memo_stat.len++;
+  else if (!memoHit(e, l, args)) memo_stat.evictions++;
+  *e = (memoent_t){.lmd = l, .ret = ret, .used = ++memo_clock};
+  memcpy(e->args, args, l->argc * sizeof(double));
+  pthread_mutex_unlock(&memo_mtx);
+}
+
+memostat_t memoStat(void) {
+  pthread_mutex_lock(&memo_mtx);
+  memostat_t stat = memo_stat;
+  pthread_mutex_unlock(&memo_mtx);
+  return stat;
+}
+
+//! @brief Drop every cached result and reset the counters
+void memoClear(void) {
+  pthread_mutex_lock(&memo_mtx);
+  nfree(memo);
+  memo_stat = (memostat_t){};
+  pthread_mutex_unlock(&memo_mtx);
+}
+
+test (lambda_intern) {
+  char const *a = "{$1 2 *} {$1 2 *} {$1 {$2}! +}";
+  lambda_t const *x = lmdLiteral(a + 1), *y = lmdLiteral(a + 10);
+  expecteq((void *)x, (void *)y);
+  expecteq(1, x->argc);
+  expecteq(true, x->code != nullptr);
+  expecteq(true, x->batch);
+  lambda_t const *z = lmdLiteral(a + 19);
+  expecteq("$1 {$2}! +", z->body);
+  expecteq(true, z->code == nullptr); // nested lambdas are interpreted
+  expecteq((void *)x, (void *)lmdIntern("$1 2 *", 6));
+  expecteq(2, lmdIntern("$2 {$3}! $1", 11)->argc);
+  expecteq(1, lmdArgc("$1 $9 $0 +")); // not arguments
+  lambda_t const *w = lmdIntern("$1 2+$8, garbage", 5); // body is a prefix
+  expecteq("$1 2+", w->body);
+  expecteq(1, w->argc);
+  expecteq(true, w->code != nullptr);
+  expecteq(5.0, irExec(w->code, (double[arg_n]){3}));
+}
+
+test (memo_lru) {
+  memoClear();
+  lambda_t const *l = lmdIntern("#$1 1 +", 7);
+  real_t ret = {};
+  double args[memo_sets * memo_ways + 1];
+  for (size_t i = 0; i < memo_sets * memo_ways + 1; i++) {
+    args[i] = (double)i;
+    real_t r = {.elem = {.real = args[i] + 1}, .isnum = true};
+    memoPut(l, args + i, r);
+  }
+  memostat_t stat = memoStat();
+  expecteq(memo_sets * memo_ways + 1, stat.len + stat.evictions);
+  expecteq(true, memoGet(l, args + memo_sets * memo_ways, &ret));
+  expecteq(memo_sets * memo_ways + 1.0, ret.elem.real);
+  expecteq(1, memoStat().hits);
+  memoClear();
+  expecteq(false, memoGet(l, args, &ret));
+  expecteq(1, memoStat().misses);
+}
+
+bench (lambda_literal) {
+  char src[] = "$1 $2 * $3 + }";
+  for (int i = 0; i < 1000; i++) lmdLiteral(src);
+}
@@ -5,6 +5,9 @@
 
 #include "main.h"
 #include "benchmarking.h"
+#include "binio.h"
+#include "csv.h"
+#include "diff.h"
 #include "editline.h"
 #include "elemop.h"
 #include "error.h"
@@ -12,18 +15,30 @@
 #include "exproriented.h"
 #include "gene.h"
 #include "graphplot.h"
+#include "lambda.h"
 #include "mathdef.h"
+#include "ode.h"
 #include "optexpr.h"
 #include "phyconst.h"
+#include "profile.h"
+#include "quad.h"
 #include "rand.h"
 #include "rc.h"
+#include "server.h"
+#include "shmring.h"
+#include "solve.h"
 #include "testing.h"
+#include "vec.h"
+#include "writer.h"
 #include <ctype.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <string.h>
 
 auto eval_f = evalExprReal;
 auto print_complex = printComplexComplex;
+void (*print_elem)(elem_t) = printElem;
 
 int main(int argc, char const **argv) {
   initPlotCfg();
@@ -32,6 +47,7 @@ int main(int argc, char const **argv) {
   procAList(argc, argv + 1);
 
   readerLoop(stdin);
+  flushWriter();
 
   return 0;
 }
@@ -76,8 +92,20 @@ void startupMsg() {
     return;
   }
   elem_t res;
+  profLineBegin(input_buf);
   res = eval_f(input_buf);
-  printElem(res);
+  profLineEnd();
+  print_elem(res);
+}
+
+/**
+ * @brief Panic unless the option at argv is followed by n operands
+ * @param[in] usage Option with its operands, for the message
+ */
+static void
+needOperands(int argc, char const **argv, int n, char const *usage) {
+  if (argc <= n) [[clang::unlikely]]
+    panic(ERR_MISSING_OPERAND, "%s (usage: %s) ", *argv, usage);
 }
 
 /**
@@ -94,13 +122,44 @@ void procAList(int argc, char const **argv) {
     readerLoop(fp);
   } else switch ((*argv)[1]) { // interpreted as a option
     case 'h':
+      flushWriter();
       startupMsg();
       break;
     case 'r':
+      needOperands(argc, argv, 1, "-r <expr>");
       procInput(*++argv);
+      argc--;
+      break;
+    case 'c': { // column-wise evaluation: -c <expr> <file>
+      needOperands(argc, argv, 2, "-c <expr> <file>");
+      char const *expr = *++argv;
+      FILE *fp dropfile
+        = fopen(*++argv, "r") ?: p$panic(ERR_FILE_NOT_FOUND, "%s ", *argv);
+      csvLoop(fp, expr);
+      argc -= 2;
+    } break;
+    case 'b': // binary output
+      flushWriter();
+      print_elem = printElemBinary;
       break;
+    case 'B': // binary input, consumes stdin
+      needOperands(argc, argv, 1, "-B <expr>");
+      binReaderLoop(stdin, *++argv);
+      exit(0);
     case 'q':
+      flushWriter();
+      exit(0);
+    case '-': { // long options taking a socket path or shm name
+      void (*run)(char const *) = !strcmp(*argv + 2, "serve")  ? serve
+                                : !strcmp(*argv + 2, "client") ? client
+                                : !strcmp(*argv + 2, "shm")    ? shmServe
+                                                               : nullptr;
+      if (run == nullptr) panic(ERR_UNKNOWN_OPTION, "%s ", *argv);
+      needOperands(argc, argv, 1, "--serve|--client|--shm <name>");
+      run(argv[1]);
+      flushWriter();
       exit(0);
+    }
     default:
       panic(ERR_UNKNOWN_OPTION, "%c ", (*argv)[1]);
     }
@@ -132,11 +191,68 @@ bool readerInteractiveLine(char *buf, size_t len, FILE *fp) {
 [[gnu::nonnull]] void readerLoop(FILE *restrict fp) {
   char input_buf[buf_size];
   auto reader_fn = fp == stdin ? readerInteractiveLine : readRawLine;
-  if (!reader_fn(input_buf, buf_size, fp)) return;
+  if (!reader_fn(input_buf, buf_size, fp)) {
+    flushWriter();
+    return;
+  }
   procInput(input_buf);
+  if (fp == stdin) flushWriter(); // interactive
   [[clang::likely]] readerLoop(fp);
 }
 
+static elem_t evalComplex(char const *, complex const *, rtinfo_t const *);
+
+//! @brief sum += x, keeping what both parts lose to rounding in err
+static void sigmaAdd(complex *sum, complex *err, complex x) {
+#pragma clang fp reassociate(off)
+  double s[2] = {creal(*sum), cimag(*sum)}, e[2] = {creal(*err), cimag(*err)};
+  double xs[2] = {creal(x), cimag(x)};
+  for (size_t i = 0; i < 2; i++) {
+    double t = s[i] + xs[i];
+    e[i] += fabs(s[i]) >= fabs(xs[i]) ? (s[i] - t) + xs[i] : (xs[i] - t) + s[i];
+    s[i] = t;
+  }
+  *sum = s[0] + I * s[1];
+  *err = e[0] + I * e[1];
+}
+
+/**
+ * @brief Sum of body at $1 = k for k = a, a+1, ..., b (Neumaier)
+ * @param[in] body Interned lambda body
+ * @param[in] info Registers the body sees
+ * @return 0 if b < a, NaN if the range is not finite or longer than seq_max,
+ *         as in real mode
+ */
+static complex
+sigma(char const *body, double a, double b, rtinfo_t const *info) {
+  if (!isfinite(a) || !isfinite(b)) return NAN;
+  if (b < a) return 0;
+  double n = floor(b - a) + 1;
+  if (seq_max < n) return NAN;
+  complex sum = 0, err = 0;
+  for (size_t i = 0; i < (size_t)n; i++) {
+    complex k = a + (double)i;
+    sigmaAdd(&sum, &err, evalComplex(body, &k, info).elem.comp);
+  }
+  return sum + err;
+}
+
+//! @brief Lambda sampled by quadIntegrate and diffRichardson
+typedef struct {
+  char const *body;
+  rtinfo_t const *info;
+} sampler_t;
+
+//! @brief The real parts of body at xs, then the imaginary parts
+static void sample(void *ctx, double const *xs, size_t n, double *ys) {
+  sampler_t const *f = ctx;
+  for (size_t i = 0; i < n; i++) {
+    complex y = evalComplex(f->body, &(complex){xs[i]}, f->info).elem.comp;
+    ys[i] = creal(y);
+    ys[n + i] = cimag(y);
+  }
+}
+
 /**
  * @brief Evaluate complex number expression
  * @param[in] expr String of expression
@@ -144,12 +260,25 @@ bool readerInteractiveLine(char *buf, size_t len, FILE *fp) {
  * @warning Possible stack overflow with very long expressions
  */
 [[gnu::nonnull]] elem_t evalExprComplex(char const *expr) {
+  return evalComplex(expr, nullptr, nullptr);
+}
+
+[[gnu::always_inline]] static inline elem_t evalComplexLoop(
+  char const *expr, complex const *arg, rtinfo_t const *caller, bool const prof
+) {
   elem_t operand_stack[buf_size] = {0};
   elem_t *rsp = operand_stack, *rbp = operand_stack;
-  rtinfo_t info_c = getRuntimeInfo();
+  rtinfo_t info_c = caller ? *caller : getRuntimeInfo();
+  if (prof && arg != nullptr) {
+    profCall(expr);
+    profEnter(expr);
+  }
 
   for (;; expr++) {
     if (*expr == '[') {
+      if (prof) { // the elements count themselves
+        _ = profCount(PROF_COMPLEX, '[');
+      }
       (++rsp)->rtype = RTYPE_MATR;
       expr++;
       matrix_t val = {.matrix = zalloc(complex, mat_init_size)};
@@ -166,6 +295,9 @@ bool readerInteractiveLine(char *buf, size_t len, FILE *fp) {
     if (isspace(*expr)) continue;
     if (*expr == '\0') break;
 
+    char const op = *expr; // multi-char tokens count by their first
+    bool const timed = prof && profCount(PROF_COMPLEX, op);
+    uint64_t const begin = timed ? __builtin_readcyclecounter() : 0;
     switch (*expr) {
     case '0' ... '9':
       (++rsp)->rtype = RTYPE_COMP;
@@ -278,13 +410,17 @@ bool readerInteractiveLine(char *buf, size_t len, FILE *fp) {
       break;
 
     case '\\': // special variables and CONSTANTS
-      (++rsp)->elem.comp = getConst(*++expr);
+      (++rsp)->rtype = RTYPE_COMP;
+      rsp->elem.comp = getConst(*++expr);
       break;
 
     case '$': // register
       if (islower(*++expr)) [[clang::likely]] {
         elem_t *rhs = &info_c.reg[*expr - 'a'];
         elemSet(++rsp, rhs);
+      } else if (*expr == '1' && arg != nullptr) {
+        (++rsp)->rtype = RTYPE_COMP;
+        rsp->elem.comp = *arg;
       }
       break;
 
@@ -292,9 +428,44 @@ bool readerInteractiveLine(char *buf, size_t len, FILE *fp) {
       elemSet(&info_c.reg[*++expr - 'a'], rsp);
       break;
 
-      // TODO differential
-      // TODO integral
-      // TODO sigma
+    case '{': { // lambda, only for S
+      lambda_t const *l = lmdLiteral(++expr);
+      (++rsp)->rtype = RTYPE_LAMB;
+      rsp->elem.lamb = l->body;
+      expr += l->len - (expr[l->len] != '}'); // at '}', or before the end
+    } break;
+
+    case 'S': { // a b <lambda> S is the sum of the lambda at a, ..., b
+      if (rsp - 2 <= rbp || rsp->rtype != RTYPE_LAMB) [[clang::unlikely]] {
+        dispErr(__FUNCTION__, "%s", codetomsg(ERR_TYPE_MISMATCH));
+        break;
+      }
+      char const *body = (rsp--)->elem.lamb;
+      double b = creal((rsp--)->elem.comp);
+      rsp->elem.comp = sigma(body, creal(rsp->elem.comp), b, &info_c);
+    } break;
+
+    case 'I': { // a b <lambda> I is the integral of the lambda from a to b
+      if (rsp - 2 <= rbp || rsp->rtype != RTYPE_LAMB) [[clang::unlikely]] {
+        dispErr(__FUNCTION__, "%s", codetomsg(ERR_TYPE_MISMATCH));
+        break;
+      }
+      sampler_t f = {.body = (rsp--)->elem.lamb, .info = &info_c};
+      double b = creal((rsp--)->elem.comp), v[2];
+      quadIntegrate(sample, &f, 2, creal(rsp->elem.comp), b, v, false);
+      rsp->elem.comp = v[0] + I * v[1];
+    } break;
+
+    case 'D': { // x <lambda> D is the derivative of the lambda at x
+      if (rsp - 1 <= rbp || rsp->rtype != RTYPE_LAMB) [[clang::unlikely]] {
+        dispErr(__FUNCTION__, "%s", codetomsg(ERR_TYPE_MISMATCH));
+        break;
+      }
+      sampler_t f = {.body = (rsp--)->elem.lamb, .info = &info_c};
+      double v[2];
+      diffRichardson(sample, &f, 2, creal(rsp->elem.comp), v);
+      rsp->elem.comp = v[0] + I * v[1];
+    } break;
 
     case ';': // comment
     case ',': // delimiter
@@ -302,9 +473,13 @@ bool readerInteractiveLine(char *buf, size_t len, FILE *fp) {
     default:
       dispErr(__FUNCTION__, "unknown char: %c", *expr);
     }
+    if (timed)
+      profSample(PROF_COMPLEX, op, __builtin_readcyclecounter() - begin);
   }
 
 end:
+  if (prof && arg != nullptr) profLeave();
+  if (arg != nullptr) return *rsp;
   if (rsp->rtype == RTYPE_MATR) {
     elem_t *rhs = &info_c.hist[++info_c.histi];
     if (rhs->rtype == RTYPE_MATR) nfree(rhs->elem.matr.matrix);
@@ -315,6 +490,20 @@ end:
   return *rsp;
 }
 
+/**
+ * @brief evalExprComplex, or a lambda body called with $1 = *arg, which
+ *        leaves the history alone, on its own copy of the loop while
+ *        profiling
+ * @param[in] arg nullptr unless expr is a lambda body
+ * @param[in] caller Runtime info of the caller of the lambda, if any
+ */
+static elem_t
+evalComplex(char const *expr, complex const *arg, rtinfo_t const *caller) {
+  if (profOn()) [[clang::unlikely]]
+    return evalComplexLoop(expr, arg, caller, true);
+  return evalComplexLoop(expr, arg, caller, false);
+}
+
 #define eval_expr_complex_return_complex(expr) evalExprComplex(expr).elem.comp
 test_table(
   eval_complex, eval_expr_complex_return_complex, (complex, char const *),
@@ -331,8 +520,39 @@ test_table(
     {1.1447298858494002 + 1.5707963267948967i,  "\\Pil"},
 }
 )
+test_table(
+  eval_complex_sigma, eval_expr_complex_return_complex, (complex, char const *),
+  {
+    {55.0,     "1 10 {$1} S"},
+    {6.0i, "0 3 {$1 1i *} S"},
+    {30.0,  "1 4 {$1 2 ^} S"},
+    { 0.0,      "1 0 {1} S"}, // empty
+}
+)
+test_table(
+  eval_complex_integral, eval_expr_complex_return_complex,
+  (complex, char const *),
+  {
+    {                              0.5 + 1.0i,               "0 1 {$1 1i +} I"},
+    {0.8414709848078965 + 0.4596976941318602i,       "0 1 {\\E ($1 1i *) ^} I"},
+    {                                     2.0,                "0 \\P {$1 s} I"},
+    {                      1.7724538509055159, "\\Im \\I {\\E ($1 2 ^ m) ^} I"},
+}
+)
+test_table(
+  eval_complex_diff, eval_expr_complex_return_complex, (complex, char const *),
+  {
+    {      12.0,             "2 {$1 3 ^} D"},
+    {3.0 + 1.0i, "1 {$1 3 ^ ($1 1i *) +} D"},
+    {      -1.0,           "\\P {$1 s} D"},
+}
+)
 #undef eval_expr_complex_return_complex
 
+test (eval_complex_sigma_cap) { // past 2^53, k++ would not move k
+  expect(isnan(creal(evalExprComplex("0 1e300 {1} S").elem.comp)));
+}
+
 test (eval_expr_complex) {
   matrix_t resultm;
 
@@ -399,6 +619,19 @@ bench (eval_matrix) {
   evalExprComplex("[2 5,4,3,2,][2 4,8,2,1,]/");
 }
 
+//! @brief Run the batch corpus as a script file, the results to /dev/null
+bench_rate(workload_batch, "lines") {
+  static int devnull = -1;
+  if (devnull == -1) devnull = open("/dev/null", O_WRONLY);
+  benchcorpus_t const *c = benchCorpus("batch.rpx");
+  FILE *fp dropfile = fopen(c->path, "r");
+  if (fp == nullptr) [[clang::unlikely]] return 0;
+  int out = setWriterFd(devnull);
+  readerLoop(fp);
+  setWriterFd(out);
+  return (double)c->n;
+}
+
 /**
  * @brief Output elem_t in appropriate format
  * @param[in] elem Output comtent
@@ -417,7 +650,9 @@ void printElem(elem_t elem) {
     break;
   case RTYPE_LAMB:
     printLambda(elem.elem.lamb);
-    free(elem.elem.lamb);
+    break;
+  case RTYPE_VECT:
+    printVector(elem.elem.vect);
     break;
   default:
     [[clang::unlikely]];
@@ -439,6 +674,15 @@ overloadable bool eq(elem_t lhs, elem_t rhs) {
     return eq(&lhs.elem.matr, &rhs.elem.matr);
   case RTYPE_LAMB:
     return eq(lhs.elem.lamb, rhs.elem.lamb);
+  case RTYPE_VECT:
+    if (lhs.elem.vect->len != rhs.elem.vect->len) return false;
+    for (size_t i = 0; i < lhs.elem.vect->len; i++) {
+      double x, y;
+      vecRead(lhs.elem.vect, i, 1, &x);
+      vecRead(rhs.elem.vect, i, 1, &y);
+      if (!eq(x, y)) return false;
+    }
+    return true;
   default:
     return false;
   }
@@ -449,15 +693,21 @@ overloadable bool eq(elem_t lhs, elem_t rhs) {
  * @param[in] result Output value
  */
 void printReal(double result) {
-  if (isInt(result)) PRINT("result: ", (long)result, "\n");
-  else PRINT("result: ", result, "\n");
+  writeStr("result: ");
+  if (isInt(result)) writeInt((long)result);
+  else writeReal(result);
+  writeChar('\n');
 }
 
 /**
  * @brief Output value of type complex
  */
 void printComplexComplex(complex result) {
-  PRINT("result: ", creal(result), " + ", cimag(result), "i\n");
+  writeStr("result: ");
+  writeReal(creal(result));
+  writeStr(" + ");
+  writeReal(cimag(result));
+  writeStr("i\n");
 }
 
 /**
@@ -467,9 +717,11 @@ void printComplexPolar(complex result) {
   complex res = result;
   if (isnan(creal(res)) || isnan(cimag(res))) return;
 
-  PRINT(
-    "result: ", cabs(res), " \\phasor ", atan2(cimag(res), creal(res)), "\n"
-  );
+  writeStr("result: ");
+  writeReal(cabs(res));
+  writeStr(" \\phasor ");
+  writeReal(atan2(cimag(res), creal(res)));
+  writeChar('\n');
 }
 
 /**
@@ -479,17 +731,44 @@ void printMatrix(matrix_t result) {
   for (size_t i = 0; i < result.rows; i++) {
     for (size_t j = 0; j < result.cols; j++) {
       complex res = result.matrix[result.cols * i + j];
-      putchar('\t');
-      if (cimag(res) == 0) PRINT(creal(res));
-      else PRINT(creal(res), " + ", cimag(res), "i");
+      writeChar('\t');
+      writeReal(creal(res));
+      if (cimag(res) == 0) continue;
+      writeStr(" + ");
+      writeReal(cimag(res));
+      writeChar('i');
     }
 
-    putchar('\n');
+    writeChar('\n');
   }
 }
 
 [[gnu::nonnull]] void printLambda(char const *result) {
-  PRINT("result: ", result, "\n");
+  writeStr("result: ");
+  writeStr(result);
+  writeChar('\n');
+}
+
+/**
+ * @brief Output a vector, eliding the middle of long ones
+ */
+[[gnu::nonnull]] void printVector(vec_t const *result) {
+  constexpr size_t shown = 3; // at each end
+  writeStr("result: [");
+  for (size_t i = 0; i < result->len; i++) {
+    if (shown <= i && i + shown < result->len && 2 * shown + 2 < result->len) {
+      writeStr(" ...");
+      i = result->len - shown - 1;
+      continue;
+    }
+    double x;
+    vecRead(result, i, 1, &x); // lazy ones are computed only here
+    if (i != 0) writeChar(' ');
+    writeReal(x);
+  }
+  writeStr("] (");
+  writeInt((long)result->len);
+  writeStr(")\n");
 }
 
 /**
@@ -498,6 +777,7 @@ void printMatrix(matrix_t result) {
  */
 [[gnu::nonnull]] void procCmds(char const *restrict cmd) {
   plotcfg_t pcfg = getPlotCfg();
+  flushWriter(); // commands print through stdio
 
   // TODO save registers
   switch (*cmd++) {
@@ -519,10 +799,77 @@ void printMatrix(matrix_t result) {
       [[clang::unlikely]];
     }
     break;
+  case 'm': { // memoized lambdas
+    memostat_t stat = memoStat();
+    printf(
+      "hits: %" PRIu64 ", misses: %" PRIu64 ", evictions: %" PRIu64
+      ", entries: %zu\n",
+      stat.hits,
+      stat.misses,
+      stat.evictions,
+      stat.len
+    );
+  } break;
+  case 'i': { // last integral
+    quadstat_t stat = quadStat();
+    printf(
+      "tolerance: %g, error: %g, evaluations: %zu, panels: %zu\n",
+      stat.tol,
+      stat.err,
+      stat.evals,
+      stat.panels
+    );
+  } break;
+  case 'd': { // last ODE integration
+    odestat_t stat = odeStat();
+    printf(
+      "method: %s, steps: %zu, rejected: %zu, evaluations: %zu\n",
+      stat.rk4 ? "rk4" : "dopri5",
+      stat.steps,
+      stat.rejected,
+      stat.evals
+    );
+  } break;
+  case 'z': { // last root or minimum
+    solvestat_t stat = solveStat();
+    printf(
+      "method: %s, iterations: %zu, evaluations: %zu%s\n",
+      stat.method ? stat.method : "none",
+      stat.iters,
+      stat.evals,
+      stat.converged ? "" : " (not converged)"
+    );
+  } break;
+  case 'P':   // profiler
+    switch (*cmd) {
+    case '\0': // toggle
+    case '\n': // from a file
+      puts(profToggle() ? "profiler: on" : "profiler: off");
+      break;
+    case 'r':  // report
+      profReport();
+      break;
+    case 'f': { // folded stacks for flamegraphs
+      char path[buf_size];
+      cmd++;
+      skipSpaces((char const **)&cmd);
+      snprintf(path, sizeof path, "%.*s", (int)strcspn(cmd, "\n"), cmd);
+      if (*path != '\0' && profFolded(path))
+        printf("profiler: wrote %s\n", path);
+    } break;
+    case 'z':  // clear
+      profClear();
+      break;
+    default:
+      [[clang::unlikely]];
+    }
+    break;
   case 'o': {
     char buf[buf_size];
-    strncpy(buf, cmd, buf_size);
-    optexpr(buf);
+    strncpy(buf, cmd, buf_size - 1);
+    buf[buf_size - 1] = '\0';
+    if (eval_f == evalExprReal) optexpr(buf);
+    else optexprSpaces(buf);
     puts(buf);
   } break;
   case 'p':
@@ -549,6 +896,30 @@ void printMatrix(matrix_t result) {
     case 'p': // plot
       changePlotCfg(cmd + 1);
       break;
+    case 'i': // integral tolerance
+      quadSetTol(evalExprReal(cmd + 1).elem.real);
+      break;
+    case 'o': // ODE integrator and output
+      switch (*++cmd) {
+      case 'a': // adaptive with tolerance
+        odeSetTol(evalExprReal(cmd + 1).elem.real);
+        break;
+      case 'r': // RK4 with steps
+        odeSetRk4((size_t)evalExprReal(cmd + 1).elem.real);
+        break;
+      case 'n': // no trajectory
+        odeSetOut(ODE_OUT_NONE);
+        break;
+      case 'p': // plot trajectory
+        odeSetOut(ODE_OUT_PLOT);
+        break;
+      case 'b': // binary trajectory
+        odeSetOut(ODE_OUT_BINARY);
+        break;
+      default:
+        [[clang::unlikely]];
+      }
+      break;
     default:
       [[clang::unlikely]];
     }
@@ -215,3 +215,59 @@ matrix_t inverseMatrix(matrix_t const *restrict a) {
 void smul(matrix_t *restrict lhs, complex rhs) {
   for (size_t i = 0; i < lhs->rows * lhs->cols; i++) lhs->matrix[i] *= rhs;
 }
+
+//! @brief Diagonally dominant dim x dim matrix, so that it has an inverse
+static matrix_t sampleMatrix(size_t dim) {
+  matrix_t m = newMatrix(dim, dim);
+  for (size_t i = 0; i < dim * dim; i++)
+    m.matrix[i] = (double)(i % 7) - 3 + (i % (dim + 1) ? 0 : 4.0 * (double)dim);
+  return m;
+}
+
+//! @return Flops, 8 per complex multiply-add
+static double mulWorkload(size_t dim) {
+  matrix_t a dropmatr = sampleMatrix(dim), b dropmatr = sampleMatrix(dim);
+  _ dropmatr = mMul(&a, &b);
+  return 8.0 * (double)(dim * dim * dim);
+}
+
+//! @return Flops, 2 per complex addition
+static double addWorkload(size_t dim) {
+  matrix_t a dropmatr = sampleMatrix(dim), b dropmatr = sampleMatrix(dim);
+  _ dropmatr = mAdd(&a, &b);
+  return 2.0 * (double)(dim * dim);
+}
+
+//! @return Flops of the elimination on both sides, 8 per multiply-add
+static double inverseWorkload(size_t dim) {
+  matrix_t a dropmatr = sampleMatrix(dim);
+  _ dropmatr = inverseMatrix(&a);
+  return 16.0 * (double)(dim * dim * (dim - 1));
+}
+
+// a product of two 1024 x 1024 matrices takes seconds, too long for the
+// samples of a benchmark, so the cubic ones stop at 256
+#define CUBIC_WORKLOADS(dim) \
+  bench_rate(workload_matmul_##dim, "flops") { \
+    return mulWorkload(dim); \
+  } \
+  bench_rate(workload_inverse_##dim, "flops") { \
+    return inverseWorkload(dim); \
+  }
+CUBIC_WORKLOADS(2)
+CUBIC_WORKLOADS(8)
+CUBIC_WORKLOADS(32)
+CUBIC_WORKLOADS(128)
+CUBIC_WORKLOADS(256)
+
+bench_rate(workload_matadd_2, "flops") {
+  return addWorkload(2);
+}
+
+bench_rate(workload_matadd_32, "flops") {
+  return addWorkload(32);
+}
+
+bench_rate(workload_matadd_1024, "flops") {
+  return addWorkload(1024);
+}
@@ -0,0 +1,228 @@
+/**
+ * @file src/ode.c
+ * @brief Define the Dormand-Prince 5(4) and RK4 integrators
+ */
+
+#include "ode.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "testing.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+constexpr size_t dp_stages = 7;
+
+static _Atomic double ode_tol = 1e-8;
+static _Atomic size_t ode_rk4; // steps of RK4, 0 for Dormand-Prince
+static _Atomic odeout_t ode_out = ODE_OUT_NONE;
+static thread_local odestat_t ode_stat;
+
+static double const dp_c[dp_stages] = {0, 0.2, 0.3, 0.8, 8.0 / 9, 1, 1};
+static double const dp_a[dp_stages][dp_stages - 1] = {
+  {},
+  {1.0 / 5},
+  {3.0 / 40, 9.0 / 40},
+  {44.0 / 45, -56.0 / 15, 32.0 / 9},
+  {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729},
+  {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656},
+  {35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84},
+};
+// weights of the 5th order solution minus those of the embedded 4th
+static double const dp_e[dp_stages] = {
+  71.0 / 57600,      0,          -71.0 / 16695, 71.0 / 1920,
+  -17253.0 / 339200, 22.0 / 525, -1.0 / 40,
+};
+
+typedef struct {
+  odefn_t f;
+  void *ctx;
+  size_t dim;
+  odesink_t sink; // nullptr to drop the trajectory
+  void *sinkctx;
+} ode_t;
+
+static void eval(ode_t const *o, double t, double const *y, double *dy) {
+  o->f(o->ctx, t, y, o->dim, dy);
+  ode_stat.evals++;
+}
+
+static void emit(ode_t const *o, double t, double const *y) {
+  if (o->sink != nullptr) o->sink(o->sinkctx, t, y, o->dim);
+}
+
+//! @brief out = y + h * k
+static void
+step(size_t dim, double *out, double const *y, double h, double const *k) {
+  for (size_t d = 0; d < dim; d++) out[d] = y[d] + h * k[d];
+}
+
+static void rk4(ode_t const *o, double t0, double t1, double *y, size_t n) {
+  double k[4][ode_max_dim], tmp[ode_max_dim], h = (t1 - t0) / (double)n;
+  for (size_t i = 0; i < n; i++) {
+    double t = t0 + h * (double)i; // no drift over many steps
+    eval(o, t, y, k[0]);
+    step(o->dim, tmp, y, h / 2, k[0]);
+    eval(o, t + h / 2, tmp, k[1]);
+    step(o->dim, tmp, y, h / 2, k[1]);
+    eval(o, t + h / 2, tmp, k[2]);
+    step(o->dim, tmp, y, h, k[2]);
+    eval(o, t + h, tmp, k[3]);
+    for (size_t d = 0; d < o->dim; d++)
+      y[d] += h / 6 * (k[0][d] + 2 * (k[1][d] + k[2][d]) + k[3][d]);
+    ode_stat.steps++;
+    emit(o, i + 1 == n ? t1 : t + h, y);
+  }
+}
+
+//! @brief RMS of xs, each scaled by tol * (1 + |y|)
+static double
+errNorm(size_t dim, double const *xs, double const *y, double tol) {
+  double sum = 0;
+  for (size_t d = 0; d < dim; d++) {
+    double r = xs[d] / (tol * (1 + fabs(y[d])));
+    sum += r * r;
+  }
+  return sqrt(sum / (double)dim);
+}
+
+static void dopri(ode_t const *o, double t0, double t1, double *y) {
+  double k[dp_stages][ode_max_dim], yn[ode_max_dim], err[ode_max_dim];
+  double tol = atomic_load(&ode_tol), t = t0;
+  eval(o, t, y, k[0]);
+  double d0 = errNorm(o->dim, y, y, tol), d1 = errNorm(o->dim, k[0], y, tol);
+  double h = d0 < 1e-5 || d1 < 1e-5 ? 1e-6 : d0 / d1 / 100;
+  h = copysign(lesser(h, fabs(t1 - t0)), t1 - t0);
+  for (bool last = false; !last;) {
+    if (ode_stat.steps + ode_stat.rejected == ode_max_steps || t + h == t)
+      [[clang::unlikely]] {
+        for (size_t d = 0; d < o->dim; d++) y[d] = NAN;
+        return;
+      }
+    if (0 < (t + h - t1) * (t1 - t0)) h = t1 - t;
+    for (size_t i = 1; i < dp_stages; i++) {
+      memcpy(yn, y, o->dim * sizeof(double));
+      for (size_t j = 0; j < i; j++)
+        step(o->dim, yn, yn, h * dp_a[i][j], k[j]);
+      eval(o, t + dp_c[i] * h, yn, k[i]);
+    }
+    memset(err, 0, sizeof err);
+    for (size_t j = 0; j < dp_stages; j++)
+      step(o->dim, err, err, h * dp_e[j], k[j]);
+    double e = errNorm(o->dim, err, y, tol);
+    if (isnan(e)) [[clang::unlikely]] {
+      for (size_t d = 0; d < o->dim; d++) y[d] = NAN;
+      return;
+    }
+    double fac = e == 0 ? 5 : bigger(0.2, lesser(5.0, 0.9 * pow(e, -0.2)));
+    if (1 < e) {
+      ode_stat.rejected++;
+      h *= lesser(fac, 1.0);
+      continue;
+    }
+    last = h == t1 - t;
+    t = last ? t1 : t + h;
+    memcpy(y, yn, o->dim * sizeof(double));
+    memcpy(k[0], k[dp_stages - 1], sizeof k[0]); // first same as last
+    ode_stat.steps++;
+    emit(o, t, y);
+    h *= fac;
+  }
+}
+
+/**
+ * @brief Integrate y' = f(t, y) from t0 to t1, either way
+ * @param[in] dim Components of y, at most ode_max_dim
+ * @param[in,out] y Values at t0 in, at t1 out, NaN if the step vanished
+ * @param[in] sink Called with every accepted point, nullptr for none
+ */
+void odeSolve(
+  odefn_t f, void *ctx, size_t dim, double t0, double t1, double *y,
+  odesink_t sink, void *sinkctx
+) {
+  size_t n = atomic_load(&ode_rk4);
+  ode_stat = (odestat_t){.rk4 = 0 < n};
+  ode_t o = {f, ctx, lesser(dim, ode_max_dim), sink, sinkctx};
+  emit(&o, t0, y);
+  if (t0 == t1) return;
+  if (!isfinite(t0) || !isfinite(t1)) [[clang::unlikely]] {
+    for (size_t d = 0; d < o.dim; d++) y[d] = NAN;
+    return;
+  }
+  if (n != 0) rk4(&o, t0, t1, y, n);
+  else dopri(&o, t0, t1, y);
+}
+
+odestat_t odeStat(void) {
+  return ode_stat;
+}
+
+//! @brief Switch to Dormand-Prince with the relative tolerance tol
+void odeSetTol(double tol) {
+  if (0 < tol) atomic_store(&ode_tol, tol);
+  atomic_store(&ode_rk4, 0);
+}
+
+//! @brief Switch to RK4 with n equal steps
+void odeSetRk4(size_t n) {
+  if (0 < n) atomic_store(&ode_rk4, lesser(n, ode_max_steps));
+}
+
+void odeSetOut(odeout_t out) {
+  atomic_store(&ode_out, out);
+}
+
+odeout_t odeOut(void) {
+  return atomic_load(&ode_out);
+}
+
+static void
+growth(void *ctx, double t, double const *y, size_t dim, double *dy) {
+  _ = ctx;
+  _ = dim;
+  dy[0] = t * y[0];
+}
+
+static void
+oscillator(void *ctx, double t, double const *y, size_t dim, double *dy) {
+  _ = ctx;
+  _ = t;
+  _ = dim;
+  dy[0] = y[1];
+  dy[1] = -y[0];
+}
+
+static void countPoint(void *ctx, double t, double const *y, size_t dim) {
+  _ = t;
+  _ = y;
+  _ = dim;
+  ++*(size_t *)ctx;
+}
+
+test (ode) {
+  double const pi = 3.14159265358979323846;
+  double y[2] = {1};
+  size_t points = 0;
+  odeSolve(growth, nullptr, 1, 0, 2, y, countPoint, &points);
+  expecteq(exp(2), y[0]);
+  expecteq(odeStat().steps + 1, points);
+  odeSolve(growth, nullptr, 1, 2, 0, y, nullptr, nullptr); // backward
+  expecteq(1.0, y[0]);
+  y[0] = 1;
+  odeSolve(oscillator, nullptr, 2, 0, pi, y, nullptr, nullptr);
+  expecteq(-1.0, y[0]);
+  expecteq(true, fabs(y[1]) < 1e-7);
+  odeSetRk4(100);
+  y[0] = 1;
+  y[1] = 0;
+  odeSolve(oscillator, nullptr, 2, 0, pi, y, nullptr, nullptr);
+  expecteq(-1.0, y[0]);
+  expecteq(true, odeStat().rk4);
+  expecteq(400, odeStat().evals);
+  odeSetTol(0);
+}
+
+bench (ode_dopri) {
+  double y[2] = {1, 0};
+  odeSolve(oscillator, nullptr, 2, 0, 100, y, nullptr, nullptr);
+}
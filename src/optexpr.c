@@ -1,13 +1,61 @@
 /**
  * @file src/optexpr.c
+ * @brief Define optimizer for real number mode expressions
+ *
+ * The expression is run on an abstract operand stack whose slots remember
+ * where their code starts in the output. Constant slots are folded into
+ * literals, adjacent unary ops are cancelled, groups that do not need their
+ * own frame are unwrapped, and a slot repeating the one below becomes @p.
+ * Anything the model does not understand leaves the expression with only
+ * its spaces removed. Cancelling r d drops the rounding of the two
+ * multiplications, so the result can differ from the original in the last
+ * bit.
  */
 
 #include "optexpr.h"
 #include "chore.h"
+#include "evalfn.h"
+#include "lambda.h"
+#include "mathdef.h"
 #include "testing.h"
+#include "writer.h"
 #include <ctype.h>
 #include <string.h>
 
+constexpr size_t opt_cap = buf_size * 4; // literals may outgrow the source
+constexpr size_t no_uop = ~(size_t)0;
+
+//! @brief Value on the abstract operand stack
+typedef struct {
+  size_t off;    // start of the code producing the value
+  int argc;      // parameters of a lambda literal, -1 if unknown
+  bool isconst;  // depends on nothing but literals and constants
+  bool ispure;   // no side effect
+  bool isflat;   // same value wherever in the frame it is evaluated
+  bool ismany;   // stands for an unknown number of values
+  bool afternum; // the code before off ends with a number
+} slot_t;
+
+typedef struct {
+  size_t base;  // first slot of the frame
+  size_t paren; // offset of '('
+  bool afternum;
+} frame_t;
+
+typedef struct {
+  char out[opt_cap];
+  size_t len;
+  slot_t slots[buf_size];
+  size_t sp;
+  frame_t frames[buf_size];
+  size_t fp;
+  size_t uop; // offset of the trailing one-char unary op
+  bool uopafternum;
+  bool lastnum;
+  bool hoist; // register loads are constants
+  bool fail;
+} optctx_t;
+
 static void rmExprSpaces(char **expr) {
   char const *start = *expr;
   for (; **expr != '\0'; (*expr)++) {
@@ -21,16 +69,529 @@ static void rmExprSpaces(char **expr) {
   }
 }
 
-void optexpr(char *arg_expr) {
-  char *expr = arg_expr;
+static bool isOneOf(char c, char const *set) {
+  return c != '\0' && strchr(set, c) != nullptr;
+}
+
+/**
+ * @brief Append code to the output
+ * @param[in] isnum Code is a numeric literal (needs a space after a number)
+ */
+static void emit(optctx_t *ctx, char const *code, size_t n, bool isnum) {
+  if (n == 0) return;
+  bool sep = isnum && ctx->lastnum;
+  if (opt_cap <= ctx->len + n + sep) [[clang::unlikely]] {
+    ctx->fail = true;
+    return;
+  }
+  if (sep) ctx->out[ctx->len++] = ' ';
+  memcpy(ctx->out + ctx->len, code, n);
+  ctx->len += n;
+  ctx->lastnum = isnum || isdigit(code[n - 1]);
+}
+
+static void cut(optctx_t *ctx, size_t off, bool afternum) {
+  ctx->len = off;
+  ctx->lastnum = afternum;
+  ctx->uop = no_uop;
+}
+
+static size_t frameBase(optctx_t const *ctx) {
+  return ctx->fp ? ctx->frames[ctx->fp - 1].base : 0;
+}
+
+//! @brief Code of slot i without the separating space
+static char const *slotCode(optctx_t const *ctx, size_t i, size_t *n) {
+  size_t end = i + 1 < ctx->sp ? ctx->slots[i + 1].off : ctx->len;
+  size_t off = ctx->slots[i].off;
+  if (off < end && ctx->out[off] == ' ') off++;
+  *n = end - off;
+  return ctx->out + off;
+}
+
+static slot_t *top(optctx_t *ctx) {
+  if (ctx->sp == frameBase(ctx)) {
+    ctx->fail = true;
+    return nullptr;
+  }
+  return ctx->slots + ctx->sp - 1;
+}
+
+/**
+ * @brief Replace the top slot with @p if it repeats the one below
+ * @note Called once the top slot is complete
+ */
+static void cseTop(optctx_t *ctx) {
+  if (ctx->sp < frameBase(ctx) + 2) return;
+  slot_t *hi = ctx->slots + ctx->sp - 1, *lo = hi - 1;
+  if (hi->isconst || !hi->ispure || !lo->ispure || !hi->isflat || !lo->isflat)
+    return;
+  size_t nlo, nhi;
+  char const *clo = slotCode(ctx, ctx->sp - 2, &nlo);
+  char const *chi = slotCode(ctx, ctx->sp - 1, &nhi);
+  if (nhi <= 2 || nlo != nhi || memcmp(clo, chi, nhi)) return;
+  cut(ctx, hi->off, hi->afternum);
+  emit(ctx, "@p", 2, false);
+  hi->isflat = false;
+}
+
+static void pushSlot(optctx_t *ctx, bool isconst, bool ispure) {
+  cseTop(ctx);
+  if (ctx->sp == buf_size) [[clang::unlikely]] {
+    ctx->fail = true;
+    return;
+  }
+  ctx->slots[ctx->sp++] = (slot_t){
+    .off = ctx->len,
+    .argc = -1,
+    .isconst = isconst,
+    .ispure = ispure,
+    .isflat = true,
+    .ismany = false,
+    .afternum = ctx->lastnum,
+  };
+}
+
+/**
+ * @brief Merge the top k slots of the frame into the slot of their result
+ * @return Result, or nullptr if the frame is too shallow
+ */
+static slot_t *take(optctx_t *ctx, size_t k) {
+  size_t base = frameBase(ctx);
+  bool isshort = ctx->sp - base < k;
+  bool ismany = false;
+  for (size_t i = ctx->sp - lesser(k, ctx->sp - base); i < ctx->sp; i++)
+    ismany = ismany || ctx->slots[i].ismany;
+  if (isshort) k = ctx->sp - base;
+  if (k == 0 || (isshort && !ismany)) {
+    ctx->fail = true;
+    return nullptr;
+  }
+
+  cseTop(ctx);
+  slot_t *r = ctx->slots + ctx->sp - k;
+  for (slot_t const *s = r + 1; s < ctx->slots + ctx->sp; s++) {
+    r->isconst = r->isconst && s->isconst;
+    r->ispure = r->ispure && s->ispure;
+    r->isflat = r->isflat && s->isflat;
+  }
+  r->ismany = ismany;
+  r->argc = -1;
+  ctx->sp -= k - 1;
+  return r;
+}
+
+//! @brief Merge the whole frame into a slot standing for unknown values
+static void collapse(optctx_t *ctx) {
+  slot_t *r = take(ctx, ctx->sp - frameBase(ctx));
+  if (r == nullptr) return;
+  r->isconst = r->isflat = false;
+  r->ismany = true;
+}
+
+/**
+ * @brief Replace the code of a constant slot by its value
+ * @note Non-finite values have no literal and are left as they are
+ */
+static void fold(optctx_t *ctx, slot_t *s) {
+  if (ctx->fail || !s->isconst) return;
+  char expr[opt_cap];
+  size_t n = ctx->len - s->off;
+  memcpy(expr, ctx->out + s->off, n);
+  expr[n] = '\0';
+
+  machine_t ei;
+  initEvalinfo(&ei);
+  real_t args[arg_n] = {};
+  real_t res = evalWithArgs(&ei, expr, args);
+  double x = res.elem.real;
+  if (!res.isnum || !isfinite(x)) return;
+
+  char lit[fmt_size];
+  size_t len = fmtReal(fabs(x), lit);
+  cut(ctx, s->off, s->afternum);
+  emit(ctx, lit, len, true);
+  if (signbit(x)) emit(ctx, "m", 1, false);
+  s->isflat = true;
+}
+
+// adjacent unary ops and what they reduce to
+static char const *const peephole[][2] = {
+  {"mm",  ""},
+  {"rd",  ""},
+  {"dr",  ""},
+  {"mA", "A"},
+  {"AA", "A"},
+  {"CC", "C"},
+  {"FF", "F"},
+  {"RR", "R"},
+};
+
+static void optUnary(optctx_t *ctx, char const *op, size_t n) {
+  slot_t *s = top(ctx);
+  if (s == nullptr) return;
+  s->argc = -1;
+
+  if (n == 1 && ctx->uop != no_uop && ctx->uop + 1 == ctx->len
+      && s->off <= ctx->uop) {
+    char pair[] = {ctx->out[ctx->uop], *op, '\0'};
+    for (size_t i = 0; i < sizeof peephole / sizeof *peephole; i++) {
+      if (strcmp(pair, peephole[i][0])) continue;
+      size_t at = ctx->uop;
+      cut(ctx, at, ctx->uopafternum);
+      emit(ctx, peephole[i][1], strlen(peephole[i][1]), false);
+      if (ctx->len != at) ctx->uop = at;
+      return;
+    }
+  }
+
+  size_t at = ctx->len;
+  ctx->uopafternum = ctx->lastnum;
+  emit(ctx, op, n, false);
+  ctx->uop = n == 1 ? at : no_uop;
+  fold(ctx, s);
+}
+
+static void optFixed(optctx_t *ctx, char const *op, size_t n, size_t arity) {
+  slot_t *r = take(ctx, arity);
+  if (r == nullptr) return;
+  emit(ctx, op, n, false);
+  fold(ctx, r);
+}
+
+//! @brief Operators that consume the whole frame
+static void optVariadic(optctx_t *ctx, char const *op) {
+  size_t n = ctx->sp - frameBase(ctx);
+  slot_t *r = take(ctx, n);
+  if (r == nullptr) return;
+  r->isflat = r->ismany = false;
+  emit(ctx, op, 1, false);
+  fold(ctx, r);
+}
+
+static char const *optNumber(optctx_t *ctx, char const *p) {
+  char *end = nullptr;
+  _ = strtod(p, &end);
+  pushSlot(ctx, true, true);
+  emit(ctx, p, (size_t)(end - p), true);
+  return end - 1;
+}
+
+static void optLoad(optctx_t *ctx, char const *p) {
+  if ('1' <= p[1] && p[1] <= '0' + (int)arg_n) pushSlot(ctx, false, true);
+  else if (islower(p[1]))
+    pushSlot(
+      ctx, ctx->hoist && getRRuntimeInfo().reg[p[1] - 'a'].isnum, true
+    );
+  else ctx->fail = true;
+  emit(ctx, p, 2, false);
+}
+
+static void optSysFn(optctx_t *ctx, char const *p) {
+  slot_t *s;
+  switch (p[1]) {
+  case 'a':
+    pushSlot(ctx, false, true);
+    break;
+  case 'n':
+    pushSlot(ctx, true, true);
+    break;
+  case 'r':
+    pushSlot(ctx, false, false);
+    break;
+  case 'h':
+    if ((s = top(ctx)) == nullptr) return;
+    s->isconst = false;
+    break;
+  case 'd':
+    if ((s = top(ctx)) == nullptr) return;
+    s->ispure = false;
+    break;
+  case 'p': {
+    if ((s = top(ctx)) == nullptr) return;
+    if (s->isconst && s->isflat) { // copy the code so that the result folds
+      size_t n;
+      char const *code = slotCode(ctx, ctx->sp - 1, &n);
+      pushSlot(ctx, true, true);
+      emit(ctx, code, n, isdigit(*code) != 0);
+      return;
+    }
+    pushSlot(ctx, false, true);
+    ctx->slots[ctx->sp - 1].isflat = false;
+  } break;
+  default: // @s depends on the real depth of the stack
+    ctx->fail = true;
+    return;
+  }
+  emit(ctx, p, 2, false);
+}
+
+static void optGrpBgn(optctx_t *ctx) {
+  cseTop(ctx);
+  if (ctx->fp == buf_size) [[clang::unlikely]] {
+    ctx->fail = true;
+    return;
+  }
+  ctx->frames[ctx->fp++] = (frame_t){
+    .base = ctx->sp, .paren = ctx->len, .afternum = ctx->lastnum
+  };
+  emit(ctx, "(", 1, false);
+}
+
+/**
+ * @brief Close a group, dropping the parens if the frame is not needed
+ * @note That is when the group leaves one value whose code either is flat
+ *       or already starts its enclosing frame
+ */
+static void optGrpEnd(optctx_t *ctx) {
+  if (ctx->fp == 0 || ctx->sp == frameBase(ctx)) {
+    ctx->fail = true;
+    return;
+  }
+  frame_t f = ctx->frames[ctx->fp - 1];
+  slot_t *s = ctx->slots + f.base;
+  size_t outer = ctx->fp < 2 ? 0 : ctx->frames[ctx->fp - 2].base;
+  bool isfirst = f.base == outer;
+
+  if (ctx->sp == f.base + 1 && !s->ismany && (s->isflat || isfirst)) {
+    ctx->fp--;
+    if (f.afternum && isdigit(ctx->out[f.paren + 1])) ctx->out[f.paren] = ' ';
+    else {
+      memmove(
+        ctx->out + f.paren, ctx->out + f.paren + 1, ctx->len - f.paren - 1
+      );
+      ctx->len--;
+    }
+    ctx->uop = no_uop;
+    s->off = f.paren;
+    s->afternum = f.afternum;
+    return;
+  }
+
+  slot_t *r = take(ctx, ctx->sp - f.base); // only the top survives
+  if (r == nullptr) return;
+  r->isconst = r->isconst && !r->ismany;
+  r->isflat = true;
+  r->ismany = false;
+  r->off = f.paren;
+  r->afternum = f.afternum;
+  ctx->fp--;
+  emit(ctx, ")", 1, false);
+  fold(ctx, r);
+}
+
+static void optimizeExpr(char *, bool);
+
+static char const *optLambda(optctx_t *ctx, char const *p) {
+  size_t n = 0;
+  for (int nest = 1; p[n + 1] != '\0'; n++)
+    if (p[n + 1] == '{') nest++;
+    else if (p[n + 1] == '}' && !--nest) break;
+  if (p[n + 1] != '}' || opt_cap <= n) {
+    ctx->fail = true;
+    return p;
+  }
+
+  char body[opt_cap];
+  memcpy(body, p + 1, n);
+  body[n] = '\0';
+  optimizeExpr(body, ctx->hoist);
+  pushSlot(ctx, false, true);
+  ctx->slots[ctx->sp - 1].argc // ',' and ';' may end the caller
+    = strpbrk(body, ",;") != nullptr ? -1 : (int)lmdArgc(body);
+  emit(ctx, "{", 1, false);
+  emit(ctx, body, strlen(body), false);
+  emit(ctx, "}", 1, false);
+  return p + n + 1;
+}
+
+static void optCall(optctx_t *ctx) {
+  slot_t *s = top(ctx);
+  if (s == nullptr) return;
+  if (s->argc < 0 || s->ismany) collapse(ctx); // unknown stack effect
+  else if ((s = take(ctx, (size_t)s->argc + 1)) != nullptr) s->ispure = false;
+  emit(ctx, "!", 1, false);
+}
+
+static void optimize(optctx_t *ctx, char const *p) {
+  for (; *p && !ctx->fail; p++) {
+    if (isspace(*p)) continue;
+    if (isdigit(*p)) {
+      p = optNumber(ctx, p);
+      continue;
+    }
+    switch (*p) {
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+    case '%':
+    case '^':
+    case '=':
+    case '<':
+    case '>':
+      optVariadic(ctx, p);
+      break;
+    case 's':
+    case 'c':
+    case 't':
+    case 'A':
+    case 'g':
+    case 'C':
+    case 'F':
+    case 'R':
+    case 'm':
+    case 'r':
+    case 'd':
+      optUnary(ctx, p, 1);
+      break;
+    case 'h':
+    case 'a':
+      if (!isOneOf(p[1], "sct")) ctx->fail = true;
+      else optUnary(ctx, p++, 2);
+      break;
+    case 'l':
+      if (!isOneOf(p[1], "2ce")) ctx->fail = true;
+      else optUnary(ctx, p++, 2);
+      break;
+    case 'i':
+      if (!isOneOf(p[1], "glpc")) ctx->fail = true;
+      else optFixed(ctx, p++, 2, 2);
+      break;
+    case 'L':
+      optFixed(ctx, p, 1, 2);
+      break;
+    case '?':
+      optFixed(ctx, p, 1, 3);
+      break;
+    case '\\':
+      if (p[1] == '\0') {
+        ctx->fail = true;
+        break;
+      }
+      pushSlot(ctx, true, true);
+      emit(ctx, p++, 2, false);
+      break;
+    case '$':
+      optLoad(ctx, p++);
+      break;
+    case '&': {
+      slot_t *s = top(ctx);
+      if (s == nullptr || !islower(p[1])) ctx->fail = true;
+      else s->ispure = false;
+      emit(ctx, p++, 2, false);
+    } break;
+    case '@':
+      optSysFn(ctx, p++);
+      break;
+    case '(':
+      optGrpBgn(ctx);
+      break;
+    case ')':
+      optGrpEnd(ctx);
+      break;
+    case '{':
+      p = optLambda(ctx, p);
+      break;
+    case '!':
+      optCall(ctx);
+      break;
+    case ',':
+    case ';': // nothing after this runs
+      emit(ctx, p, 1, false);
+      return;
+    default:
+      ctx->fail = true;
+    }
+  }
+}
+
+/**
+ * @brief Optimize expr in place
+ * @param[in,out] expr Expression in a buffer of at least buf_size bytes
+ * @param[in] hoist Treat register loads as constants
+ */
+static void optimizeExpr(char *expr, bool hoist) {
+  optctx_t ctx = {.uop = no_uop, .hoist = hoist};
+  optimize(&ctx, expr);
+  if (ctx.fail || buf_size <= ctx.len) {
+    rmExprSpaces(&expr);
+    return;
+  }
+  memcpy(expr, ctx.out, ctx.len);
+  expr[ctx.len] = '\0';
+}
+
+/**
+ * @brief Optimize real number mode expression
+ * @param[in,out] expr Expression in a buffer of at least buf_size bytes
+ */
+void optexpr(char *expr) {
+  optimizeExpr(expr, false);
+}
+
+/**
+ * @brief Optimize expression evaluated many times under fixed registers
+ * @param[in,out] expr Expression in a buffer of at least buf_size bytes
+ * @note Register loads are folded as constants unless expr may write
+ *       registers
+ */
+void optexprInvariant(char *expr) {
+  optimizeExpr(expr, strpbrk(expr, "&!") == nullptr);
+}
+
+/**
+ * @brief Only remove unnecessary spaces
+ */
+void optexprSpaces(char *expr) {
   rmExprSpaces(&expr);
 }
 
-test (optexpr) {
+static char *optexprStr(char const *expr) {
+  static char buf[buf_size];
+  strncpy(buf, expr, buf_size - 1);
+  optexpr(buf);
+  return buf;
+}
+
+test_table(
+  optexpr, optexprStr, (char *, char const *),
+  {
+    {                "15",           "4   5   6   +"}, // fold
+    {"1.5707963267948966",                "\\P 2 /"},
+    {                "3m",                  "1 4 -"}, // negative literal
+    {              "1 0/",                  "1 0 /"}, // inf has no literal
+    {                "$1",                 "$1 m m"}, // cancel
+    {                "$1",                 "$1 r d"},
+    {               "$xA",                 "$x m A"},
+    {     "$1s2^($1c2^)+", "($1 s 2 ^) ($1 c 2 ^) +"}, // unwrap group
+    {          "$2 3 4*-",            "$2 (3) 4 * -"},
+    {            "$1s@p*",            "$1 s $1 s *"}, // cse
+    {         "3{$1 2*}!",         "3 {$1 2 *} !"},
+    {               "$1,",          "$1 , 2 3 +"},
+    {           "$1 2:3+",           "$1 2 : 3 +"}, // unknown token
+}
+)
+
+test (optexpr_spaces) {
   char str1[] = "4   5   6   +";
-  optexpr(str1);
+  optexprSpaces(str1);
   expecteq("4 5 6+", (char *)str1);
   char str2[] = "(1 s 2 ^) (1 c 2 ^) +";
-  optexpr(str2);
+  optexprSpaces(str2);
   expecteq("(1s2^)(1c2^)+", (char *)str2);
 }
+
+test (optexpr_invariant) {
+  rrtinfo_t info = getRRuntimeInfo();
+  rrtinfo_t saved = info;
+  info.reg['k' - 'a'] = (real_t){.elem = {.real = 2}, .isnum = true};
+  setRRuntimeInfo(info);
+  char str1[buf_size] = "$1 ($k 3 *) *";
+  optexprInvariant(str1);
+  expecteq("$1 6*", (char *)str1);
+  char str2[buf_size] = "$k 1 + &k";
+  optexprInvariant(str2);
+  expecteq("$k1+&k", (char *)str2);
+  setRRuntimeInfo(saved);
+}
@@ -18,7 +18,7 @@ constexpr static double const consts[alpha_n * 2] = {
   96485.33212331,  // F Faraday constant
   6.6743015e-11,   // G
   0,               // H
-  0,               // I
+  INFINITY,        // I infinity
   0,               // J
   0,               // K
   6.02214076e23,   // L Avogadro constant
@@ -0,0 +1,372 @@
+/**
+ * @file src/profile.c
+ * @brief Define the evaluation profiler
+ */
+
+#include "profile.h"
+#include "chore.h"
+#include "error.h"
+#include "evalfn.h"
+#include "testing.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr size_t prof_cap = 1024;       // entries of a table, a power of 2
+constexpr size_t prof_max_depth = 1024; // frames tracked, deeper ones not
+constexpr size_t prof_rows = 20;        // of each table of the report
+constexpr size_t prof_op_n = '~' - ' ' + 1;
+
+typedef struct {
+  uint64_t count;
+  double cycles;
+} profslot_t;
+
+//! @brief Lambda body or input line
+typedef struct {
+  char const *name; // interned body, or a copy of the line
+  bool line;
+  profslot_t s;
+  uint64_t stamp; // last sample credited, once per sample in recursion
+} profent_t;
+
+//! @brief Distinct stack of the samples, for the folded export
+typedef struct {
+  profent_t const *frames[prof_depth];
+  size_t depth;
+  profmode_t mode;
+  char op;
+  double cycles;
+} profstack_t;
+
+typedef struct {
+  profslot_t ops[PROF_MODE_N][prof_op_n];
+  profent_t lmds[prof_cap], lines[prof_cap];
+  profstack_t stacks[prof_cap];
+  profent_t *frames[prof_max_depth];
+  size_t depth;          // may pass prof_max_depth
+  profent_t *line;       // being evaluated, nullptr if the table is full
+  bool in_line;          // between profLineBegin and profLineEnd
+  uint64_t begin;        // cycle counter at the start of the line
+  uint64_t samples;
+  size_t lost;           // samples without room for their stack
+  uint32_t left, weight; // tokens to the next sample, tokens it stands for
+  uint64_t rng;
+  double overhead; // cycles of reading the counter twice
+} prof_t;
+
+static thread_local prof_t *prof;
+static thread_local bool prof_on;
+
+static size_t opSlot(char op) {
+  return (size_t)(op - ' ') < prof_op_n ? (size_t)(op - ' ') : 0; // '\n'
+}
+
+//! @brief Next gap between samples, uniform in [1, 2 * prof_period - 1]
+static void reload(prof_t *p) {
+  p->rng ^= p->rng << 13;
+  p->rng ^= p->rng >> 7;
+  p->rng ^= p->rng << 17;
+  p->weight = p->left = (uint32_t)(p->rng % (2 * prof_period - 1)) + 1;
+}
+
+static void reset(prof_t *p) {
+  for (size_t i = 0; i < prof_cap; i++) free((char *)p->lines[i].name);
+  memset(p, 0, sizeof *p);
+  p->rng = 0x9E37'79B9'7F4A'7C15;
+  reload(p);
+  p->overhead = INFINITY;
+  for (size_t i = 0; i < 16; i++) {
+    uint64_t t = __builtin_readcyclecounter();
+    double dt = (double)(__builtin_readcyclecounter() - t);
+    p->overhead = lesser(p->overhead, dt);
+  }
+}
+
+//! @brief Whether the calling thread records
+bool profOn(void) {
+  return prof_on;
+}
+
+/**
+ * @brief Start or stop recording on the calling thread, keeping what it
+ *        has recorded so far
+ * @return Whether it records now
+ */
+bool profToggle(void) {
+  if (prof == nullptr) {
+    prof = palloc(sizeof(prof_t));
+    memset(prof, 0, sizeof(prof_t));
+    reset(prof);
+  }
+  return prof_on = !prof_on;
+}
+
+void profClear(void) {
+  if (prof != nullptr) reset(prof);
+}
+
+static uint64_t hashStr(char const *s) {
+  uint64_t h = 0xCBF2'9CE4'8422'2325; // FNV-1a
+  for (; *s; s++) h = (h ^ (uint8_t)*s) * 0x100'0000'01B3;
+  return h;
+}
+
+/**
+ * @brief Entry of name, added if new
+ * @param[in] line Whether name is a line, compared by contents and copied,
+ *                 or an interned lambda body, compared by address
+ * @return nullptr if the table is full
+ */
+static profent_t *
+lookup(profent_t *table, char const *name, bool line, size_t len) {
+  uint64_t h = line ? hashStr(name) : (uint64_t)(uintptr_t)name >> 3;
+  for (size_t i = 0; i < prof_cap; i++) {
+    profent_t *e = table + ((h + i) & (prof_cap - 1));
+    if (e->name == nullptr) {
+      char *copy = nullptr;
+      if (line) {
+        copy = zalloc(char, len + 1);
+        memcpy(copy, name, len);
+        copy[len] = '\0';
+      }
+      *e = (profent_t){.name = line ? copy : name, .line = line};
+      return e;
+    }
+    if (line ? strncmp(e->name, name, len) == 0 && e->name[len] == '\0'
+             : e->name == name)
+      return e;
+  }
+  return nullptr;
+}
+
+static void push(profent_t *e) {
+  if (prof->depth < prof_max_depth) prof->frames[prof->depth] = e;
+  prof->depth++;
+}
+
+/**
+ * @brief Start timing an input line, if the calling thread records
+ * @param[in] line Input, up to a newline
+ */
+void profLineBegin(char const *line) {
+  if (!prof_on) [[clang::likely]]
+    return;
+  prof->line = lookup(prof->lines, line, true, strcspn(line, "\n"));
+  prof->in_line = true;
+  push(prof->line);
+  prof->begin = __builtin_readcyclecounter();
+}
+
+void profLineEnd(void) {
+  if (!prof_on || !prof->in_line) [[clang::likely]]
+    return;
+  double t = (double)(__builtin_readcyclecounter() - prof->begin);
+  if (prof->line != nullptr) {
+    prof->line->s.count++;
+    prof->line->s.cycles += bigger(t - prof->overhead, 0.0);
+  }
+  prof->in_line = false;
+  prof->depth--;
+}
+
+//! @brief Count a call of the lambda body
+void profCall(char const *body) {
+  profent_t *e = lookup(prof->lmds, body, false, 0);
+  if (e != nullptr) e->s.count++;
+}
+
+//! @brief Run under the lambda body until profLeave
+void profEnter(char const *body) {
+  push(lookup(prof->lmds, body, false, 0));
+}
+
+void profLeave(void) {
+  prof->depth--;
+}
+
+/**
+ * @brief Count a dispatched token
+ * @return Whether to time it and pass the cycles to profSample, asked again
+ *         of the next token until it does
+ */
+bool profCount(profmode_t mode, char op) {
+  prof->ops[mode][opSlot(op)].count++;
+  if (prof->left == 1) return true;
+  prof->left--;
+  return false;
+}
+
+static profstack_t *stackOf(profmode_t mode, char op) {
+  op = (char)(opSlot(op) + ' '); // as the report shows it
+  size_t depth = lesser(lesser(prof->depth, prof_max_depth), prof_depth);
+  uint64_t h = (uint64_t)mode * 31 + (uint8_t)op;
+  for (size_t i = 0; i < depth; i++)
+    h = (h ^ (uint64_t)(uintptr_t)prof->frames[i]) * 0x100'0000'01B3;
+  for (size_t i = 0; i < prof_cap; i++) {
+    profstack_t *s = prof->stacks + ((h + i) & (prof_cap - 1));
+    if (s->op == '\0') {
+      s->mode = mode;
+      s->op = op;
+      s->depth = depth;
+      memcpy(s->frames, prof->frames, depth * sizeof(profent_t *));
+      return s;
+    }
+    if (s->mode == mode && s->op == op && s->depth == depth
+        && memcmp(s->frames, prof->frames, depth * sizeof(profent_t *)) == 0)
+      return s;
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Credit a timed token, with the tokens since the last sample, to
+ *        its slot, to the lambda bodies it ran under and to its stack
+ * @param[in] cycles Read around the dispatch of the token
+ */
+void profSample(profmode_t mode, char op, uint64_t cycles) {
+  double t = bigger((double)cycles - prof->overhead, 0.0) * prof->weight;
+  reload(prof);
+  prof->samples++;
+  prof->ops[mode][opSlot(op)].cycles += t;
+  for (size_t i = 0; i < lesser(prof->depth, prof_max_depth); i++) {
+    profent_t *e = prof->frames[i];
+    if (e == nullptr || e->line || e->stamp == prof->samples) continue;
+    e->stamp = prof->samples;
+    e->s.cycles += t;
+  }
+  profstack_t *s = stackOf(mode, op);
+  if (s != nullptr) s->cycles += t;
+  else prof->lost++;
+}
+
+typedef struct {
+  char name[buf_size + 8];
+  profslot_t const *s;
+} profrow_t;
+
+static int cmpRow(void const *a, void const *b) {
+  double x = ((profrow_t const *)a)->s->cycles;
+  double y = ((profrow_t const *)b)->s->cycles;
+  return (x < y) - (x > y);
+}
+
+static void printRows(char const *title, profrow_t *rows, size_t n) {
+  double total = 0;
+  for (size_t i = 0; i < n; i++) total += rows[i].s->cycles;
+  qsort(rows, n, sizeof *rows, cmpRow);
+  printf("%12s %14s %7s  %s\n", "count", "cycles", "share", title);
+  for (size_t i = 0; i < lesser(n, prof_rows); i++)
+    printf(
+      "%12" PRIu64 " %14.0f %6.1f%%    %s\n", // names last, being long
+      rows[i].s->count,
+      rows[i].s->cycles,
+      total == 0 ? 0 : rows[i].s->cycles / total * 100,
+      rows[i].name
+    );
+  if (prof_rows < n) printf("%39s(%zu more)\n", "", n - prof_rows);
+}
+
+static void
+entryRows(profent_t const *table, profrow_t *rows, size_t *n, bool braces) {
+  for (size_t i = 0; i < prof_cap; i++) {
+    if (table[i].name == nullptr) continue;
+    char const *fmt = braces ? "{%s}" : "%s";
+    snprintf(rows[*n].name, sizeof rows->name, fmt, table[i].name);
+    rows[(*n)++].s = &table[i].s;
+  }
+}
+
+/**
+ * @brief Print the tokens, lambda bodies and lines by their cycles, the
+ *        most expensive first
+ */
+void profReport(void) {
+  if (prof == nullptr) {
+    puts("profiler: nothing recorded (:P to start)");
+    return;
+  }
+  static char const *const titles[PROF_MODE_N] = {
+    "real tokens",
+    "complex tokens",
+  };
+  profrow_t *rows drop = zalloc(profrow_t, prof_cap);
+  for (size_t m = 0; m < PROF_MODE_N; m++) {
+    size_t n = 0;
+    for (size_t i = 0; i < prof_op_n; i++) {
+      if (prof->ops[m][i].count == 0) continue;
+      snprintf(rows[n].name, sizeof rows->name, "'%c'", (char)(i + ' '));
+      rows[n++].s = &prof->ops[m][i];
+    }
+    if (n != 0) printRows(titles[m], rows, n);
+  }
+  size_t n = 0;
+  entryRows(prof->lmds, rows, &n, true);
+  if (n != 0) printRows("lambda bodies", rows, n);
+  n = 0;
+  entryRows(prof->lines, rows, &n, false);
+  if (n != 0) printRows("lines", rows, n);
+  printf(
+    "%s, %" PRIu64 " samples, 1 in %" PRIu32 " tokens on average%s\n",
+    prof_on ? "recording" : "stopped",
+    prof->samples,
+    prof_period,
+    prof->lost ? ", some stacks dropped" : ""
+  );
+}
+
+//! @brief Frame name without the ';' that separates frames
+static void writeFrame(FILE *fp, profent_t const *e) {
+  if (!e->line) fputc('{', fp);
+  for (char const *c = e->name; *c; c++) fputc(*c == ';' ? ',' : *c, fp);
+  if (!e->line) fputc('}', fp);
+  fputc(';', fp);
+}
+
+/**
+ * @brief Write the sampled stacks as "line;{body};..;token cycles", the
+ *        folded format of flamegraph tools
+ * @return Whether the file could be written
+ */
+bool profFolded(char const *path) {
+  FILE *fp dropfile = fopen(path, "w");
+  if (fp == nullptr) [[clang::unlikely]] {
+    dispErr(__FUNCTION__, "cannot write %s", path);
+    return false;
+  }
+  if (prof == nullptr) return true;
+  for (size_t i = 0; i < prof_cap; i++) {
+    profstack_t const *s = prof->stacks + i;
+    if (s->op == '\0' || s->cycles < 0.5) continue;
+    for (size_t j = 0; j < s->depth; j++)
+      if (s->frames[j] != nullptr) writeFrame(fp, s->frames[j]);
+    fprintf(
+      fp,
+      "%s '%c' %.0f\n",
+      s->mode == PROF_REAL ? "real" : "complex",
+      s->op,
+      s->cycles
+    );
+  }
+  return true;
+}
+
+test (profile) {
+  bool was = profOn();
+  if (!was) profToggle();
+  profClear();
+  char const *expr = "1 2 3 + {$1 2 *}!"; // '+' is not fused
+  profLineBegin(expr);
+  expecteq(12.0, evalExprReal(expr).elem.real);
+  profLineEnd();
+  expecteq(1, prof->ops[PROF_REAL]['+' - ' '].count);
+  expecteq(1, prof->ops[PROF_REAL]['!' - ' '].count);
+  expecteq(1, lookup(prof->lines, expr, true, strlen(expr))->s.count);
+  expecteq(0, prof->depth);
+  profToggle();
+  evalExprReal(expr);
+  expecteq(1, prof->ops[PROF_REAL]['+' - ' '].count);
+  if (was) profToggle();
+}
@@ -0,0 +1,304 @@
+/**
+ * @file src/quad.c
+ * @brief Define adaptive Gauss-Kronrod quadrature
+ *
+ * Every round bisects up to quad_wave of the worst panels and integrates
+ * the halves, on the shared pool when the round is large enough to pay for
+ * it. Which panels a round takes depends only on the error estimates, so
+ * the result is the same on any number of threads.
+ */
+
+#include "quad.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "testing.h"
+#include "thpool.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+constexpr size_t quad_wave = 8;    // panels bisected per round
+constexpr size_t quad_max_dim = 2; // components of the integrand
+
+// Kronrod nodes on [0, 1] and their weights, the odd ones also Gauss nodes
+static double const xgk[8] = {
+  0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+  0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+  0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+  0.207784955007898467600689403773245, 0.000000000000000000000000000000000,
+};
+static double const wgk[8] = {
+  0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+  0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+  0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+  0.204432940075298892414161999234649, 0.209482141084727828012999174891714,
+};
+static double const wg[4] = {
+  0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+  0.381830050505118944950369775488975, 0.417959183673469387755102040816327,
+};
+
+//! @brief Substitution taking t in the panel domain to x
+typedef enum {
+  MAP_NONE,  // x = t
+  MAP_UPPER, // x = a + t / (1 - t) over [0, 1)
+  MAP_LOWER, // x = b - t / (1 - t) over [0, 1)
+  MAP_BOTH,  // x = t / (1 - t^2) over (-1, 1)
+} quadmap_t;
+
+typedef struct {
+  quadfn_t f;
+  void *ctx;
+  size_t dim;
+  quadmap_t map;
+  double a, b;
+} quad_t;
+
+typedef struct {
+  quad_t const *q;
+  double lo, hi; // in t
+  double val[quad_max_dim];
+  double abs; // integral of |f|, the scale of the tolerance
+  double err;
+} panel_t;
+
+static _Atomic double quad_tol = 1e-10;
+static thread_local quadstat_t quad_stat;
+
+//! @brief x of t, and dx/dt in jac
+static double mapNode(quad_t const *q, double t, double *jac) {
+  switch (q->map) {
+  case MAP_NONE:
+    *jac = 1;
+    return t;
+  case MAP_UPPER:
+    *jac = 1 / ((1 - t) * (1 - t));
+    return q->a + t / (1 - t);
+  case MAP_LOWER:
+    *jac = 1 / ((1 - t) * (1 - t));
+    return q->b - t / (1 - t);
+  case MAP_BOTH:
+    *jac = (1 + t * t) / ((1 - t * t) * (1 - t * t));
+    return t / (1 - t * t);
+  default:
+    [[clang::unlikely]];
+  }
+  return NAN;
+}
+
+/**
+ * @brief QUADPACK's error estimate of a 15-point panel
+ * @param[in] fs Integrand values, the center first, then the pairs of xgk
+ */
+static double panelErr(
+  double const *fs, double resk, double resg, double *resabs, double h
+) {
+  double mean = resk / 2, asc = wgk[7] * fabs(fs[0] - mean);
+  *resabs = wgk[7] * fabs(fs[0]);
+  for (size_t j = 0; j < 7; j++) {
+    double l = fs[1 + 2 * j], r = fs[2 + 2 * j];
+    *resabs += wgk[j] * (fabs(l) + fabs(r));
+    asc += wgk[j] * (fabs(l - mean) + fabs(r - mean));
+  }
+  *resabs *= h;
+  asc *= h;
+  double err = fabs(resk - resg) * h;
+  if (asc != 0 && err != 0) err = asc * lesser(1.0, pow(200 * err / asc, 1.5));
+  return bigger(err, 50 * 0x1p-52 * *resabs);
+}
+
+//! @brief Integrate one panel with G7K15, all nodes in one call of f
+static void runPanel(void *arg) {
+  panel_t *p = arg;
+  quad_t const *q = p->q;
+  double c = (p->lo + p->hi) / 2, h = (p->hi - p->lo) / 2;
+  double xs[quad_nodes], jac[quad_nodes], ys[quad_nodes * quad_max_dim];
+  xs[0] = mapNode(q, c, jac);
+  for (size_t j = 0; j < 7; j++) {
+    xs[1 + 2 * j] = mapNode(q, c - h * xgk[j], jac + 1 + 2 * j);
+    xs[2 + 2 * j] = mapNode(q, c + h * xgk[j], jac + 2 + 2 * j);
+  }
+  q->f(q->ctx, xs, quad_nodes, ys);
+  p->abs = p->err = 0;
+  for (size_t d = 0; d < q->dim; d++) {
+    double *fs = ys + d * quad_nodes;
+    for (size_t i = 0; i < quad_nodes; i++) fs[i] *= jac[i];
+    double resk = wgk[7] * fs[0], resg = wg[3] * fs[0], resabs;
+    for (size_t j = 0; j < 7; j++) {
+      resk += wgk[j] * (fs[1 + 2 * j] + fs[2 + 2 * j]);
+      if (j % 2) resg += wg[j / 2] * (fs[1 + 2 * j] + fs[2 + 2 * j]);
+    }
+    p->val[d] = resk * h;
+    p->err += panelErr(fs, resk, resg, &resabs, h);
+    p->abs += resabs;
+  }
+}
+
+static bool worse(panel_t const *lhs, panel_t const *rhs) {
+  return lhs->err > rhs->err;
+}
+
+static void heapPush(panel_t **heap, size_t *n, panel_t *p) {
+  size_t i = (*n)++;
+  for (; i > 0 && worse(p, heap[(i - 1) / 2]); i = (i - 1) / 2)
+    heap[i] = heap[(i - 1) / 2];
+  heap[i] = p;
+}
+
+static panel_t *heapPop(panel_t **heap, size_t *n) {
+  panel_t *top = heap[0], *last = heap[--*n];
+  size_t i = 0;
+  for (size_t c; (c = 2 * i + 1) < *n; i = c) {
+    if (c + 1 < *n && worse(heap[c + 1], heap[c])) c++;
+    if (!worse(heap[c], last)) break;
+    heap[i] = heap[c];
+  }
+  heap[i] = last;
+  return top;
+}
+
+//! @brief Integrate ps[0..n), on the pool if parallel and n is large
+static void runPanels(panel_t *const *ps, size_t n, bool parallel) {
+  if (!parallel || n < quad_wave) {
+    for (size_t i = 0; i < n; i++) runPanel(ps[i]);
+    return;
+  }
+  thpool_t *pool = thpoolShared();
+  for (size_t i = 0; i < n; i++) thpoolSubmit(pool, runPanel, ps[i]);
+  thpoolWait(pool);
+}
+
+/**
+ * @brief Bisect the worst panels until the estimated error is within the
+ *        tolerance times the integral of |f|, or quad_max_panels are used
+ * @param[out] out dim components of the integral
+ */
+static void
+adapt(quad_t const *q, double lo, double hi, double *out, bool parallel) {
+  panel_t *ps drop = zalloc(panel_t, quad_max_panels);
+  panel_t **heap drop = zalloc(panel_t *, quad_max_panels);
+  size_t n = 1, len = 0, evals = 1;
+  ps[0] = (panel_t){.q = q, .lo = lo, .hi = hi};
+  runPanel(ps);
+  heapPush(heap, &len, ps);
+  double tol = atomic_load(&quad_tol), err = ps->err;
+  for (;;) {
+    double abs = 0;
+    err = 0;
+    for (size_t i = 0; i < n; i++) {
+      abs += ps[i].abs;
+      err += ps[i].err;
+    }
+    if (!(tol * abs < err) || n == quad_max_panels) break;
+    panel_t *split[2 * quad_wave];
+    size_t k = lesser(lesser(quad_wave, len), quad_max_panels - n);
+    for (size_t i = 0; i < k; i++) {
+      panel_t *p = heapPop(heap, &len), *r = ps + n++;
+      double mid = (p->lo + p->hi) / 2;
+      *r = (panel_t){.q = q, .lo = mid, .hi = p->hi};
+      p->hi = mid;
+      split[2 * i] = p;
+      split[2 * i + 1] = r;
+    }
+    runPanels(split, 2 * k, parallel);
+    for (size_t i = 0; i < 2 * k; i++) heapPush(heap, &len, split[i]);
+    evals += 2 * k;
+  }
+  for (size_t d = 0; d < q->dim; d++) {
+    out[d] = 0;
+    for (size_t i = 0; i < n; i++) out[d] += ps[i].val[d];
+  }
+  quad_stat = (quadstat_t){
+    .tol = tol, .err = err, .evals = evals * quad_nodes, .panels = n
+  };
+}
+
+/**
+ * @brief Integral of f from a to b, either of which may be infinite
+ * @param[in] dim Components of f, at most 2
+ * @param[out] out dim components of the integral
+ * @param[in] parallel Whether f may run on several threads at once
+ */
+void quadIntegrate(
+  quadfn_t f, void *ctx, size_t dim, double a, double b, double *out,
+  bool parallel
+) {
+  double sign = 1;
+  if (b < a) {
+    double t = a;
+    a = b;
+    b = t;
+    sign = -1;
+  }
+  quad_stat = (quadstat_t){.tol = atomic_load(&quad_tol)};
+  if (isnan(a) || isnan(b) || a == b) {
+    for (size_t d = 0; d < dim; d++) out[d] = a == b ? 0 : NAN;
+    return;
+  }
+  quad_t q = {.f = f, .ctx = ctx, .dim = lesser(dim, quad_max_dim)};
+  double lo = 0, hi = 1;
+  if (isinf(a) && isinf(b)) {
+    q.map = MAP_BOTH;
+    lo = -1;
+  } else if (isinf(b)) {
+    q.map = MAP_UPPER;
+    q.a = a;
+  } else if (isinf(a)) {
+    q.map = MAP_LOWER;
+    q.b = b;
+  } else {
+    q.map = MAP_NONE;
+    lo = a;
+    hi = b;
+  }
+  adapt(&q, lo, hi, out, parallel);
+  for (size_t d = 0; d < q.dim; d++) out[d] *= sign;
+}
+
+//! @brief Report of the last quadIntegrate on this thread
+quadstat_t quadStat(void) {
+  return quad_stat;
+}
+
+//! @brief Set the relative tolerance of later integrals
+void quadSetTol(double tol) {
+  if (0 < tol) atomic_store(&quad_tol, tol);
+}
+
+static void gauss(void *ctx, double const *xs, size_t n, double *ys) {
+  _ = ctx;
+  for (size_t i = 0; i < n; i++) ys[i] = exp(-xs[i] * xs[i]);
+}
+
+static void cosSin(void *ctx, double const *xs, size_t n, double *ys) {
+  _ = ctx;
+  for (size_t i = 0; i < n; i++) {
+    ys[i] = cos(xs[i]);
+    ys[n + i] = sin(xs[i]);
+  }
+}
+
+static void invSqrt(void *ctx, double const *xs, size_t n, double *ys) {
+  _ = ctx;
+  for (size_t i = 0; i < n; i++) ys[i] = 1 / sqrt(xs[i]);
+}
+
+test (quad) {
+  double v[2];
+  quadIntegrate(gauss, nullptr, 1, -INFINITY, INFINITY, v, false);
+  expecteq(sqrt(3.14159265358979323846), v[0]);
+  quadIntegrate(gauss, nullptr, 1, INFINITY, 0, v, true);
+  expecteq(-sqrt(3.14159265358979323846) / 2, v[0]);
+  quadIntegrate(cosSin, nullptr, 2, 0, 1, v, false);
+  expecteq(sin(1), v[0]);
+  expecteq(1 - cos(1), v[1]);
+  expecteq(quad_nodes, quadStat().evals);
+  quadIntegrate(invSqrt, nullptr, 1, 0, 1, v, true); // endpoint singularity
+  expecteq(2.0, v[0]);
+  expecteq(true, quadStat().err <= quadStat().tol * 2.0);
+}
+
+bench (quad_gauss) {
+  double v;
+  quadIntegrate(gauss, nullptr, 1, -INFINITY, INFINITY, &v, false);
+}
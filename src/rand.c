@@ -30,8 +30,13 @@ void sxorsh(uint64_t s) {
   state = s;
 }
 
+/**
+ * @brief Seed the calling thread, whose state would otherwise stay 0
+ * @note The address of the state tells the threads apart
+ */
 [[gnu::constructor(101)]] void initXorsh() {
-  sxorsh((uint64_t)clock());
+  uint64_t id = (uint64_t)(uintptr_t)&state * 0x9e37'79b9'7f4a'7c15;
+  sxorsh(((uint64_t)clock() ^ id) | 1);
   _ = xorsh();
 }
 
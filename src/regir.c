@@ -0,0 +1,587 @@
+/**
+ * @file src/regir.c
+ * @brief Define register IR compiler and interpreter
+ *
+ * Slot i of the operand stack is virtual register i. Frame depths are
+ * resolved at compile time, so variadic operators become straight-line
+ * code, and an immediate or duplicated right operand is folded into the
+ * instruction instead of occupying a register. Lambdas, @d, @h and @s are
+ * left to the stack interpreter.
+ */
+
+#include "regir.h"
+#include "arthfn.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "gene.h"
+#include "mathdef.h"
+#include "phyconst.h"
+#include "rand.h"
+#include "testing.h"
+#include <ctype.h>
+#include <string.h>
+
+typedef double [[gnu::vector_size(ir_lanes * sizeof(double))]] irv_t;
+typedef double (*fn1_t)(double);
+typedef double (*fn2_t)(double, double);
+
+typedef struct {
+  irprog_t *p;
+  size_t depth;            // operand stack depth
+  size_t frames[buf_size]; // depth at each open '('
+  size_t fp;
+  machine_t *ei; // owner of the registers and history, nullable
+  bool fail;
+} irctx_t;
+
+static double logBase(double x, double base) {
+  return log(x) / log(base);
+}
+
+static double cond(double a, double b, double c) {
+  return isnan(c) ? b : a;
+}
+
+static bool cmpOk(int op, double lhs, double rhs) {
+  return op == '<' ? lhs < rhs : op == '>' ? lhs > rhs : eq(lhs, rhs);
+}
+
+//! @brief Same as rpxLt, rpxGt and rpxEql over s[0..n-1]
+static double cmpChain(double const *s, size_t n, int op) {
+  size_t i = n - 1;
+  for (; 0 < i && cmpOk(op, s[i - 1], s[i]); i--);
+  return i == 0 ? 1 : NAN;
+}
+
+static void put(irctx_t *c, irinst_t in) {
+  if (c->p->n == ir_cap) c->fail = true;
+  if (c->fail) return;
+  in.depth = c->depth;
+  c->p->code[c->p->n++] = in;
+}
+
+static size_t frameBase(irctx_t const *c) {
+  return c->fp ? c->frames[c->fp - 1] : 0;
+}
+
+static bool need(irctx_t *c, size_t n) {
+  if (c->depth - frameBase(c) < n) c->fail = true;
+  return !c->fail;
+}
+
+//! @brief Emit an instruction producing a new slot
+static void putPush(irctx_t *c, irinst_t in) {
+  if (c->depth == buf_size) c->fail = true;
+  in.dst = c->depth;
+  put(c, in);
+  c->depth++;
+  c->p->nslots = bigger(c->p->nslots, c->depth);
+}
+
+/**
+ * @brief Emit dst = a op b, folding b when the previous instruction only
+ *        produced it as an immediate or a copy
+ */
+static void putArith(irctx_t *c, irop_t op, size_t dst, size_t a, size_t b) {
+  irinst_t in = {.op = op, .dst = dst, .a = a, .b = b};
+  irinst_t *last = c->p->n ? c->p->code + c->p->n - 1 : nullptr;
+  if (last && last->dst == b && b + 1 == c->depth) {
+    if (last->op == IR_IMM) {
+      in.bimm = true;
+      in.imm = last->imm;
+      c->p->n--;
+    } else if (last->op == IR_MOV) {
+      in.b = last->a;
+      c->p->n--;
+    }
+  }
+  put(c, in);
+}
+
+static void putCall2(irctx_t *c, fn2_t fn, size_t a, size_t b) {
+  put(c, (irinst_t){.op = IR_CALL2, .dst = a, .a = a, .b = b, .fn2 = fn});
+}
+
+static void compileUnary(irctx_t *c, fn1_t fn) {
+  if (fn == nullptr) c->fail = true;
+  if (!need(c, 1)) return;
+  size_t top = c->depth - 1;
+  put(c, (irinst_t){.op = IR_CALL1, .dst = top, .a = top, .fn1 = fn});
+}
+
+static void compileScale(irctx_t *c, double factor) {
+  if (!need(c, 1)) return;
+  size_t top = c->depth - 1;
+  put(
+    c,
+    (irinst_t){
+      .op = IR_MUL, .dst = top, .a = top, .bimm = true, .imm = factor
+    }
+  );
+}
+
+static void compileBinary(irctx_t *c, fn2_t fn) {
+  if (fn == nullptr) c->fail = true;
+  if (!need(c, 2)) return;
+  size_t lhs = c->depth - 2;
+  putCall2(c, fn, lhs, lhs + 1);
+  c->depth--;
+}
+
+static void compileCond(irctx_t *c) {
+  if (!need(c, 3)) return;
+  size_t a = c->depth - 3;
+  put(
+    c,
+    (irinst_t){
+      .op = IR_CALL3, .dst = a, .a = a, .b = a + 1, .c = a + 2, .fn3 = cond
+    }
+  );
+  c->depth -= 2;
+}
+
+//! @brief Operators over the whole frame, folded from the top down
+static void compileVariadic(irctx_t *c, char op) {
+  size_t base = frameBase(c);
+  if (!need(c, 1)) return;
+  switch (op) {
+  case '<':
+  case '>':
+  case '=':
+    put(
+      c,
+      (irinst_t){.op = IR_CMP,
+                 .dst = base,
+                 .b = c->depth - base,
+                 .c = (size_t)op,
+                 .fnv = cmpChain}
+    );
+    break;
+  default:
+    for (size_t i = c->depth - 1; base < i; c->depth = i--)
+      switch (op) {
+      case '+':
+        putArith(c, IR_ADD, base, base, i);
+        break;
+      case '-':
+        putArith(c, IR_SUB, base, base, i);
+        break;
+      case '*':
+        putArith(c, IR_MUL, base, base, i);
+        break;
+      case '/':
+        putArith(c, IR_DIV, base, base, i);
+        break;
+      case '%':
+        putCall2(c, fmod, base, i);
+        break;
+      default: // '^'
+        putCall2(c, pow, base, i);
+      }
+  }
+  c->depth = base + 1;
+}
+
+static int keyIndex(char key, char const *keys) {
+  char const *hit = key == '\0' ? nullptr : strchr(keys, key);
+  return hit == nullptr ? -1 : (int)(hit - keys);
+}
+
+// key is evaluated twice
+#define PICK(T, key, keys, ...) \
+  (keyIndex(key, keys) < 0 ? nullptr \
+                           : (T const[]){__VA_ARGS__}[keyIndex(key, keys)])
+
+static void compileSysFn(irctx_t *c, char op) {
+  switch (op) {
+  case 'a':
+    if (c->ei == nullptr) {
+      c->fail = true;
+      break;
+    }
+    rrtinfo_t *info = &c->ei->e.info;
+    putPush(
+      c,
+      (irinst_t){
+        .op = IR_LOAD,
+        .src = &info->hist[lesser(info->histi, buf_size - 1)].elem.real
+      }
+    );
+    break;
+  case 'n':
+    putPush(c, (irinst_t){.op = IR_IMM, .imm = NAN});
+    break;
+  case 'p':
+    if (need(c, 1)) putPush(c, (irinst_t){.op = IR_MOV, .a = c->depth - 1});
+    break;
+  case 'r':
+    putPush(c, (irinst_t){.op = IR_CALL0, .fn0 = xorsh0to1});
+    break;
+  default: // I/O and stack introspection stay in the interpreter
+    c->fail = true;
+  }
+}
+
+static void compileRegs(irctx_t *c, char reg) {
+  if ('1' <= reg && reg <= '0' + (int)arg_n)
+    putPush(c, (irinst_t){.op = IR_ARG, .k = (size_t)(reg - '1')});
+  else if (islower(reg) && c->ei != nullptr
+           && c->ei->e.info.reg[reg - 'a'].isnum)
+    putPush(
+      c,
+      (irinst_t){
+        .op = IR_LOAD, .src = &c->ei->e.info.reg[reg - 'a'].elem.real
+      }
+    );
+  else c->fail = true;
+}
+
+static void compileStore(irctx_t *c, char reg) {
+  if (!islower(reg) || c->ei == nullptr) c->fail = true;
+  if (c->fail || !need(c, 1)) return;
+  put(
+    c,
+    (irinst_t){
+      .op = IR_STORE, .a = c->depth - 1, .reg = c->ei->e.info.reg + reg - 'a'
+    }
+  );
+}
+
+static void compileGrpEnd(irctx_t *c) {
+  if (c->fp == 0 || !need(c, 1)) {
+    c->fail = true;
+    return;
+  }
+  size_t base = c->frames[--c->fp];
+  if (base != c->depth - 1)
+    put(c, (irinst_t){.op = IR_MOV, .dst = base, .a = c->depth - 1});
+  c->depth = base + 1;
+}
+
+static void compile(irctx_t *c, char const *p) {
+  for (; !c->fail && *p; p++) {
+    if (isspace(*p)) continue;
+    if (isdigit(*p)) {
+      char *end = nullptr;
+      putPush(c, (irinst_t){.op = IR_IMM, .imm = strtod(p, &end)});
+      p = end - 1;
+      continue;
+    }
+    switch (*p) {
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+    case '%':
+    case '^':
+    case '<':
+    case '>':
+    case '=':
+      compileVariadic(c, *p);
+      break;
+    case 'm':
+      compileScale(c, -1);
+      break;
+    case 'r':
+      compileScale(c, pi / 180);
+      break;
+    case 'd':
+      compileScale(c, 180 / pi);
+      break;
+    case 's':
+    case 'c':
+    case 't':
+    case 'A':
+    case 'g':
+    case 'C':
+    case 'F':
+    case 'R':
+      compileUnary(
+        c,
+        PICK(
+          fn1_t, *p, "sctAgCFR", sin, cos, tan, fabs, tgamma, ceil, floor, round
+        )
+      );
+      break;
+    case 'h':
+      p++;
+      compileUnary(c, PICK(fn1_t, *p, "sct", sinh, cosh, tanh));
+      break;
+    case 'a':
+      p++;
+      compileUnary(c, PICK(fn1_t, *p, "sct", asin, acos, atan));
+      break;
+    case 'l':
+      p++;
+      compileUnary(c, PICK(fn1_t, *p, "2ce", log2, log10, log));
+      break;
+    case 'i':
+      p++;
+      compileBinary(
+        c, PICK(fn2_t, *p, "glpc", gcd, lcm, permutation, combination)
+      );
+      break;
+    case 'L':
+      compileBinary(c, logBase);
+      break;
+    case '?':
+      compileCond(c);
+      break;
+    case '\\':
+      putPush(c, (irinst_t){.op = IR_IMM, .imm = getConst(*++p)});
+      break;
+    case '$':
+      compileRegs(c, *++p);
+      break;
+    case '&':
+      compileStore(c, *++p);
+      break;
+    case '@':
+      compileSysFn(c, *++p);
+      break;
+    case '(':
+      if (c->fp == buf_size) c->fail = true;
+      else c->frames[c->fp++] = c->depth;
+      break;
+    case ')':
+      compileGrpEnd(c);
+      break;
+    case ',':
+    case ';':
+      return;
+    default: // lambdas and unknown tokens
+      c->fail = true;
+    }
+  }
+}
+
+/**
+ * @brief Translate expr into register IR
+ * @param[in] ei Machine whose registers and history the code refers to,
+ *               nullptr rejects code referring to them
+ * @return Whether the expression could be compiled
+ */
+bool irCompile(irprog_t *p, char const *expr, machine_t *ei) {
+  *p = (irprog_t){.n = 0, .nslots = 0};
+  irctx_t c = {.p = p, .ei = ei};
+  compile(&c, expr);
+  if (c.depth == 0) c.fail = true;
+  else put(&c, (irinst_t){.op = IR_RET, .a = c.depth - 1});
+  return !c.fail;
+}
+
+/**
+ * @brief Run compiled IR
+ * @param[in] args $1..$8 in order
+ * @return Value of the expression
+ */
+double irRun(irprog_t const *p, double const *args) {
+  return irExec(p->code, args);
+}
+
+/**
+ * @brief Run IR up to its IR_RET, for code kept outside an irprog_t
+ * @param[in] args $1..$8 in order
+ */
+#define RHS(in) ((in)->bimm ? (in)->imm : r[(in)->b])
+double irExec(irinst_t const *code, double const *args) {
+  double r[buf_size];
+  for (irinst_t const *in = code;; in++) {
+    switch (in->op) {
+    case IR_IMM:
+      r[in->dst] = in->imm;
+      break;
+    case IR_ARG:
+      r[in->dst] = args[in->k];
+      break;
+    case IR_LOAD:
+      r[in->dst] = *in->src;
+      break;
+    case IR_STORE:
+      *in->reg = (real_t){.elem = {.real = r[in->a]}, .isnum = true};
+      break;
+    case IR_MOV:
+      r[in->dst] = r[in->a];
+      break;
+    case IR_ADD:
+      r[in->dst] = r[in->a] + RHS(in);
+      break;
+    case IR_SUB:
+      r[in->dst] = r[in->a] - RHS(in);
+      break;
+    case IR_MUL:
+      r[in->dst] = r[in->a] * RHS(in);
+      break;
+    case IR_DIV:
+      r[in->dst] = r[in->a] / RHS(in);
+      break;
+    case IR_CALL0:
+      r[in->dst] = in->fn0();
+      break;
+    case IR_CALL1:
+      r[in->dst] = in->fn1(r[in->a]);
+      break;
+    case IR_CALL2:
+      r[in->dst] = in->fn2(r[in->a], r[in->b]);
+      break;
+    case IR_CALL3:
+      r[in->dst] = in->fn3(r[in->a], r[in->b], r[in->c]);
+      break;
+    case IR_CMP:
+      r[in->dst] = in->fnv(r + in->dst, in->b, (int)in->c);
+      break;
+    case IR_RET:
+      return r[in->a];
+    default:
+      [[clang::unlikely]];
+    }
+  }
+}
+
+//! @brief Whether irExecBatch may run code, that is, it stores no register
+bool irBatchable(irinst_t const *code) {
+  for (irinst_t const *in = code; in->op != IR_RET; in++)
+    if (in->op == IR_STORE) return false;
+  return true;
+}
+
+/**
+ * @brief irExec with $1 = xs[i] for every i, ir_lanes calls at a time
+ *
+ * Arithmetic runs on all lanes at once and calls go lane by lane, so the
+ * dispatch is paid once per batch. Every lane reads the same registers,
+ * hence irBatchable.
+ *
+ * @param[in] args $2..$8 from args[1] on, args[0] is ignored
+ * @param[out] out n results, may be xs itself
+ */
+#define RHSV(in) ((in)->bimm ? (in)->imm + (irv_t){} : r[(in)->b])
+void irExecBatch(
+  irinst_t const *code, double const *args, double const *xs, size_t n,
+  double *out
+) {
+  irv_t r[buf_size] = {}; // lanes past n stay defined
+  for (size_t base = 0; base < n; base += ir_lanes) {
+    size_t m = lesser(ir_lanes, n - base);
+    irv_t x1 = {};
+    for (size_t j = 0; j < m; j++) x1[j] = xs[base + j];
+    irinst_t const *in = code;
+    for (; in->op != IR_RET; in++) {
+      switch (in->op) {
+      case IR_IMM:
+        r[in->dst] = in->imm + (irv_t){};
+        break;
+      case IR_ARG:
+        r[in->dst] = in->k == 0 ? x1 : args[in->k] + (irv_t){};
+        break;
+      case IR_LOAD:
+        r[in->dst] = *in->src + (irv_t){};
+        break;
+      case IR_MOV:
+        r[in->dst] = r[in->a];
+        break;
+      case IR_ADD:
+        r[in->dst] = r[in->a] + RHSV(in);
+        break;
+      case IR_SUB:
+        r[in->dst] = r[in->a] - RHSV(in);
+        break;
+      case IR_MUL:
+        r[in->dst] = r[in->a] * RHSV(in);
+        break;
+      case IR_DIV:
+        r[in->dst] = r[in->a] / RHSV(in);
+        break;
+      case IR_CALL0:
+        for (size_t j = 0; j < m; j++) r[in->dst][j] = in->fn0();
+        break;
+      case IR_CALL1:
+        for (size_t j = 0; j < m; j++)
+          r[in->dst][j] = in->fn1(r[in->a][j]);
+        break;
+      case IR_CALL2:
+        for (size_t j = 0; j < m; j++)
+          r[in->dst][j] = in->fn2(r[in->a][j], r[in->b][j]);
+        break;
+      case IR_CALL3:
+        for (size_t j = 0; j < m; j++)
+          r[in->dst][j] = in->fn3(r[in->a][j], r[in->b][j], r[in->c][j]);
+        break;
+      case IR_CMP:
+        for (size_t j = 0; j < m; j++) {
+          double s[buf_size];
+          for (size_t i = 0; i < in->b; i++) s[i] = r[in->dst + i][j];
+          r[in->dst][j] = in->fnv(s, in->b, (int)in->c);
+        }
+        break;
+      case IR_STORE:
+      case IR_RET:
+      default:
+        [[clang::unlikely]];
+      }
+    }
+    for (size_t j = 0; j < m; j++) out[base + j] = r[in->a][j];
+  }
+}
+
+static bool irMatches(char const *expr, size_t n) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  real_t args[arg_n] = {
+    [arg_n - 1] = (real_t){.elem = {.real = 3}, .isnum = true},
+    [arg_n - 2] = (real_t){.elem = {.real = 4}, .isnum = true},
+  };
+  double want = evalWithArgs(&ei, expr, args).elem.real;
+  irprog_t *p drop = palloc(sizeof(irprog_t));
+  if (!irCompile(p, expr, &ei)) return false;
+  double got = irRun(p, (double const[arg_n]){3, 4});
+  return p->n == n && (got == want || (isnan(got) && isnan(want)));
+}
+
+test_table(
+  regir, irMatches, (bool, char const *, size_t),
+  {
+    { true,           "1 2 3 4 5 +",  9}, // top imm folded into add
+    { true,                "$1 2 ^",  4},
+    { true,               "$1 @p *",  3}, // dup folded into mul
+    { true, "$1 s 2 ^ ($1 c 2 ^) +", 10},
+    { true,      "$1 $2 ($2 5 <) ?",  7},
+    { true,            "$1 &x $x *",  5},
+    { true,              "$1 3 m -",  5},
+    {false,            "{$1 2 *} !",  0}, // lambda
+}
+)
+
+static bool batchMatches(char const *expr) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  irprog_t *p drop = palloc(sizeof(irprog_t));
+  if (!irCompile(p, expr, &ei) || !irBatchable(p->code)) return false;
+  double xs[11], out[11], args[arg_n] = {0, 4};
+  for (size_t i = 0; i < 11; i++) xs[i] = (double)i - 5;
+  irExecBatch(p->code, args, xs, 11, out);
+  for (size_t i = 0; i < 11; i++) {
+    args[0] = xs[i];
+    double want = irRun(p, args);
+    if (out[i] != want && !(isnan(out[i]) && isnan(want))) return false;
+  }
+  return true;
+}
+
+test_table(
+  regir_batch, batchMatches, (bool, char const *),
+  {
+    { true,      "$1 s 2 ^ ($1 c 2 ^) +"},
+    { true,          "$1 $2 ($1 0 <) ?"},
+    { true, "$1 2 * 3 - $2 / (1 $1 <)"},
+    {false,                 "$1 &x $x"}, // stores a register
+}
+)
+
+bench (regir_sweep) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  static irprog_t p;
+  irCompile(&p, "1 2 3 4 5 + $1 * $2 -", &ei);
+  for (int i = 0; i < 1000; i++) irRun(&p, (double const[arg_n]){i, 2});
+}
@@ -5,7 +5,7 @@
 #include "rtconf.h"
 
 plotcfg_t pcfg;
-rrtinfo_t info_r = (rrtinfo_t){.histi = ~0UL};
+thread_local rrtinfo_t info_r = (rrtinfo_t){.histi = ~0UL};
 rtinfo_t info_c = (rtinfo_t){.histi = ~0UL};
 
 plotcfg_t getPlotCfg() {
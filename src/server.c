@@ -0,0 +1,291 @@
+/**
+ * @file src/server.c
+ * @brief Define evaluation daemon over a UNIX domain socket
+ */
+
+#define _POSIX_C_SOURCE 200112L // nanosleep
+#include "server.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "errcode.h"
+#include "evalfn.h"
+#include "exprcheck.h"
+#include "testing.h"
+#include "thpool.h"
+#include "writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+constexpr size_t conn_bufsize = 1 << 12;
+constexpr int max_events = 64;
+
+//! @brief Per-connection context
+typedef struct {
+  int fd;
+  int efd; // epoll instance to rearm
+  rrtinfo_t info;
+  bool skipping; // the rest of a request line that was too long
+  size_t len;
+  char buf[conn_bufsize];
+} conn_t;
+
+static struct sockaddr_un sockAddr(char const *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+  return addr;
+}
+
+/**
+ * @brief Evaluate every complete line in the connection buffer
+ * @note One "result: ..." line is written back per request line, or an
+ *       "error: ..." line for one that checkExprReal refuses or that does
+ *       not fit in the buffer
+ */
+static void evalLines(conn_t *restrict c) {
+  int prevfd = setWriterFd(c->fd);
+  rrtinfo_t previnfo = getRRuntimeInfo();
+  setRRuntimeInfo(c->info);
+
+  char *p = c->buf;
+  if (c->skipping) [[clang::unlikely]] {
+    char *nl = memchr(p, '\n', c->len);
+    c->skipping = nl == nullptr;
+    p = c->skipping ? p + c->len : nl + 1;
+  }
+  for (char *nl; (nl = memchr(p, '\n', c->len - (size_t)(p - c->buf)));
+       p = nl + 1) {
+    *nl = '\0';
+    rrtinfo_t info = getRRuntimeInfo();
+    char const *at;
+    errcode_t e = checkExprReal(p, &info, &at);
+    if (e == ERR_SUCCESS) [[clang::likely]] {
+      printElem(evalExprReal(p));
+      continue;
+    }
+    writeStr("error: ");
+    writeStr(codetomsg(e));
+    writeStr(" at col ");
+    writeInt(at - p);
+    writeChar('\n');
+  }
+  c->len -= (size_t)(p - c->buf);
+  memmove(c->buf, p, c->len);
+  if (c->len == conn_bufsize - 1) [[clang::unlikely]] {
+    writeStr("error: request too long\n");
+    c->len = 0;
+    c->skipping = true; // up to the next '\n', so replies stay in order
+  }
+
+  c->info = getRRuntimeInfo();
+  setRRuntimeInfo(previnfo);
+  setWriterFd(prevfd);
+}
+
+static void closeConn(conn_t *c) {
+  close(c->fd);
+  free(c);
+}
+
+/**
+ * @brief Worker job: drain a readable connection
+ * @param[in] arg conn_t
+ */
+static void serveConn(void *arg) {
+  conn_t *c = arg;
+  for (;;) {
+    ssize_t n = recv(
+      c->fd, c->buf + c->len, conn_bufsize - 1 - c->len, MSG_DONTWAIT
+    );
+    if (n > 0) {
+      c->len += (size_t)n;
+      evalLines(c);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    closeConn(c); // EOF or error
+    return;
+  }
+
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = c};
+  if (epoll_ctl(c->efd, EPOLL_CTL_MOD, c->fd, &ev) < 0) closeConn(c);
+}
+
+static void acceptConns(int lfd, int efd, rrtinfo_t const *warm) {
+  for (int fd; (fd = accept(lfd, nullptr, nullptr)) >= 0;) {
+    conn_t *c = palloc(sizeof(conn_t));
+    *c = (conn_t){.fd = fd, .efd = efd, .info = *warm, .len = 0};
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = c};
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0) closeConn(c);
+  }
+}
+
+/**
+ * @brief Serve evaluation requests forever
+ * @param[in] path Socket path (an existing file is replaced)
+ * @note Registers and init scripts loaded so far are the initial context of
+ *       every connection
+ */
+void serve(char const *path) {
+  struct sockaddr_un addr = sockAddr(path);
+  int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  unlink(path);
+  if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof addr) < 0
+      || listen(lfd, SOMAXCONN) < 0) [[clang::unlikely]]
+    panic(ERR_CONNECTION_FAILURE, "%s ", path);
+  fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+
+  int efd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event lev = {.events = EPOLLIN, .data.ptr = nullptr};
+  if (efd < 0 || epoll_ctl(efd, EPOLL_CTL_ADD, lfd, &lev) < 0)
+    [[clang::unlikely]] panic(ERR_CONNECTION_FAILURE);
+
+  signal(SIGPIPE, SIG_IGN); // a client hanging up must not kill the server
+  rrtinfo_t warm = getRRuntimeInfo();
+  thpool_t *pool = thpoolNew(0);
+
+  for (struct epoll_event evs[max_events];;) {
+    int n = epoll_wait(efd, evs, max_events, -1);
+    for (int i = 0; i < n; i++)
+      if (evs[i].data.ptr == nullptr) acceptConns(lfd, efd, &warm);
+      else thpoolSubmit(pool, serveConn, evs[i].data.ptr);
+  }
+}
+
+/**
+ * @brief Send each line of stdin to a server and print the responses
+ * @param[in] path Socket path
+ */
+void client(char const *path) {
+  struct sockaddr_un addr = sockAddr(path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0)
+    [[clang::unlikely]] panic(ERR_CONNECTION_FAILURE, "%s ", path);
+
+  bool interactive = isatty(STDIN_FILENO);
+  char line[buf_size];
+  char res[conn_bufsize];
+  while (fgets(line, buf_size, stdin)) {
+    if (write(fd, line, strlen(line)) < 0) break;
+    for (size_t len = 0; len == 0 || res[len - 1] != '\n';) {
+      ssize_t n = read(fd, res + len, conn_bufsize - len);
+      if (n <= 0) goto end;
+      len += (size_t)n;
+      writeBytes(res + len - (size_t)n, (size_t)n);
+      if (len == conn_bufsize) len = 0;
+    }
+    if (interactive) flushWriter();
+  }
+
+end:
+  flushWriter();
+  close(fd);
+}
+
+test (server_conn) {
+  int sv[2];
+  expect(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  conn_t *c = palloc(sizeof(conn_t));
+  *c = (conn_t){.fd = sv[0], .efd = -1, .info = getRRuntimeInfo(), .len = 0};
+
+  char const req[] = "1 2 +\n3 &x\n$x $x *\n";
+  expect(write(sv[1], req, sizeof req - 1) == (ssize_t)(sizeof req - 1));
+  serveConn(c); // rearm fails without epoll, which closes the connection
+
+  char res[128] = {};
+  expect(read(sv[1], res, sizeof res - 1) > 0);
+  expecteq("result: 3\nresult: 3\nresult: 9\n", (char *)res);
+  close(sv[1]);
+}
+
+test (server_check) {
+  int sv[2];
+  expect(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  conn_t *c = palloc(sizeof(conn_t));
+  *c = (conn_t){.fd = sv[0], .efd = -1, .info = getRRuntimeInfo(), .len = 0};
+
+  char const req[] = "1 2 +\n$?\n+\n1 $q +\n1 ?\n3 !\n(1 2 +))\n"
+                     "3 {$1 2 ^}&f !\n2 $f !\n";
+  expect(write(sv[1], req, sizeof req - 1) == (ssize_t)(sizeof req - 1));
+  serveConn(c);
+
+  char res[512] = {};
+  expect(read(sv[1], res, sizeof res - 1) > 0);
+  expecteq(
+    "result: 3\n"
+    "error: Unknown character at col 0\n"
+    "error: Missing operand at col 0\n"
+    "error: Unset register at col 2\n"
+    "error: Missing operand at col 2\n"
+    "error: Type mismatch at col 2\n"
+    "error: Character not found at col 7\n"
+    "result: 9\n"
+    "result: 4\n",
+    (char *)res
+  );
+  close(sv[1]);
+}
+
+test (server_long_request) {
+  int sv[2];
+  expect(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  conn_t *c = palloc(sizeof(conn_t));
+  *c = (conn_t){.fd = sv[0], .efd = -1, .info = getRRuntimeInfo(), .len = 0};
+
+  char req[3 * conn_bufsize] = "1 2 +\n";
+  memset(req + 6, '1', sizeof req - 6);
+  strcpy(req + sizeof req - 16, " +\n3 4 +\n");
+  expect(write(sv[1], req, strlen(req)) == (ssize_t)strlen(req));
+  serveConn(c);
+
+  char res[128] = {};
+  expect(read(sv[1], res, sizeof res - 1) > 0);
+  expecteq("result: 3\nerror: request too long\nresult: 7\n", (char *)res);
+  close(sv[1]);
+}
+
+#ifdef BENCHMARK_MODE
+static void *benchServe(void *path) {
+  serve(path);
+}
+
+//! @brief Connection to a server started on a thread of its own
+static int benchConnect(void) {
+  static char path[64];
+  snprintf(path, sizeof path, "/tmp/rpx-bench-%d.sock", (int)getpid());
+  pthread_t th;
+  pthread_create(&th, nullptr, benchServe, path);
+  pthread_detach(th);
+  struct sockaddr_un addr = sockAddr(path);
+  for (int i = 0; i < 1000; i++) { // until it listens
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0) return fd;
+    close(fd);
+    nanosleep(&(struct timespec){.tv_nsec = 1'000'000}, nullptr);
+  }
+  return -1;
+}
+
+//! @brief Request written and its response read back, as a client sees it
+bench (server_roundtrip) {
+  static int fd = -2;
+  if (fd == -2) fd = benchConnect();
+  if (fd < 0) [[clang::unlikely]] return;
+  char res[64];
+  if (write(fd, "1 2 +\n", 6) != 6) return;
+  for (size_t len = 0; len == 0 || res[len - 1] != '\n';) {
+    ssize_t n = read(fd, res + len, sizeof res - len);
+    if (n <= 0) return;
+    len += (size_t)n;
+    if (len == sizeof res) len = 0;
+  }
+}
+#endif
@@ -0,0 +1,278 @@
+/**
+ * @file src/shmring.c
+ * @brief Define evaluation over shared-memory rings
+ */
+
+#define _POSIX_C_SOURCE 200809L // shm_open, ftruncate, nanosleep
+#include "shmring.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "errcode.h"
+#include "jit.h"
+#include "mathdef.h"
+#include "optexpr.h"
+#include "testing.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+constexpr uint32_t default_spin = 1 << 12;
+constexpr uint32_t default_sleep_ns = 50'000;
+
+#define DEF_RING_OPS(name, T) \
+  bool name##Push(name##ring_t *r, T const *v) { \
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed); \
+    uint64_t t = atomic_load_explicit(&r->tail, memory_order_acquire); \
+    if (h - t == ring_size) return false; \
+    r->slots[h & (ring_size - 1)] = *v; \
+    atomic_store_explicit(&r->head, h + 1, memory_order_release); \
+    return true; \
+  } \
+  bool name##Pop(name##ring_t *r, T *v) { \
+    uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed); \
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_acquire); \
+    if (t == h) return false; \
+    *v = r->slots[t & (ring_size - 1)]; \
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release); \
+    return true; \
+  }
+DEF_RING_OPS(req, shmreq_t)
+DEF_RING_OPS(res, shmres_t)
+
+//! @brief Evaluation state private to the consumer
+typedef struct {
+  machine_t ei;
+  uint32_t gen[shm_expr_n]; // generation the compiled entry was built from
+  char compiled[shm_expr_n][buf_size];
+  jitexpr_t jit[shm_expr_n]; // expr is nullptr until first use
+} shmctx_t;
+
+/**
+ * @brief Copy exprs[id] as of one generation, retrying while the producer
+ *        rewrites it (seqlock, gen is odd during a write)
+ * @return The generation copied
+ */
+static uint32_t readExpr(shmseg_t *seg, uint32_t id, char *buf) {
+  for (;;) {
+    uint32_t gen = atomic_load_explicit(seg->gen + id, memory_order_acquire);
+    if (gen & 1) continue;
+    memcpy(buf, seg->exprs[id], buf_size);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(seg->gen + id, memory_order_relaxed) == gen)
+      return gen;
+  }
+}
+
+static jitexpr_t *getCompiled(shmseg_t *seg, shmctx_t *ctx, uint32_t id) {
+  uint32_t gen = atomic_load_explicit(seg->gen + id, memory_order_relaxed);
+  if (ctx->gen[id] != gen || ctx->jit[id].expr == nullptr) {
+    ctx->gen[id] = readExpr(seg, id, ctx->compiled[id]);
+    ctx->compiled[id][buf_size - 1] = '\0';
+    optexpr(ctx->compiled[id]);
+    jitFree(ctx->jit + id);
+    jitInit(ctx->jit + id, ctx->compiled[id]);
+  }
+  return ctx->jit + id;
+}
+
+//! @brief Polls since the last progress and the next sleep after them
+typedef struct {
+  uint32_t idle, sleep_ns, spin, sleep_max;
+} backoff_t;
+
+static backoff_t newBackoff(shmseg_t const *seg) {
+  return (backoff_t){
+    .sleep_ns = 1'000,
+    .spin = seg->spin ?: default_spin,
+    .sleep_max = seg->sleep_ns ?: default_sleep_ns,
+  };
+}
+
+//! @brief Spin for b->spin polls, then sleep twice as long each time
+static void backOff(backoff_t *b) {
+  if (++b->idle < b->spin) return;
+  nanosleep(&(struct timespec){.tv_nsec = b->sleep_ns}, nullptr);
+  b->sleep_ns = lesser(b->sleep_ns * 2, b->sleep_max);
+}
+
+static bool stopped(shmseg_t *seg) {
+  return atomic_load_explicit(&seg->stop, memory_order_relaxed);
+}
+
+/**
+ * @brief Push res, backing off while the producer leaves the ring full
+ * @return false if the producer sets stop first, dropping res
+ */
+static bool pushResult(shmseg_t *seg, shmres_t const *res) {
+  for (backoff_t b = newBackoff(seg); !resPush(&seg->res, res); backOff(&b))
+    if (stopped(seg)) return false;
+  return true;
+}
+
+/**
+ * @brief Evaluate every pending request
+ * @return Number of requests served
+ */
+static size_t drainRequests(shmseg_t *seg, shmctx_t *ctx) {
+  size_t n = 0;
+  for (shmreq_t req; reqPop(&seg->req, &req); n++) {
+    shmres_t res = {.seq = req.seq, .result = NAN};
+    if (req.id < shm_expr_n && req.argc <= arg_n) [[clang::likely]] {
+      real_t args[arg_n];
+      for (size_t i = 0; i < arg_n; i++)
+        args[arg_n - 1 - i] = (real_t){
+          .elem = {.real = i < req.argc ? req.args[i] : NAN},
+          .isnum = true
+        };
+      res.result =
+        jitEval(getCompiled(seg, ctx, req.id), &ctx->ei, args).elem.real;
+    }
+    if (!pushResult(seg, &res)) break;
+  }
+  return n;
+}
+
+static void initCtx(shmctx_t *ctx) {
+  initEvalinfo(&ctx->ei);
+  memset(ctx->gen, 0, sizeof ctx->gen);
+  memset(ctx->jit, 0, sizeof ctx->jit);
+}
+
+static void freeCtx(shmctx_t *ctx) {
+  for (size_t i = 0; i < shm_expr_n; i++) jitFree(ctx->jit + i);
+}
+
+/**
+ * @brief Busy-poll requests until the producer sets stop
+ */
+static void pollLoop(shmseg_t *seg) {
+  shmctx_t *ctx drop = palloc(sizeof(shmctx_t));
+  initCtx(ctx);
+  for (backoff_t b = newBackoff(seg); !stopped(seg);)
+    if (drainRequests(seg, ctx)) b = newBackoff(seg);
+    else backOff(&b);
+  freeCtx(ctx);
+}
+
+/**
+ * @brief Whether seg is ours, marking it so if it is fresh (all zero)
+ * @note A segment of another layout or version is left alone
+ */
+static bool claimSeg(shmseg_t *seg) {
+  if (seg->magic == shm_magic) return true;
+  unsigned char const *p = (unsigned char const *)seg;
+  for (size_t i = 0; i < sizeof(shmseg_t); i++)
+    if (p[i] != 0) return false;
+  seg->magic = shm_magic;
+  return true;
+}
+
+/**
+ * @brief Attach to (or create) a shared-memory segment and serve it
+ * @param[in] name POSIX shared-memory object name such as "/rpx"
+ */
+void shmServe(char const *name) {
+  int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) [[clang::unlikely]]
+    panic(ERR_CONNECTION_FAILURE, "%s ", name);
+  if (st.st_size == 0 && ftruncate(fd, sizeof(shmseg_t)) < 0)
+    [[clang::unlikely]] panic(ERR_CONNECTION_FAILURE, "%s ", name);
+  if (st.st_size != 0 && (size_t)st.st_size != sizeof(shmseg_t))
+    [[clang::unlikely]] panic(
+      ERR_CONNECTION_FAILURE, "%s: size is not %zu ", name, sizeof(shmseg_t)
+    );
+  shmseg_t *seg = mmap(
+    nullptr, sizeof(shmseg_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+  );
+  close(fd);
+  if (seg == MAP_FAILED) [[clang::unlikely]]
+    panic(ERR_CONNECTION_FAILURE, "%s ", name);
+  if (!claimSeg(seg)) [[clang::unlikely]]
+    panic(ERR_CONNECTION_FAILURE, "%s: not an rpx segment ", name);
+
+  pollLoop(seg);
+  munmap(seg, sizeof(shmseg_t));
+}
+
+//! @brief Producer side of the seqlock around exprs[id]
+[[gnu::nonnull]] static void
+registerExpr(shmseg_t *seg, uint32_t id, char const *expr) {
+  atomic_fetch_add_explicit(seg->gen + id, 1, memory_order_relaxed); // odd
+  atomic_thread_fence(memory_order_release);
+  strncpy(seg->exprs[id], expr, buf_size - 1);
+  atomic_fetch_add_explicit(seg->gen + id, 1, memory_order_release);
+}
+
+test (shm_ring) {
+  shmseg_t *seg drop = aligned_alloc(alignof(shmseg_t), sizeof(shmseg_t));
+  memset(seg, 0, sizeof(shmseg_t));
+  shmctx_t *ctx drop = palloc(sizeof(shmctx_t));
+  initCtx(ctx);
+  registerExpr(seg, 3, "$1 $2 *");
+
+  for (uint64_t i = 0; i < 3; i++) {
+    shmreq_t req = {.seq = i, .id = 3, .argc = 2, .args = {(double)i, 10}};
+    expect(reqPush(&seg->req, &req));
+  }
+  expecteq(3, drainRequests(seg, ctx));
+
+  shmres_t res;
+  for (uint64_t i = 0; i < 3; i++) {
+    expect(resPop(&seg->res, &res));
+    expecteq(i, res.seq);
+    expecteq(i * 10.0, res.result);
+  }
+  expect(!resPop(&seg->res, &res));
+
+  registerExpr(seg, 3, "$1 $2 +"); // re-registration
+  expect(reqPush(&seg->req, &(shmreq_t){.id = 3, .argc = 2, .args = {1, 2}}));
+  expecteq(1, drainRequests(seg, ctx));
+  expect(resPop(&seg->res, &res));
+  expecteq(3.0, res.result);
+  expecteq(4, (size_t)atomic_load(seg->gen + 3)); // even between writes
+
+  for (size_t i = 0; i < ring_size; i++) // nobody pops the results
+    expect(resPush(&seg->res, &(shmres_t){.seq = i}));
+  expect(reqPush(&seg->req, &(shmreq_t){.id = 3, .argc = 2, .args = {1, 2}}));
+  atomic_store(&seg->stop, true);
+  expecteq(0, drainRequests(seg, ctx)); // returns, dropping the result
+  freeCtx(ctx);
+
+  expect(!claimSeg(seg)); // written to without the magic
+  memset(seg, 0, sizeof(shmseg_t));
+  expect(claimSeg(seg));
+  expecteq(shm_magic, seg->magic);
+  expect(claimSeg(seg));
+}
+
+#ifdef BENCHMARK_MODE
+static void *benchConsumer(void *arg) {
+  pollLoop(arg);
+  return nullptr;
+}
+
+//! @brief Round trip of a request through the rings to a consumer thread
+bench (shm_latency) {
+  static shmseg_t *seg;
+  static uint64_t seq;
+  if (seg == nullptr) {
+    seg = aligned_alloc(alignof(shmseg_t), sizeof(shmseg_t));
+    memset(seg, 0, sizeof(shmseg_t));
+    seg->spin = ~0U; // never sleep
+    registerExpr(seg, 0, "$1 $2 * 1 +");
+    pthread_t th;
+    pthread_create(&th, nullptr, benchConsumer, seg);
+    pthread_detach(th);
+  }
+  shmreq_t req = {.seq = seq, .id = 0, .argc = 2, .args = {(double)seq, 2}};
+  shmres_t res;
+  seq++;
+  while (!reqPush(&seg->req, &req));
+  while (!resPop(&seg->res, &res));
+}
+#endif
@@ -0,0 +1,233 @@
+/**
+ * @file src/solve.c
+ * @brief Define Brent's root finder and minimizer, and safeguarded Newton
+ */
+
+#include "solve.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "testing.h"
+#include <float.h>
+#include <math.h>
+
+static thread_local solvestat_t solve_stat;
+
+//! @brief Absolute tolerance of x, so that roots at 0 end too
+static double xtol(double a, double b) {
+  return DBL_EPSILON * (fabs(a) + fabs(b)) / 4;
+}
+
+static bool sameSign(double x, double y) {
+  return (0 < x) == (0 < y);
+}
+
+/**
+ * @brief Zero of f in [a, b] by Brent's method (zeroin)
+ * @return NaN unless f(a) and f(b) differ in sign
+ */
+double solveBrent(solvefn_t f, void *ctx, double a, double b) {
+  solve_stat = (solvestat_t){.method = "brent", .evals = 2};
+  double fa = f(ctx, a), fb = f(ctx, b), t = xtol(a, b);
+  if (fa == 0 || fb == 0) {
+    solve_stat.converged = true;
+    return fa == 0 ? a : b;
+  }
+  if (isnan(fa) || isnan(fb) || sameSign(fa, fb)) return NAN;
+  double c = a, fc = fa, d = b - a, e = d;
+  for (; solve_stat.iters < solve_max_iter; solve_stat.iters++) {
+    if (fabs(fc) < fabs(fb)) {
+      a = b;
+      b = c;
+      c = a;
+      fa = fb;
+      fb = fc;
+      fc = fa;
+    }
+    double tol = 2 * DBL_EPSILON * fabs(b) + t, m = (c - b) / 2;
+    if (fabs(m) <= tol || fb == 0) {
+      solve_stat.converged = true;
+      break;
+    }
+    if (fabs(e) < tol || fabs(fa) <= fabs(fb)) d = e = m; // bisection
+    else {
+      double s = fb / fa, p, q;
+      if (a == c) { // secant
+        p = 2 * m * s;
+        q = 1 - s;
+      } else { // inverse quadratic interpolation
+        double r = fb / fc;
+        q = fa / fc;
+        p = s * (2 * m * q * (q - r) - (b - a) * (r - 1));
+        q = (q - 1) * (r - 1) * (s - 1);
+      }
+      if (0 < p) q = -q;
+      else p = -p;
+      if (2 * p < 3 * m * q - fabs(tol * q) && p < fabs(e * q / 2)) {
+        e = d;
+        d = p / q;
+      } else d = e = m;
+    }
+    a = b;
+    fa = fb;
+    b += tol < fabs(d) ? d : 0 < m ? tol : -tol;
+    fb = f(ctx, b);
+    solve_stat.evals++;
+    if (sameSign(fb, fc)) {
+      c = a;
+      fc = fa;
+      d = e = b - a;
+    }
+  }
+  return b;
+}
+
+/**
+ * @brief Zero of f in [a, b] by Newton's method, bisecting when a step
+ *        leaves the bracket or does not halve it
+ * @param[in] f Value and derivative, one evaluation each step
+ * @return NaN unless f(a) and f(b) differ in sign
+ */
+double solveNewton(solvedfn_t f, void *ctx, double a, double b) {
+  solve_stat = (solvestat_t){.method = "newton", .evals = 2};
+  double fa = f(ctx, a).v, fb = f(ctx, b).v, t = xtol(a, b);
+  if (fa == 0 || fb == 0) {
+    solve_stat.converged = true;
+    return fa == 0 ? a : b;
+  }
+  if (isnan(fa) || isnan(fb) || sameSign(fa, fb)) return NAN;
+  double lo = fa < 0 ? a : b, hi = fa < 0 ? b : a; // f(lo) < 0 < f(hi)
+  double x = (a + b) / 2, dx = fabs(b - a), dxold = dx;
+  dual_t y = f(ctx, x);
+  solve_stat.evals++;
+  for (; solve_stat.iters < solve_max_iter; solve_stat.iters++) {
+    if (y.v == 0) {
+      solve_stat.converged = true;
+      break;
+    }
+    if (0 < ((x - hi) * y.d - y.v) * ((x - lo) * y.d - y.v)
+        || fabs(dxold * y.d) < fabs(2 * y.v)) {
+      dxold = dx;
+      dx = (hi - lo) / 2;
+      x = lo + dx;
+    } else {
+      dxold = dx;
+      dx = y.v / y.d;
+      x -= dx;
+    }
+    if (fabs(dx) <= 2 * DBL_EPSILON * fabs(x) + t) {
+      solve_stat.converged = true;
+      break;
+    }
+    y = f(ctx, x);
+    solve_stat.evals++;
+    if (y.v < 0) lo = x;
+    else hi = x;
+  }
+  return x;
+}
+
+/**
+ * @brief Local minimum of f in [a, b] by Brent's method (fmin)
+ * @return x at the minimum, to about sqrt(DBL_EPSILON) relative
+ */
+double solveMin(solvefn_t f, void *ctx, double a, double b) {
+  solve_stat = (solvestat_t){.method = "minimum", .evals = 1};
+  if (b < a) {
+    double s = a;
+    a = b;
+    b = s;
+  }
+  double const golden = (3 - sqrt(5.0)) / 2, t = xtol(a, b);
+  double x = a + golden * (b - a), w = x, v = x, d = 0, e = 0;
+  double fx = f(ctx, x), fw = fx, fv = fx;
+  for (; solve_stat.iters < solve_max_iter; solve_stat.iters++) {
+    double xm = (a + b) / 2, tol = sqrt(DBL_EPSILON) * fabs(x) + t;
+    if (fabs(x - xm) <= 2 * tol - (b - a) / 2) {
+      solve_stat.converged = true;
+      break;
+    }
+    bool parabola = tol < fabs(e);
+    if (parabola) {
+      double r = (x - w) * (fx - fv), q = (x - v) * (fx - fw);
+      double p = (x - v) * q - (x - w) * r;
+      q = 2 * (q - r);
+      if (0 < q) p = -p;
+      else q = -q;
+      r = e;
+      e = d;
+      parabola = fabs(p) < fabs(q * r / 2) && q * (a - x) < p
+              && p < q * (b - x);
+      if (parabola) {
+        d = p / q;
+        if (x + d - a < 2 * tol || b - x - d < 2 * tol)
+          d = x < xm ? tol : -tol;
+      }
+    }
+    if (!parabola) { // golden section into the larger part
+      e = (xm <= x ? a : b) - x;
+      d = golden * e;
+    }
+    double u = x + (tol <= fabs(d) ? d : 0 < d ? tol : -tol), fu = f(ctx, u);
+    solve_stat.evals++;
+    if (fu <= fx) {
+      if (x <= u) a = x;
+      else b = x;
+      v = w;
+      fv = fw;
+      w = x;
+      fw = fx;
+      x = u;
+      fx = fu;
+    } else {
+      if (u < x) a = u;
+      else b = u;
+      if (fu <= fw || w == x) {
+        v = w;
+        fv = fw;
+        w = u;
+        fw = fu;
+      } else if (fu <= fv || v == x || v == w) {
+        v = u;
+        fv = fu;
+      }
+    }
+  }
+  return x;
+}
+
+solvestat_t solveStat(void) {
+  return solve_stat;
+}
+
+static double cubic(void *ctx, double x) {
+  _ = ctx;
+  return (x * x - 2) * x - 5;
+}
+
+static dual_t cubicDual(void *ctx, double x) {
+  _ = ctx;
+  return (dual_t){cubic(ctx, x), 3 * x * x - 2};
+}
+
+static double cosOf(void *ctx, double x) {
+  _ = ctx;
+  return cos(x);
+}
+
+test (solve) {
+  double root = 2.0945514815423265;
+  expecteq(root, solveBrent(cubic, nullptr, 2, 3));
+  expecteq(true, solveStat().converged);
+  size_t brent = solveStat().evals;
+  expecteq(root, solveNewton(cubicDual, nullptr, 3, 2));
+  expecteq(true, solveStat().evals <= brent);
+  expecteq(3.14159265358979323846 / 2, solveBrent(cosOf, nullptr, 0, 2));
+  expecteq(true, isnan(solveNewton(cubicDual, nullptr, 2.5, 3))); // no change
+  expecteq(false, solveStat().converged);
+  expecteq(3.14159265358979323846, solveMin(cosOf, nullptr, 4, 2));
+  expecteq(true, solveStat().converged);
+}
+
+bench (solve_brent) {
+  solveBrent(cubic, nullptr, 2, 3);
+}
@@ -0,0 +1,153 @@
+/**
+ * @file src/thpool.c
+ * @brief Define fixed-size worker pool
+ */
+
+#include "thpool.h"
+#include "chore.h"
+#include "errcode.h"
+#include "rand.h"
+#include "testing.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+constexpr size_t job_init_cap = 64;
+
+static void *worker(void *arg) {
+  thpool_t *pool = arg;
+  initXorsh(); // thread_local, as @r is
+  for (;;) {
+    pthread_mutex_lock(&pool->mtx);
+    while (pool->len == 0 && !pool->stop)
+      pthread_cond_wait(&pool->hasjob, &pool->mtx);
+    if (pool->len == 0) { // stopped and drained
+      pthread_mutex_unlock(&pool->mtx);
+      return nullptr;
+    }
+    job_t job = pool->jobs[pool->head];
+    pool->head = (pool->head + 1) % pool->cap;
+    pool->len--;
+    pool->active++;
+    pthread_mutex_unlock(&pool->mtx);
+
+    job.fn(job.arg);
+
+    pthread_mutex_lock(&pool->mtx);
+    if (--pool->active == 0 && pool->len == 0)
+      pthread_cond_broadcast(&pool->idle);
+    pthread_mutex_unlock(&pool->mtx);
+  }
+}
+
+/**
+ * @brief Number of online processors
+ */
+size_t cpuCount() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n < 1 ? 1 : (size_t)n;
+}
+
+/**
+ * @brief Start a pool
+ * @param[in] nthreads Number of workers, 0 for one per processor
+ */
+thpool_t *thpoolNew(size_t nthreads) {
+  if (nthreads == 0) nthreads = cpuCount();
+  thpool_t *pool = palloc(sizeof(thpool_t) + nthreads * sizeof(pthread_t));
+  pthread_mutex_init(&pool->mtx, nullptr);
+  pthread_cond_init(&pool->hasjob, nullptr);
+  pthread_cond_init(&pool->idle, nullptr);
+  pool->jobs = zalloc(job_t, job_init_cap);
+  pool->cap = job_init_cap;
+  pool->head = pool->len = pool->active = 0;
+  pool->stop = false;
+  pool->nthreads = nthreads;
+  for (size_t i = 0; i < nthreads; i++)
+    if (pthread_create(pool->threads + i, nullptr, worker, pool))
+      [[clang::unlikely]] panic(ERR_ALLOCATION_FAILURE);
+  return pool;
+}
+
+static thpool_t *shared;
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+
+static void startShared(void) {
+  shared = thpoolNew(0);
+}
+
+/**
+ * @brief Pool shared by the evaluators of every thread, started on first
+ *        use and never freed
+ * @note Jobs must not wait on the pool themselves
+ */
+thpool_t *thpoolShared(void) {
+  pthread_once(&shared_once, startShared);
+  return shared;
+}
+
+/**
+ * @brief Grow the ring buffer, keeping the order of jobs
+ */
+static void growJobs(thpool_t *pool) {
+  job_t *jobs = zalloc(job_t, pool->cap * 2);
+  for (size_t i = 0; i < pool->len; i++)
+    jobs[i] = pool->jobs[(pool->head + i) % pool->cap];
+  free(pool->jobs);
+  pool->jobs = jobs;
+  pool->head = 0;
+  pool->cap *= 2;
+}
+
+/**
+ * @brief Queue fn(arg) to be run by a worker
+ */
+void thpoolSubmit(thpool_t *pool, void (*fn)(void *), void *arg) {
+  pthread_mutex_lock(&pool->mtx);
+  if (pool->len == pool->cap) growJobs(pool);
+  pool->jobs[(pool->head + pool->len++) % pool->cap] = (job_t){fn, arg};
+  pthread_cond_signal(&pool->hasjob);
+  pthread_mutex_unlock(&pool->mtx);
+}
+
+/**
+ * @brief Block until every submitted job has finished
+ */
+void thpoolWait(thpool_t *pool) {
+  pthread_mutex_lock(&pool->mtx);
+  while (pool->len != 0 || pool->active != 0)
+    pthread_cond_wait(&pool->idle, &pool->mtx);
+  pthread_mutex_unlock(&pool->mtx);
+}
+
+/**
+ * @brief Finish queued jobs, join workers and release the pool
+ */
+void thpoolFree(thpool_t *pool) {
+  pthread_mutex_lock(&pool->mtx);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->hasjob);
+  pthread_mutex_unlock(&pool->mtx);
+  for (size_t i = 0; i < pool->nthreads; i++)
+    pthread_join(pool->threads[i], nullptr);
+  pthread_mutex_destroy(&pool->mtx);
+  pthread_cond_destroy(&pool->hasjob);
+  pthread_cond_destroy(&pool->idle);
+  free(pool->jobs);
+  free(pool);
+}
+
+static void incr(void *arg) {
+  atomic_fetch_add((atomic_int *)arg, 1);
+}
+
+test (thpool) {
+  atomic_int cnt = 0;
+  thpool_t *pool = thpoolNew(4);
+  for (int i = 0; i < 1000; i++) thpoolSubmit(pool, incr, &cnt);
+  thpoolWait(pool);
+  expecteq(1000, atomic_load(&cnt));
+  for (int i = 0; i < 10; i++) thpoolSubmit(pool, incr, &cnt);
+  thpoolFree(pool);
+  expecteq(1010, atomic_load(&cnt));
+}
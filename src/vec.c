@@ -0,0 +1,830 @@
+/**
+ * @file src/vec.c
+ * @brief Define vector allocation and elementwise kernels
+ *
+ * Kernels run four lanes at a time through GNU vector types, which lower
+ * to SSE2/AVX, and finish the remainder with scalar code. Lazy vectors run
+ * the same kernels over L1-sized chunks.
+ */
+
+#include "vec.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "error.h"
+#include "errcode.h"
+#include "lambda.h"
+#include "testing.h"
+#include "thpool.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr size_t lanes = 4;
+constexpr size_t load_bufsize = 1 << 16;
+constexpr size_t chunk_len = 1 << 13; // elements per job of vm, vf and vr
+constexpr size_t wave_n = 16;         // jobs in flight over one vector
+
+typedef enum {
+  SEQ_RANGE, // a + i * step
+  SEQ_MAP,   // fn of src
+  SEQ_LMD,   // lmd of src
+  SEQ_ZIP,   // lhs op rhs, either of which may be a scalar
+} seqkind_t;
+
+//! @brief Recipe of a lazy vector, run a chunk at a time by fillChunk
+struct seq {
+  seqkind_t kind;
+  bool serial; // interprets a lambda somewhere, so stays off the pool
+  double a, step;
+  vec_t const *src;
+  double (*fn)(double);
+  lambda_t const *lmd;
+  machine_t *ei; // scratch machine, nullptr when lmd is compiled
+  vecop_t op;
+  real_t lhs, rhs;
+};
+
+typedef enum {
+  HOF_MAP,
+  HOF_FILTER,
+  HOF_FOLD,
+  HOF_SUM, // compensated sum of the mapped elements
+} hof_t;
+
+//! @brief Slice of a higher-order operation, run by one job
+typedef struct {
+  hof_t op;
+  lambda_t const *lmd;
+  machine_t *ei; // scratch machine, nullptr when lmd is compiled
+  vec_t const *src;
+  size_t off, n;
+  double const *xs; // elements off..off+n of src
+  double *buf;      // where xs is computed when src is lazy
+  double *out;      // mapped or kept elements, nullptr for folds
+  size_t kept;
+  double acc;  // accumulator of folds, starting at xs[0] unless seeded
+  double comp; // rounding error of acc for HOF_SUM
+  bool seeded;
+} chunk_t;
+
+typedef double [[gnu::vector_size(lanes * sizeof(double))]] vd_t;
+
+static thread_local vec_t *temps;
+
+vec_t *vecNew(size_t len) {
+  size_t size = sizeof(vec_t) + len * sizeof(double);
+  size += -size % alignof(vec_t);
+  vec_t *v = aligned_alloc(alignof(vec_t), size);
+  if (v == nullptr) [[clang::unlikely]]
+    panic(ERR_ALLOCATION_FAILURE);
+  *v = (vec_t){.next = temps, .len = len, .pinned = false, .seq = nullptr};
+  temps = v;
+  return v;
+}
+
+//! @brief Lazy vector of len elements, owning a copy of s
+static vec_t *newSeq(size_t len, struct seq s) {
+  vec_t *v = vecNew(0);
+  v->len = len;
+  v->seq = palloc(sizeof(struct seq));
+  *v->seq = s;
+  return v;
+}
+
+static bool isVec(real_t x) {
+  return !x.isnum && x.isvec;
+}
+
+static bool isSerial(real_t x) {
+  return isVec(x) && x.elem.vec->seq != nullptr && x.elem.vec->seq->serial;
+}
+
+//! @brief Lambdas in a frame of vectors count as NaN
+static double scalarOf(real_t x) {
+  return x.isnum ? x.elem.real : NAN;
+}
+
+static double rangeLen(double a, double b) {
+  return isfinite(a) ? floor(fabs(b - a)) + 1 : NAN;
+}
+
+/**
+ * @brief a, a+1, ..., up to b (or down to b when b < a)
+ * @return nullptr if the range is not finite or longer than vec_max
+ */
+vec_t *vecRange(double a, double b) {
+  double n = rangeLen(a, b);
+  if (!isfinite(n) || vec_max < n) return nullptr;
+  vec_t *v = vecNew((size_t)n);
+  double step = a <= b ? 1 : -1;
+  for (size_t i = 0; i < v->len; i++) v->data[i] = a + (double)i * step;
+  return v;
+}
+
+/**
+ * @brief vecRange that computes its elements when they are consumed
+ * @return nullptr if the range is not finite or longer than 2^53
+ */
+vec_t *vecLazyRange(double a, double b) {
+  double n = rangeLen(a, b);
+  if (!isfinite(n) || seq_max < n) return nullptr;
+  struct seq s = {.kind = SEQ_RANGE, .a = a, .step = a <= b ? 1 : -1};
+  return newSeq((size_t)n, s);
+}
+
+//! @brief Parse every number in s into xs (nullable), skipping the rest
+static size_t parseNums(char const *s, double *xs) {
+  size_t n = 0;
+  for (char *next; *s; s = next) {
+    double x = strtod(s, &next);
+    if (next == s) next++;
+    else if (xs == nullptr) n++;
+    else xs[n++] = x;
+  }
+  return n;
+}
+
+/**
+ * @brief Read every number in a file, skipping anything else
+ * @param[in] path Numbers separated by commas, semicolons or spaces
+ * @return nullptr if the file cannot be opened
+ */
+vec_t *vecLoad(char const *path) {
+  FILE *fp dropfile = fopen(path, "r");
+  if (fp == nullptr) return nullptr;
+  size_t len = 0, cap = load_bufsize;
+  char *buf drop = zalloc(char, cap + 1);
+  for (size_t n; (n = fread(buf + len, 1, cap - len, fp)) != 0;) {
+    if ((len += n) < cap) continue;
+    char *grown = zalloc(char, cap * 2 + 1);
+    memcpy(grown, buf, len);
+    free(buf);
+    buf = grown;
+    cap *= 2;
+  }
+  buf[len] = '\0';
+  vec_t *v = vecNew(parseNums(buf, nullptr));
+  parseNums(buf, v->data);
+  return v;
+}
+
+/**
+ * @brief Keep v, and the vectors a lazy v is computed from, alive after
+ *        the thread's next evaluation starts
+ */
+void vecPin(vec_t *v) {
+  v->pinned = true;
+  struct seq const *s = v->seq;
+  if (s == nullptr) return;
+  if (s->src != nullptr) vecPin((vec_t *)s->src);
+  if (isVec(s->lhs)) vecPin(s->lhs.elem.vec);
+  if (isVec(s->rhs)) vecPin(s->rhs.elem.vec);
+}
+
+//! @brief Free the temporaries of the calling thread
+void vecRelease(void) {
+  for (vec_t *v = temps, *next; v != nullptr; v = next) {
+    next = v->next;
+    if (v->pinned) continue;
+    if (v->seq != nullptr) free(v->seq->ei);
+    free(v->seq);
+    free(v);
+  }
+  temps = nullptr;
+}
+
+// lanes at a time through memcpy, which keeps the loads unaligned-safe
+#define DEF_ZIP(name, op) \
+  static void name##VV( \
+    double *restrict acc, double const *restrict x, size_t n \
+  ) { \
+    size_t i = 0; \
+    for (vd_t a, b; i + lanes <= n; i += lanes) { \
+      memcpy(&a, acc + i, sizeof a); \
+      memcpy(&b, x + i, sizeof b); \
+      a = a op b; \
+      memcpy(acc + i, &a, sizeof a); \
+    } \
+    for (; i < n; i++) acc[i] = acc[i] op x[i]; \
+  } \
+  static void name##VS(double *restrict acc, double x, size_t n) { \
+    vd_t b = {x, x, x, x}; \
+    size_t i = 0; \
+    for (vd_t a; i + lanes <= n; i += lanes) { \
+      memcpy(&a, acc + i, sizeof a); \
+      a = a op b; \
+      memcpy(acc + i, &a, sizeof a); \
+    } \
+    for (; i < n; i++) acc[i] = acc[i] op x; \
+  }
+DEF_ZIP(add, +)
+DEF_ZIP(sub, -)
+DEF_ZIP(mul, *)
+DEF_ZIP(div, /)
+
+//! @brief acc[i] op= xs[i], or op= s where xs is nullptr
+static void zip(
+  vecop_t op, double *restrict acc, double const *restrict xs, double s,
+  size_t n
+) {
+  switch (op) {
+  case VOP_ADD:
+    if (xs) addVV(acc, xs, n);
+    else addVS(acc, s, n);
+    break;
+  case VOP_SUB:
+    if (xs) subVV(acc, xs, n);
+    else subVS(acc, s, n);
+    break;
+  case VOP_MUL:
+    if (xs) mulVV(acc, xs, n);
+    else mulVS(acc, s, n);
+    break;
+  case VOP_DIV:
+    if (xs) divVV(acc, xs, n);
+    else divVS(acc, s, n);
+    break;
+  case VOP_POW:
+    if (xs == nullptr && s == 2)
+      for (size_t i = 0; i < n; i++) acc[i] *= acc[i];
+    else
+      for (size_t i = 0; i < n; i++) acc[i] = pow(acc[i], xs ? xs[i] : s);
+    break;
+  case VOP_MOD:
+    for (size_t i = 0; i < n; i++) acc[i] = fmod(acc[i], xs ? xs[i] : s);
+    break;
+  default:
+    [[clang::unlikely]];
+  }
+}
+
+static void fillChunk(vec_t const *, size_t, size_t, double *);
+
+//! @brief Elements of x from off, or x itself if it is a scalar
+static void fillOperand(real_t x, size_t off, size_t n, double *out) {
+  if (isVec(x)) fillChunk(x.elem.vec, off, n, out);
+  else
+    for (size_t i = 0; i < n; i++) out[i] = scalarOf(x);
+}
+
+//! @brief vecRead of at most vec_chunk elements
+static void fillChunk(vec_t const *v, size_t off, size_t n, double *out) {
+  struct seq const *s = v->seq;
+  if (s == nullptr) {
+    memcpy(out, v->data + off, n * sizeof(double));
+    return;
+  }
+  switch (s->kind) {
+  case SEQ_RANGE:
+    for (size_t i = 0; i < n; i++) out[i] = s->a + (double)(off + i) * s->step;
+    break;
+  case SEQ_MAP:
+    fillChunk(s->src, off, n, out);
+    for (size_t i = 0; i < n; i++) out[i] = s->fn(out[i]);
+    break;
+  case SEQ_LMD:
+    fillChunk(s->src, off, n, out);
+    callLmdEach(s->ei, s->lmd, out, n, out);
+    break;
+  case SEQ_ZIP: {
+    fillOperand(s->lhs, off, n, out);
+    if (!isVec(s->rhs)) {
+      zip(s->op, out, nullptr, scalarOf(s->rhs), n);
+      break;
+    }
+    double rhs[vec_chunk];
+    fillChunk(s->rhs.elem.vec, off, n, rhs);
+    zip(s->op, out, rhs, 0, n);
+  } break;
+  default:
+    [[clang::unlikely]];
+  }
+}
+
+/**
+ * @brief Copy elements off..off+n of v, computing them if v is lazy
+ * @param[out] out n elements
+ */
+void vecRead(vec_t const *v, size_t off, size_t n, double *out) {
+  for (size_t i = 0; i < n; i += vec_chunk)
+    fillChunk(v, off + i, lesser(vec_chunk, n - i), out + i);
+}
+
+static double sumOf(double const *xs, size_t n) {
+  vd_t acc = {};
+  size_t i = 0;
+  for (vd_t x; i + lanes <= n; i += lanes) {
+    memcpy(&x, xs + i, sizeof x);
+    acc += x;
+  }
+  double s = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+  for (; i < n; i++) s += xs[i];
+  return s;
+}
+
+//! @brief s += x, returning the rounding error (Knuth's TwoSum)
+static double twoSum(double *s, double x) {
+#pragma clang fp reassociate(off)
+  double t = *s + x, z = t - *s, err = (*s - (t - z)) + (x - z);
+  *s = t;
+  return err;
+}
+
+/**
+ * @brief Sum of xs with the rounding error of every addition kept apart,
+ *        lane by lane like sumOf
+ * @param[out] err What the returned sum lacks
+ */
+static double compSumOf(double const *xs, size_t n, double *err) {
+#pragma clang fp reassociate(off)
+  vd_t acc = {}, lo = {};
+  size_t i = 0;
+  for (vd_t x; i + lanes <= n; i += lanes) {
+    memcpy(&x, xs + i, sizeof x);
+    vd_t t = acc + x, z = t - acc;
+    lo += (acc - (t - z)) + (x - z);
+    acc = t;
+  }
+  double s = 0;
+  *err = 0;
+  for (size_t j = 0; j < lanes; j++) *err += twoSum(&s, acc[j]) + lo[j];
+  for (; i < n; i++) *err += twoSum(&s, xs[i]);
+  return s;
+}
+
+static double productOf(double const *xs, size_t n) {
+  vd_t acc = {1, 1, 1, 1};
+  size_t i = 0;
+  for (vd_t x; i + lanes <= n; i += lanes) {
+    memcpy(&x, xs + i, sizeof x);
+    acc *= x;
+  }
+  double p = (acc[0] * acc[1]) * (acc[2] * acc[3]);
+  for (; i < n; i++) p *= xs[i];
+  return p;
+}
+
+//! @brief Sum or product of the elements from the from-th on
+static double foldFrom(vecop_t op, vec_t const *v, size_t from) {
+  double (*f)(double const *, size_t) = op == VOP_ADD ? sumOf : productOf;
+  if (v->seq == nullptr) return f(v->data + from, v->len - from);
+  double buf[vec_chunk], acc = op == VOP_ADD ? 0 : 1;
+  for (size_t off = from; off < v->len; off += vec_chunk) {
+    size_t n = lesser(vec_chunk, v->len - off);
+    fillChunk(v, off, n, buf);
+    acc = op == VOP_ADD ? acc + f(buf, n) : acc * f(buf, n);
+  }
+  return acc;
+}
+
+//! @brief Fold pow or fmod from the last element down to the first
+static double foldBack(vecop_t op, vec_t const *v) {
+  double buf[vec_chunk], acc;
+  vecRead(v, 0, 1, &acc);
+  for (size_t end = v->len; 1 < end;) {
+    size_t n = lesser(vec_chunk, end - 1);
+    fillChunk(v, end -= n, n, buf);
+    for (size_t i = n; i-- > 0;)
+      acc = op == VOP_POW ? pow(acc, buf[i]) : fmod(acc, buf[i]);
+  }
+  return acc;
+}
+
+//! @brief The frame fold of the elements of v, as if each were an operand
+static double reduce(vecop_t op, vec_t const *v) {
+  if (v->len == 0) return NAN;
+  double first;
+  vecRead(v, 0, 1, &first);
+  switch (op) {
+  case VOP_ADD:
+  case VOP_MUL:
+    return foldFrom(op, v, 0);
+  case VOP_SUB:
+    return first - foldFrom(VOP_ADD, v, 1);
+  case VOP_DIV:
+    return first / foldFrom(VOP_MUL, v, 1);
+  case VOP_POW:
+  case VOP_MOD:
+    return foldBack(op, v);
+  default:
+    [[clang::unlikely]];
+  }
+  return NAN;
+}
+
+/**
+ * @brief Fold a frame holding vectors
+ * @param[in] xs Frame from bottom to top, folded from the top like scalars
+ * @return A single vector is reduced to a scalar, otherwise scalars are
+ *         broadcast and vectors combined elementwise, lazily if one of
+ *         them is lazy; NaN on a length mismatch
+ */
+real_t vecFold(vecop_t op, real_t const *xs, size_t n) {
+  size_t len = 0;
+  bool hasvec = false, lazy = false;
+  for (size_t i = 0; i < n; i++) {
+    if (!isVec(xs[i])) continue;
+    if (hasvec && xs[i].elem.vec->len != len) {
+      dispErr(__FUNCTION__, "%s", codetomsg(ERR_DIMENTION_MISMATCH));
+      return (real_t){.elem = {.real = NAN}, .isnum = true};
+    }
+    len = xs[i].elem.vec->len;
+    hasvec = true;
+    lazy = lazy || xs[i].elem.vec->seq != nullptr;
+  }
+  if (n == 1 && hasvec)
+    return (real_t){.elem = {.real = reduce(op, xs->elem.vec)}, .isnum = true};
+
+  if (lazy) {
+    real_t acc = *xs;
+    for (size_t i = n - 1; i > 0; i--) {
+      struct seq s = {
+        .kind = SEQ_ZIP,
+        .serial = isSerial(acc) || isSerial(xs[i]),
+        .op = op,
+        .lhs = acc,
+        .rhs = xs[i]
+      };
+      acc = (real_t){
+        .elem = {.vec = newSeq(len, s)}, .isnum = false, .isvec = true
+      };
+    }
+    return acc;
+  }
+
+  vec_t *v = vecNew(len);
+  fillOperand(*xs, 0, len, v->data);
+  for (size_t i = n - 1; i > 0; i--)
+    zip(
+      op,
+      v->data,
+      isVec(xs[i]) ? xs[i].elem.vec->data : nullptr,
+      scalarOf(xs[i]),
+      len
+    );
+  return (real_t){.elem = {.vec = v}, .isnum = false, .isvec = true};
+}
+
+//! @brief f of every element of v, lazily if v is lazy
+vec_t *vecMap(vec_t const *v, double (*f)(double)) {
+  if (v->seq != nullptr) {
+    struct seq s = {
+      .kind = SEQ_MAP, .serial = v->seq->serial, .src = v, .fn = f
+    };
+    return newSeq(v->len, s);
+  }
+  vec_t *w = vecNew(v->len);
+  for (size_t i = 0; i < v->len; i++) w->data[i] = f(v->data[i]);
+  return w;
+}
+
+//! @brief Largest (or smallest) element, NaN only if every element is
+double vecExtreme(vec_t const *v, bool max) {
+  double buf[vec_chunk], acc = NAN;
+  for (size_t off = 0; off < v->len; off += vec_chunk) {
+    size_t n = lesser(vec_chunk, v->len - off);
+    double const *xs = buf;
+    if (v->seq == nullptr) xs = v->data + off;
+    else fillChunk(v, off, n, buf);
+    for (size_t i = 0; i < n; i++)
+      acc = max ? fmax(acc, xs[i]) : fmin(acc, xs[i]);
+  }
+  return acc;
+}
+
+static void runChunk(void *arg) {
+  chunk_t *c = arg;
+  if (c->src->seq != nullptr) {
+    vecRead(c->src, c->off, c->n, c->buf);
+    c->xs = c->buf;
+  }
+  if (c->op == HOF_MAP || c->op == HOF_SUM) {
+    double *out = c->op == HOF_MAP ? c->out : c->buf;
+    callLmdEach(c->ei, c->lmd, c->xs, c->n, out);
+    if (c->op == HOF_SUM) c->acc = compSumOf(out, c->n, &c->comp);
+    return;
+  }
+  double argv[arg_n] = {};
+  size_t i = 0;
+  if (c->op == HOF_FOLD && !c->seeded && c->n != 0) c->acc = c->xs[i++];
+  for (; i < c->n; i++) {
+    argv[0] = c->xs[i];
+    switch (c->op) {
+    case HOF_FILTER:
+      if (!isnan(callLmd(c->ei, c->lmd, argv))) c->out[c->kept++] = c->xs[i];
+      break;
+    case HOF_FOLD:
+      argv[1] = c->acc;
+      c->acc = callLmd(c->ei, c->lmd, argv);
+      break;
+    case HOF_MAP:
+    case HOF_SUM:
+    default:
+      [[clang::unlikely]];
+    }
+  }
+}
+
+static size_t chunkCount(size_t len) {
+  return (len + chunk_len - 1) / chunk_len;
+}
+
+//! @brief Run cs[0..n), on the pool unless one of them interprets a lambda
+static void runWave(chunk_t *cs, size_t n) {
+  bool serial = cs->ei != nullptr || (cs->src->seq && cs->src->seq->serial);
+  if (serial || n < 2) {
+    for (size_t i = 0; i < n; i++) runChunk(cs + i);
+    return;
+  }
+  thpool_t *pool = thpoolShared();
+  for (size_t i = 0; i < n; i++) thpoolSubmit(pool, runChunk, cs + i);
+  thpoolWait(pool);
+}
+
+/**
+ * @brief Run l over v, wave_n chunks at a time, and hand the finished
+ *        chunks to done in order
+ * @param[in] m Scratch machine from newScratch
+ * @param[out] out Mapped elements at their offsets, nullptr unless op is
+ *                 HOF_MAP
+ */
+static void forChunks(
+  hof_t op, machine_t *m, lambda_t const *l, vec_t const *v, double *out,
+  void (*done)(chunk_t const *, void *), void *ctx
+) {
+  chunk_t cs[wave_n];
+  size_t cap = bigger(lesser(v->len, wave_n * chunk_len), (size_t)1);
+  double *bufs drop = v->seq ? zalloc(double, cap) : nullptr;
+  double *kept drop = op == HOF_FILTER ? zalloc(double, cap) : nullptr;
+  for (size_t first = 0; first < chunkCount(v->len); first += wave_n) {
+    size_t n = lesser(wave_n, chunkCount(v->len) - first);
+    for (size_t i = 0; i < n; i++) {
+      size_t off = (first + i) * chunk_len;
+      cs[i] = (chunk_t){
+        .op = op,
+        .lmd = l,
+        .ei = m,
+        .src = v,
+        .off = off,
+        .n = lesser(chunk_len, v->len - off),
+        .xs = v->seq ? nullptr : v->data + off,
+        .buf = bufs ? bufs + i * chunk_len : nullptr,
+        .out = out ? out + off : kept ? kept + i * chunk_len : nullptr,
+      };
+    }
+    runWave(cs, n);
+    for (size_t i = 0; done && i < n; i++) done(cs + i, ctx);
+  }
+}
+
+/**
+ * @brief l($1 = x) for every element x of v, lazily if v is lazy
+ * @param[in] ei Machine whose registers interpreted calls see
+ */
+vec_t *vecMapLmd(machine_t *ei, lambda_t const *l, vec_t const *v) {
+  if (v->seq != nullptr) {
+    machine_t *m = newScratch(ei, l); // freed with the node
+    struct seq s = {
+      .kind = SEQ_LMD,
+      .serial = m != nullptr || v->seq->serial,
+      .src = v,
+      .lmd = l,
+      .ei = m
+    };
+    return newSeq(v->len, s);
+  }
+  machine_t *m drop = newScratch(ei, l);
+  vec_t *w = vecNew(v->len);
+  forChunks(HOF_MAP, m, l, v, w->data, nullptr, nullptr);
+  return w;
+}
+
+typedef struct {
+  double *xs;
+  size_t len, cap;
+} keptbuf_t;
+
+static void keep(chunk_t const *c, void *arg) {
+  keptbuf_t *k = arg;
+  if (c->kept == 0) return;
+  if (k->cap < k->len + c->kept) {
+    k->cap = bigger(k->cap * 2, k->len + c->kept);
+    double *xs = zalloc(double, k->cap);
+    if (k->len != 0) memcpy(xs, k->xs, k->len * sizeof(double));
+    free(k->xs);
+    k->xs = xs;
+  }
+  memcpy(k->xs + k->len, c->out, c->kept * sizeof(double));
+  k->len += c->kept;
+}
+
+/**
+ * @brief Elements x of v for which l($1 = x) is not NaN, in order
+ * @param[in] ei Machine whose registers interpreted calls see
+ */
+vec_t *vecFilter(machine_t *ei, lambda_t const *l, vec_t const *v) {
+  machine_t *m drop = newScratch(ei, l);
+  keptbuf_t k = {};
+  forChunks(HOF_FILTER, m, l, v, nullptr, keep, &k);
+  vec_t *w = vecNew(k.len);
+  if (k.len != 0) memcpy(w->data, k.xs, k.len * sizeof(double));
+  free(k.xs);
+  return w;
+}
+
+//! @brief Add the sum of a chunk and its error to the pair at arg
+static void addPartial(chunk_t const *c, void *arg) {
+  double *sum = arg;
+  sum[1] += twoSum(sum, c->acc) + c->comp;
+}
+
+/**
+ * @brief Sum of l($1 = k) for k = a, a+1, ..., b, with compensated
+ *        additions in a fixed order
+ * @param[in] ei Machine whose registers interpreted calls see
+ * @return 0 if b < a, NaN if the range is not finite or too long
+ */
+double vecSigma(machine_t *ei, lambda_t const *l, double a, double b) {
+  if (b < a) return 0;
+  vec_t *ks = vecLazyRange(a, b);
+  if (ks == nullptr) return NAN;
+  machine_t *m drop = newScratch(ei, l);
+  double sum[2] = {}; // value and its error
+  forChunks(HOF_SUM, m, l, ks, nullptr, addPartial, sum);
+  return sum[0] + sum[1];
+}
+
+//! @brief Partials not combined yet, at most one per power of 2 chunks
+typedef struct {
+  lambda_t const *lmd;
+  machine_t *ei;
+  double acc[64];
+  size_t level[64], n;
+} partials_t;
+
+//! @brief Fold the last two partials into one, the later one as $1
+static void combineTop(partials_t *p) {
+  double argv[arg_n] = {p->acc[p->n - 1], p->acc[p->n - 2]};
+  p->n--;
+  p->acc[p->n - 1] = callLmd(p->ei, p->lmd, argv);
+  p->level[p->n - 1]++;
+}
+
+/**
+ * @brief Add the partial of a chunk, combining equal-sized neighbours as
+ *        they appear; the tree is that of combining adjacent pairs, then
+ *        adjacent pairs of pairs, over all chunks at once
+ */
+static void pushPartial(chunk_t const *c, void *arg) {
+  partials_t *p = arg;
+  p->acc[p->n] = c->acc;
+  p->level[p->n++] = 0;
+  while (1 < p->n && p->level[p->n - 1] == p->level[p->n - 2]) combineTop(p);
+}
+
+/**
+ * @brief Whether the body is $1 $2 + or $1 $2 * in either order, the
+ *        folds whose partials may be combined in any grouping
+ */
+static bool isAssocBody(char const *body) {
+  char op[8];
+  size_t n = 0;
+  for (char const *c = body + (*body == '#'); *c != '\0'; c++) {
+    if (*c == ' ' || *c == '\t') continue;
+    if (n == sizeof op - 1) return false;
+    op[n++] = *c;
+  }
+  op[n] = '\0';
+  return strcmp(op, "$1$2+") == 0 || strcmp(op, "$2$1+") == 0
+      || strcmp(op, "$1$2*") == 0 || strcmp(op, "$2$1*") == 0;
+}
+
+/**
+ * @brief Fold v into init with acc = l($1 = x, $2 = acc)
+ * @param[in] ei Machine whose registers interpreted calls see
+ * @param[in] tree Fold each chunk in parallel, then combine the partials
+ *                 pairwise in a fixed order; ignored unless l is a sum or
+ *                 a product, since other bodies need not be associative
+ */
+double vecReduce(
+  machine_t *ei, lambda_t const *l, vec_t const *v, double init, bool tree
+) {
+  machine_t *m drop = newScratch(ei, l);
+  if (tree && isAssocBody(l->body)) {
+    if (v->len == 0) return init;
+    partials_t p = {.lmd = l, .ei = m, .n = 0};
+    forChunks(HOF_FOLD, m, l, v, nullptr, pushPartial, &p);
+    while (1 < p.n) combineTop(&p);
+    double argv[arg_n] = {p.acc[0], init};
+    return callLmd(m, l, argv);
+  }
+  double *buf drop = v->seq ? zalloc(double, chunk_len) : nullptr;
+  double acc = init;
+  for (size_t off = 0; off < v->len; off += chunk_len) {
+    chunk_t c = {
+      .op = HOF_FOLD,
+      .lmd = l,
+      .ei = m,
+      .src = v,
+      .off = off,
+      .n = lesser(chunk_len, v->len - off),
+      .xs = v->seq ? nullptr : v->data + off,
+      .buf = buf,
+      .acc = acc,
+      .seeded = true
+    };
+    runChunk(&c);
+    acc = c.acc;
+  }
+  return acc;
+}
+
+static real_t vecVal(vec_t *v) {
+  return (real_t){.elem = {.vec = v}, .isnum = false, .isvec = true};
+}
+
+static real_t num(double x) {
+  return (real_t){.elem = {.real = x}, .isnum = true};
+}
+
+test (vec_fold) {
+  vec_t *v = vecRange(1, 10);
+  expecteq(10, v->len);
+  expecteq(55.0, vecFold(VOP_ADD, (real_t[]){vecVal(v)}, 1).elem.real);
+  expecteq(3628800.0, vecFold(VOP_MUL, (real_t[]){vecVal(v)}, 1).elem.real);
+  expecteq(-53.0, vecFold(VOP_SUB, (real_t[]){vecVal(v)}, 1).elem.real);
+  real_t w = vecFold(VOP_MUL, (real_t[]){vecVal(v), num(2), vecVal(v)}, 3);
+  expecteq(true, w.isvec);
+  expecteq(200.0, w.elem.vec->data[9]);
+  w = vecFold(VOP_SUB, (real_t[]){num(1), vecVal(v)}, 2);
+  expecteq(-8.0, w.elem.vec->data[9]);
+  expecteq(7.0, vecRange(10, 1)->data[3]);
+  real_t bad[] = {vecVal(v), vecVal(vecRange(1, 3))};
+  expecteq(true, isnan(vecFold(VOP_ADD, bad, 2).elem.real));
+  vecRelease();
+}
+
+test (vec_lazy) {
+  vec_t *v = vecLazyRange(1, 1000);
+  expecteq(1000, v->len);
+  real_t sq = vecFold(VOP_POW, (real_t[]){vecVal(v), num(2)}, 2);
+  expecteq(true, sq.elem.vec->seq != nullptr);
+  real_t diff = vecFold(VOP_SUB, (real_t[]){sq, vecVal(vecRange(1, 1000))}, 2);
+  double x;
+  vecRead(diff.elem.vec, 999, 1, &x);
+  expecteq(999000.0, x);
+  expecteq(333833500.0, vecFold(VOP_ADD, &sq, 1).elem.real);
+  expecteq(-333833498.0, vecFold(VOP_SUB, &sq, 1).elem.real);
+  expecteq(1.0, vecExtreme(vecMap(v, sqrt), false));
+  expecteq(true, vecLazyRange(0, 1e300) == nullptr);
+  vecRelease();
+}
+
+test (vec_sigma) {
+  double err, xs[] = {1e100, 1, -1e100, 0.5, 0.25};
+  expecteq(0.0, compSumOf(xs, 3, &err));
+  expecteq(1.0, err);
+  expecteq(0.75, compSumOf(xs + 3, 2, &err));
+  machine_t ei;
+  initEvalinfo(&ei);
+  lambda_t const *l = lmdIntern("$1", 2);
+  expecteq(200010000.0, vecSigma(&ei, l, 1, 20000));
+  expecteq(0.0, vecSigma(&ei, l, 1, -1));
+  expecteq(true, isnan(vecSigma(&ei, l, 1, INFINITY)));
+  vecRelease();
+}
+
+test (vec_reduce) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  vec_t *v = vecRange(1, 20000);
+  lambda_t const *add = lmdIntern("$1 $2 +", 7);
+  expecteq(200010005.0, vecReduce(&ei, add, v, 5, false));
+  expecteq(200010005.0, vecReduce(&ei, add, v, 5, true));
+  lambda_t const *sub = lmdIntern("$1 $2 -", 7);
+  expecteq(vecReduce(&ei, sub, v, 5, false), vecReduce(&ei, sub, v, 5, true));
+  expecteq(10005.0, vecReduce(&ei, sub, v, 5, true));
+  vecRelease();
+}
+
+test (vec_map_rand) {
+  machine_t ei;
+  initEvalinfo(&ei);
+  vec_t *v = vecMapLmd(&ei, lmdIntern("@r", 2), vecRange(1, 4 * chunk_len));
+  expect(0 < vecExtreme(v, false)); // every pool worker is seeded
+  vecRelease();
+}
+
+bench (vec_square_sum) {
+  vec_t *v = vecRange(1, 100000);
+  real_t sq = vecFold(VOP_POW, (real_t[]){vecVal(v), num(2)}, 2);
+  vecFold(VOP_ADD, &sq, 1);
+  vecRelease();
+}
+
+bench (vec_lazy_square_sum) {
+  vec_t *v = vecLazyRange(1, 100000);
+  real_t sq = vecFold(VOP_POW, (real_t[]){vecVal(v), num(2)}, 2);
+  vecFold(VOP_ADD, &sq, 1);
+  vecRelease();
+}
@@ -0,0 +1,250 @@
+/**
+ * @file src/writer.c
+ * @brief Define per-thread output buffer and number formatters
+ */
+
+#include "writer.h"
+#include "benchmarking.h"
+#include "chore.h"
+#include "mathdef.h"
+#include "testing.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+  char buf[writer_size];
+  size_t len;
+  int fd;
+} writer_t;
+
+static thread_local writer_t writer = {.fd = STDOUT_FILENO};
+
+/**
+ * @brief Write the digits of n backwards from end
+ * @return Start of the digits
+ */
+static char *fmtDigits(unsigned long n, char *end) {
+  do *--end = (char)('0' + n % 10);
+  while (n /= 10);
+  return end;
+}
+
+/**
+ * @brief Format integer without stdio
+ * @param[in] n Integer
+ * @param[out] buf Destination (at least fmt_size bytes)
+ * @return Length of the output (not NUL terminated)
+ */
+size_t fmtInt(long n, char *buf) {
+  char tmp[fmt_size];
+  char *end = tmp + fmt_size;
+  unsigned long mag = n < 0 ? -(unsigned long)n : (unsigned long)n;
+  char *p = fmtDigits(mag, end);
+  if (n < 0) *--p = '-';
+  size_t len = (size_t)(end - p);
+  memcpy(buf, p, len);
+  return len;
+}
+
+constexpr double pow10tbl[] = {
+  1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,
+  1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+};
+constexpr double exact_int_max = 9007199254740992.0; // 2^53
+
+/**
+ * @brief Shortest decimal with few significant digits
+ * @return Length, or 0 if x needs the slow path
+ * @note Tries the fewest fractional digits k such that round(x*10^k)/10^k
+ *       is x exactly. Both operands of that division are exact, so the
+ *       correctly rounded strtod of the printed digits gives x back.
+ */
+static size_t fmtRealFast(double x, char *buf) {
+#pragma clang fp reciprocal(off) // -ffast-math would multiply by 10^-k
+  if (1e15 <= x) return 0;
+  for (size_t k = 0; k < sizeof pow10tbl / sizeof *pow10tbl; k++) {
+    double m = nearbyint(x * pow10tbl[k]);
+    if (exact_int_max <= m) return 0;
+    if (m / pow10tbl[k] != x) continue;
+
+    char tmp[fmt_size];
+    char *end = tmp + fmt_size;
+    char *p = fmtDigits((unsigned long)m, end);
+    for (; (size_t)(end - p) <= k; *--p = '0'); // leading zeros of 0.00ddd
+    size_t intlen = (size_t)(end - p) - k;
+    memcpy(buf, p, intlen);
+    if (k == 0) return intlen;
+    buf[intlen] = '.';
+    memcpy(buf + intlen + 1, p + intlen, k);
+    return intlen + 1 + k;
+  }
+  return 0;
+}
+
+/**
+ * @brief Round-trip representation with 15 to 17 significant digits
+ */
+static size_t fmtRealSlow(double x, char *buf) {
+  int len = 0;
+  for (int prec = 15; prec <= 17; prec++) {
+    len = snprintf(buf, fmt_size, "%.*g", prec, x);
+    if (strtod(buf, nullptr) == x) break;
+  }
+  return (size_t)len;
+}
+
+/**
+ * @brief Format double as the shortest string that reads back exactly
+ * @param[in] x Value
+ * @param[out] buf Destination (at least fmt_size bytes)
+ * @return Length of the output (not NUL terminated)
+ */
+size_t fmtReal(double x, char *buf) {
+  char *p = buf;
+  if (signbit(x) && !isnan(x)) *p++ = '-';
+  x = fabs(x);
+  size_t sign = (size_t)(p - buf);
+  if (isnan(x) || isinf(x)) {
+    memcpy(p, isnan(x) ? "nan" : "inf", 3);
+    return sign + 3;
+  }
+  if (x == 0) {
+    *p = '0';
+    return sign + 1;
+  }
+  return sign + (fmtRealFast(x, p) ?: fmtRealSlow(x, p));
+}
+
+static char *fmtRealStr(double x) {
+  static char buf[fmt_size + 1];
+  buf[fmtReal(x, buf)] = '\0';
+  return buf;
+}
+
+test_table(
+  fmt_real, fmtRealStr, (char *, double),
+  {
+    {                "0.5",        0.5},
+    {                "0.1",        0.1},
+    {              "0.001",      0.001},
+    {              "-2.25",      -2.25},
+    {         "123456.789", 123456.789},
+    {"0.30000000000000004",  0.1 + 0.2},
+    {             "1e+100",      1e100},
+    {          "0.0000001",       1e-7},
+    {                "nan",        NAN},
+    {               "-inf",  -INFINITY},
+}
+)
+
+//! @brief Random doubles, half with few digits for the fast path
+test (fmt_real_roundtrip) {
+  uint64_t s = 0x2545'F491'4F6C'DD1D;
+  size_t bad = 0;
+  for (size_t i = 0; i < 100'000; i++) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    double x = (double)(s >> 40) / pow10tbl[s & 15];
+    if (i & 1) memcpy(&x, &s, sizeof x);
+    if (!isfinite(x)) continue;
+    char buf[fmt_size + 1];
+    buf[fmtReal(x, buf)] = '\0';
+    if (strtod(buf, nullptr) != x) bad++;
+  }
+  expecteq(0, bad);
+}
+
+static char *fmtIntStr(long n) {
+  static char buf[fmt_size + 1];
+  buf[fmtInt(n, buf)] = '\0';
+  return buf;
+}
+
+test_table(
+  fmt_int, fmtIntStr, (char *, long),
+  {
+    {   "0",    0},
+    {  "42",   42},
+    {"-100", -100},
+}
+)
+
+bench (fmt_real) {
+  char buf[fmt_size];
+  _ = fmtReal(3.14159, buf);
+  _ = fmtReal(0.1 + 0.2, buf);
+  _ = fmtReal(27.142857142857142, buf);
+}
+
+bench (printf_real) {
+  char buf[fmt_size];
+  _ = snprintf(buf, fmt_size, "%lf", 3.14159);
+  _ = snprintf(buf, fmt_size, "%lf", 0.1 + 0.2);
+  _ = snprintf(buf, fmt_size, "%lf", 27.142857142857142);
+}
+
+/**
+ * @brief Write the buffer out
+ * @note Pending stdio output is flushed first so that the order is kept
+ */
+void flushWriter() {
+  if (writer.len == 0) return;
+  if (writer.fd == STDOUT_FILENO) fflush(stdout);
+  for (size_t done = 0; done < writer.len;) {
+    ssize_t n = write(writer.fd, writer.buf + done, writer.len - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) [[clang::unlikely]]
+      break;
+    done += (size_t)n;
+  }
+  writer.len = 0;
+}
+
+/**
+ * @brief Redirect the writer of the current thread
+ * @param[in] fd Destination file descriptor
+ * @return Previous destination
+ */
+int setWriterFd(int fd) {
+  flushWriter();
+  int prev = writer.fd;
+  writer.fd = fd;
+  return prev;
+}
+
+void writeBytes(void const *src, size_t len) {
+  if (writer_size - writer.len < len) flushWriter();
+  if (writer_size < len) [[clang::unlikely]] {
+    for (size_t done = 0; done < len;) {
+      ssize_t n = write(writer.fd, (char const *)src + done, len - done);
+      if (n <= 0) break;
+      done += (size_t)n;
+    }
+    return;
+  }
+  memcpy(writer.buf + writer.len, src, len);
+  writer.len += len;
+}
+
+void writeStr(char const *s) {
+  writeBytes(s, strlen(s));
+}
+
+void writeChar(char c) {
+  if (writer.len == writer_size) flushWriter();
+  writer.buf[writer.len++] = c;
+}
+
+void writeInt(long n) {
+  if (writer_size - writer.len < fmt_size) flushWriter();
+  writer.len += fmtInt(n, writer.buf + writer.len);
+}
+
+void writeReal(double x) {
+  if (writer_size - writer.len < fmt_size) flushWriter();
+  writer.len += fmtReal(x, writer.buf + writer.len);
+}